@@ -0,0 +1,120 @@
+/*
+ * spiXfer.c:
+ *	Compare SPI throughput of wiringPiSPIDataRW (which needs the command
+ *	copied into a scratch buffer and the reply copied back out) against
+ *	wiringPiSPIXfer with separate transmit and receive buffers.
+ *
+ *	Connect MOSI to MISO to check the received data as well, otherwise
+ *	the numbers are still valid but the verify column will show "no".
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <wiringPi.h>
+#include <wiringPiSPI.h>
+
+#define	SPI_CHAN		0
+#define	SPI_SPEED		16000000
+#define	NUM_TIMES		200
+#define	MAX_SIZE		4096
+
+static unsigned char txBuf   [MAX_SIZE] __attribute__((aligned(64))) ;
+static unsigned char rxBuf   [MAX_SIZE] __attribute__((aligned(64))) ;
+static unsigned char scratch [MAX_SIZE] ;
+
+
+/*
+ * runTest:
+ *	Time NUM_TIMES transfers of size bytes and return uS per transfer
+ *********************************************************************************
+ */
+
+static double runTest (int size, int useXfer)
+{
+  unsigned int start, end ;
+  int times ;
+
+  start = micros () ;
+  for (times = 0 ; times < NUM_TIMES ; ++times)
+  {
+    if (useXfer)
+    {
+      if (wiringPiSPIXfer (SPI_CHAN, txBuf, rxBuf, size) < 0)
+	return -1.0 ;
+    }
+    else
+    {
+      memcpy (scratch, txBuf, size) ;
+      if (wiringPiSPIDataRW (SPI_CHAN, scratch, size) < 0)
+	return -1.0 ;
+      memcpy (rxBuf, scratch, size) ;
+    }
+  }
+  end = micros () ;
+
+  return (double)(end - start) / (double)NUM_TIMES ;
+}
+
+
+int main (void)
+{
+  int size, i ;
+  double tRW, tXfer ;
+
+  wiringPiSetup () ;
+
+  if (wiringPiSPISetup (SPI_CHAN, SPI_SPEED) < 0)
+  {
+    fprintf (stderr, "Can't open the SPI bus: %s\n", strerror (errno)) ;
+    return EXIT_FAILURE ;
+  }
+
+  for (i = 0 ; i < MAX_SIZE ; ++i)
+    txBuf [i] = i * 7 + 3 ;
+
+  printf ("+--------+------------+------------+-----------+-----------+--------+\n") ;
+  printf ("|   Size | DataRW uS  |  Xfer uS   |   RW MB/s | Xfer MB/s | Verify |\n") ;
+  printf ("+--------+------------+------------+-----------+-----------+--------+\n") ;
+
+  for (size = 16 ; size <= MAX_SIZE ; size *= 2)
+  {
+    tRW   = runTest (size, FALSE) ;
+    memset (rxBuf, 0, size) ;
+    tXfer = runTest (size, TRUE) ;
+
+    if ((tRW < 0) || (tXfer < 0))
+    {
+      printf ("SPI failure: %s\n", strerror (errno)) ;
+      break ;
+    }
+
+    printf ("| %6d | %10.2f | %10.2f | %9.3f | %9.3f | %6s |\n", size,
+	tRW, tXfer, (double)size / tRW, (double)size / tXfer,
+	memcmp (txBuf, rxBuf, size) == 0 ? "ok" : "no") ;
+  }
+  printf ("+--------+------------+------------+-----------+-----------+--------+\n") ;
+
+  return 0 ;
+}
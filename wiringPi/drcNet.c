@@ -22,15 +22,29 @@
  ***********************************************************************
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <crypt.h>
 
 
@@ -38,23 +52,222 @@
 #include "drcNet.h"
 #include "../wiringPiD/drcNetCmd.h"
 
+// Each node has a connection to its server. The sockets are non-blocking
+//	and everything done on them has a timeout, after which the server is
+//	taken to have gone: the connection is dropped, and a thread of its
+//	own keeps trying to make it again, authenticating and watching the
+//	same pins as before, while the node's functions fail straight away.
+//
+//	Commands waiting for replies each have a slot in pending, found by
+//	sequence number. Protocol 3 servers send the number back with the
+//	reply; older ones reply in order, so the next one is worked out.
+//	Whoever is waiting reads replies for everyone, or the edge reader
+//	thread once the node has pins watched.
+
+#define	MAX_NODES	64
+#define	MAX_PENDING	64		// Commands waiting for replies at once; a power of 2
+#define	SEQ_MAX		(DRCN_SEQ_MASK >> DRCN_SEQ_SHIFT)
+
+#define	DEFAULT_TIMEOUT	500		// mS
+#define	RETRY_MIN	100		// mS between attempts to connect again, doubling
+#define	RETRY_MAX	2000		//  up to this
+
+#define	EDGE_QUEUE	256
+
+#define	PENDING_FREE	0
+#define	PENDING_WAITING	1
+#define	PENDING_DONE	2
+#define	PENDING_FAILED	3
+
+struct drcNetPendingStruct
+{
+  uint32_t seq ;
+  int      state ;
+  uint32_t data ;
+} ;
+
+struct drcNetConnStruct
+{
+  struct wiringPiNodeStruct *node ;
+
+// What it takes to connect again: a TCP server, or a UNIX socket
+
+  char *host, *port, *password ;
+  char *path ;
+  int   wantRing ;
+
+  volatile int fd ;
+  int   oldFd ;				// Dropped; closed once no one is using it
+  int   protocol, timeout, cork ;
+
+  pthread_mutex_t sendLock ;		// One sender at a time
+  pthread_mutex_t lock ;		// Everything else
+  pthread_cond_t  cond ;
+
+  int      reading ;			// Someone is reading the replies
+  unsigned char in [sizeof (struct drcNetComStruct)] ;
+  int      inLen ;			// Part of a reply read so far
+  uint32_t nextSeq, nextReply ;
+  struct drcNetPendingStruct pending [MAX_PENDING] ;
+
+// A local node's shared memory ring, one writer at a time
+
+  struct drcNetRingStruct *ring ;
+  pthread_mutex_t ringLock ;
+
+// Edges are queued for a thread of their own to run the handlers, so
+//	that they can use the node themselves
+
+  int    edges ;
+  pthread_cond_t edgeCond ;
+  struct drcNetComStruct queue [EDGE_QUEUE] ;
+  int    queueHead, queueLen ;
+  int   *modes ;
+  void (**functions)(int pin, int level, unsigned int micros, void *userData) ;
+  void  **userData ;
+} ;
+
+static struct drcNetConnStruct *conns [MAX_NODES] ;
+static int numConns = 0 ;
+static pthread_mutex_t connsLock = PTHREAD_MUTEX_INITIALIZER ;
+
+static int connectNode (struct drcNetConnStruct *c, int *protocol, struct drcNetRingStruct **ring) ;
+
+
+/*
+ * nowMs:
+ *	Monotonic time in mS, for deadlines
+ *********************************************************************************
+ */
+
+static int64_t nowMs (void)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 ;
+}
+
+
+/*
+ * waitFd:
+ *	Wait for a socket to be ready, until deadline (or forever if that is
+ *	negative). Fails with ETIMEDOUT.
+ *********************************************************************************
+ */
+
+static int waitFd (int fd, short events, int64_t deadline)
+{
+  struct pollfd pfd ;
+  int64_t left ;
+  int r ;
+
+  pfd.fd     = fd ;
+  pfd.events = events ;
+
+  for (;;)
+  {
+    left = -1 ;
+    if (deadline >= 0)
+      if ((left = deadline - nowMs ()) < 0)
+	left = 0 ;
+
+    if ((r = poll (&pfd, 1, (int)left)) > 0)
+      return 0 ;
+
+    if (r == 0)
+    {
+      errno = ETIMEDOUT ;
+      return -1 ;
+    }
+
+    if (errno != EINTR)
+      return -1 ;
+  }
+}
+
+
+/*
+ * sendAll: recvAll:
+ *	Move all of len bytes on a non-blocking socket, waiting no longer
+ *	than timeout mS, or until deadline, for it to be ready
+ *********************************************************************************
+ */
+
+static int sendAll (int fd, const void *buf, int len, int timeout)
+{
+  const char *p = buf ;
+  int64_t deadline = -1 ;
+  ssize_t n ;
+
+  while (len > 0)
+  {
+    if ((n = send (fd, p, len, MSG_NOSIGNAL | MSG_DONTWAIT)) > 0)
+    {
+      p   += n ;
+      len -= n ;
+      continue ;
+    }
+
+    if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+      return -1 ;
+
+    if (deadline < 0)
+      deadline = nowMs () + timeout ;
+
+    if (waitFd (fd, POLLOUT, deadline) < 0)
+      return -1 ;
+  }
+
+  return 0 ;
+}
+
+static int recvAll (int fd, void *buf, int len, int64_t deadline)
+{
+  char *p = buf ;
+  ssize_t n ;
+
+  while (len > 0)
+  {
+    if (waitFd (fd, POLLIN, deadline) < 0)
+      return -1 ;
+
+    if ((n = recv (fd, p, len, MSG_DONTWAIT)) == 0)
+    {
+      errno = ECONNRESET ;
+      return -1 ;
+    }
+
+    if (n > 0)
+    {
+      p   += n ;
+      len -= n ;
+    }
+    else if ((errno != EAGAIN) && (errno != EINTR))
+      return -1 ;
+  }
+
+  return 0 ;
+}
+
 
 /*
  * remoteReadline:
  *	Read in a line of data from the remote server, ending with a newline
  *	character which is not stored. Returns the length or < 0 on
- *	any sort of failure.
+ *	any sort of failure, including nothing by the deadline.
  *********************************************************************************
  */
 
-static int remoteReadline (int fd, char *buf, int max)
+static int remoteReadline (int fd, char *buf, int max, int64_t deadline)
 {
   int  len = 0 ;
   char c ;
 
   for (;;)
   {
-    if (read (fd, &c, 1) < 1)
+    if (recvAll (fd, &c, 1, deadline) < 0)
       return -1 ;
 
     if (c == '\n')
@@ -70,21 +283,28 @@ static int remoteReadline (int fd, char *buf, int max)
 /*
  * getChallenge:
  *	Read in lines from the remote site until we get one identified
- *	as the challenge. This line contains the password salt.
+ *	as the challenge. This line contains the password salt. Newer
+ *	servers say which protocol they talk on the way; older ones don't
+ *	and are protocol 1.
  *********************************************************************************
  */
 
-static char *getChallenge (int fd)
+static char *getChallenge (int fd, int *protocol, int64_t deadline)
 {
   static char buf [1024] ;
   int num ;
 
+  *protocol = 1 ;
+
   for (;;)
   {
-    if ((num = remoteReadline (fd, buf, 1023)) < 0)
+    if ((num = remoteReadline (fd, buf, 1023, deadline)) < 0)
       return NULL ;
     buf [num] = 0 ;
 
+    if (strncmp (buf, "200 Protocol ", 13) == 0)
+      *protocol = atoi (&buf [13]) ;
+
     if (strncmp (buf, "Challenge ", 10) == 0)
       return &buf [10] ;
   }
@@ -100,14 +320,22 @@ static char *getChallenge (int fd)
  *********************************************************************************
  */
 
-static int authenticate (int fd, const char *pass)
+static int authenticate (int fd, const char *pass, int *protocol, int timeout)
 {
+  static pthread_mutex_t cryptLock = PTHREAD_MUTEX_INITIALIZER ;
   char *challenge ;
   char *encrypted ;
   char salted [1024] ;
+  char response [86] ;
+  int  ok ;
+
+  pthread_mutex_lock (&cryptLock) ;	// getChallenge and crypt return static buffers
 
-  if ((challenge = getChallenge (fd)) == NULL)
+  if ((challenge = getChallenge (fd, protocol, nowMs () + timeout)) == NULL)
+  {
+    pthread_mutex_unlock (&cryptLock) ;
     return -1 ;
+  }
 
   snprintf (salted, 1024, "$6$%s$", challenge) ;
   encrypted = crypt (pass, salted) ;
@@ -116,7 +344,13 @@ static int authenticate (int fd, const char *pass)
 //	The '20' comes from the $6$ then the 16 characters of the salt,
 //	then the terminating $.
 
-  if (strncmp (encrypted, salted, 20) != 0)
+  ok = (encrypted != NULL) && (strncmp (encrypted, salted, 20) == 0) ;
+  if (ok)
+    memcpy (response, encrypted + 20, 86) ;
+
+  pthread_mutex_unlock (&cryptLock) ;
+
+  if (!ok)
   {
     errno = EBADE ;
     return -1 ;
@@ -124,26 +358,59 @@ static int authenticate (int fd, const char *pass)
 
 // 86 characters is the length of the SHA-256 hash
 
-  if (write (fd, encrypted + 20, 86) == 86)
+  return sendAll (fd, response, 86, timeout) ;
+}
+
+
+/*
+ * connectTimeout:
+ *	Connect a non-blocking socket, giving up after timeout mS
+ *********************************************************************************
+ */
+
+static int connectTimeout (int fd, const struct sockaddr *addr, socklen_t len, int timeout)
+{
+  socklen_t errLen = sizeof (int) ;
+  int err = 0 ;
+
+  if (connect (fd, addr, len) == 0)
     return 0 ;
-  else
+
+  if (errno != EINPROGRESS)
+    return -1 ;
+
+  if (waitFd (fd, POLLOUT, nowMs () + timeout) < 0)
+    return -1 ;
+
+  if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0)
+    return -1 ;
+
+  if (err != 0)
+  {
+    errno = err ;
     return -1 ;
+  }
+
+  return 0 ;
 }
 
 
 /*
  * _drcSetupNet:
  *	Do the hard work of establishing a network connection and authenticating
- *	the password.
+ *	the password, each step within timeout mS. Commands are small and
+ *	want to go straight out, so Nagle is turned off. The socket is left
+ *	non-blocking.
  *********************************************************************************
  */
 
-int _drcSetupNet (const char *ipAddress, const char *port, const char *password)
+int _drcSetupNet (const char *ipAddress, const char *port, const char *password, int *protocol, int timeout)
 {
   struct addrinfo hints;
   struct addrinfo *result, *rp ;
   struct in6_addr serveraddr ;
   int remoteFd ;
+  int on = 1 ;
 
 // Start by seeing if we've been given a (textual) numeric IP address
 //	which will save lookups in getaddrinfo()
@@ -177,13 +444,19 @@ int _drcSetupNet (const char *ipAddress, const char *port, const char *password)
 
   for (rp = result; rp != NULL; rp = rp->ai_next)
   {
-    if ((remoteFd = socket (rp->ai_family, rp->ai_socktype, rp->ai_protocol)) < 0)
+    if ((remoteFd = socket (rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol)) < 0)
       continue ;
 
-    if (connect (remoteFd, rp->ai_addr, rp->ai_addrlen) < 0)
+    if ((connectTimeout (remoteFd, rp->ai_addr, rp->ai_addrlen, timeout) < 0) ||
+        (setsockopt (remoteFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on)) < 0))
+    {
+      close (remoteFd) ;
       continue ;
+    }
+
+    freeaddrinfo (result) ;
 
-    if (authenticate (remoteFd, password) < 0)
+    if (authenticate (remoteFd, password, protocol, timeout) < 0)
     {
       close (remoteFd) ;
       errno = EACCES ;		// Permission denied
@@ -193,213 +466,1308 @@ int _drcSetupNet (const char *ipAddress, const char *port, const char *password)
       return remoteFd ;
   }
 
+  freeaddrinfo (result) ;
+
   errno = EHOSTUNREACH ;	// Host unreachable - may not be right, but good enough
   return -1 ; // Nothing connected
 }
 
 
 /*
- * myPinMode:
- *	Change the pin mode on the remote DRC device
+ * localGreeting:
+ *	Read the lines a local server sends until it says we can start. It
+ *	just hangs up on those it won't let in.
  *********************************************************************************
  */
 
-static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
+static int localGreeting (int fd, int *protocol, int timeout)
 {
-  struct drcNetComStruct cmd ;
+  char buf [1024] ;
+  int64_t deadline = nowMs () + timeout ;
+  int num ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_PIN_MODE ;
-  cmd.data = mode ;
+  *protocol = 1 ;
+
+  for (;;)
+  {
+    if ((num = remoteReadline (fd, buf, 1023, deadline)) < 0)
+    {
+      errno = EACCES ;
+      return -1 ;
+    }
+    buf [num] = 0 ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+    if (strncmp (buf, "200 Protocol ", 13) == 0)
+      *protocol = atoi (&buf [13]) ;
+
+    if (strcmp (buf, "200 Ready") == 0)
+      return 0 ;
+  }
 }
 
 
 /*
- * myPullUpDnControl:
+ * _drcSetupLocal:
+ *	Connect to the UNIX socket of the wiringPiD on this machine. No
+ *	password: the daemon goes by who we are.
  *********************************************************************************
  */
 
-static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mode)
+static int _drcSetupLocal (const char *path, int *protocol, int timeout)
 {
-  struct drcNetComStruct cmd ;
+  struct sockaddr_un addr ;
+  int fd ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_PULL_UP_DN ;
-  cmd.data = mode ;
+  if (strlen (path) >= sizeof (addr.sun_path))
+  {
+    errno = ENAMETOOLONG ;
+    return -1 ;
+  }
+
+  memset (&addr, 0, sizeof (addr)) ;
+  addr.sun_family = AF_UNIX ;
+  strcpy (addr.sun_path, path) ;
+
+  if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    return -1 ;
+
+  if ((connectTimeout (fd, (struct sockaddr *)&addr, sizeof (addr), timeout) < 0) ||
+      (localGreeting (fd, protocol, timeout) < 0))
+  {
+    close (fd) ;
+    return -1 ;
+  }
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  return fd ;
 }
 
 
 /*
- * myDigitalWrite:
+ * startRing:
+ *	Make a ring in a memfd, sealed so that it can't be shrunk under the
+ *	daemon, and pass it over the socket.
  *********************************************************************************
  */
 
-static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
+static struct drcNetRingStruct *startRing (int fd, int timeout)
 {
-  struct drcNetComStruct cmd ;
+  struct drcNetRingStruct *ring ;
+  struct drcNetComStruct cmd = { 0, DRCN_RING, 0 } ;
+  union
+  {
+    char buf [CMSG_SPACE (sizeof (int))] ;
+    struct cmsghdr align ;
+  } control ;
+  struct msghdr msg ;
+  struct iovec iov ;
+  struct cmsghdr *cmsg ;
+  int ringFd ;
+
+  if ((ringFd = memfd_create ("wiringPiD-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    return NULL ;
+
+  if ((ftruncate (ringFd, sizeof (*ring)) < 0) ||
+      (fcntl (ringFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0) ||
+      ((ring = mmap (NULL, sizeof (*ring), PROT_READ | PROT_WRITE, MAP_SHARED, ringFd, 0)) == MAP_FAILED))
+  {
+    close (ringFd) ;
+    return NULL ;
+  }
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_DIGITAL_WRITE ;
-  cmd.data = value ;
+  iov.iov_base = &cmd ;
+  iov.iov_len  = sizeof (cmd) ;
+
+  memset (&msg, 0, sizeof (msg)) ;
+  msg.msg_iov        = &iov ;
+  msg.msg_iovlen     = 1 ;
+  msg.msg_control    = control.buf ;
+  msg.msg_controllen = sizeof (control.buf) ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  cmsg = CMSG_FIRSTHDR (&msg) ;
+  cmsg->cmsg_level = SOL_SOCKET ;
+  cmsg->cmsg_type  = SCM_RIGHTS ;
+  cmsg->cmsg_len   = CMSG_LEN (sizeof (int)) ;
+  memcpy (CMSG_DATA (cmsg), &ringFd, sizeof (int)) ;
+
+  if ((sendmsg (fd, &msg, MSG_NOSIGNAL) != sizeof (cmd)) ||
+      (recvAll (fd, &cmd, sizeof (cmd), nowMs () + timeout) < 0) || (cmd.data != 0))
+  {
+    close (ringFd) ;
+    munmap (ring, sizeof (*ring)) ;
+    errno = EPROTO ;
+    return NULL ;
+  }
+
+  close (ringFd) ;
+
+  return ring ;
 }
 
 
 /*
- * myDigitalWrite8:
+ * queueEdge:
+ *	Hand an edge notification to the thread running the handlers. Called
+ *	with the lock held.
  *********************************************************************************
+ */
 
-static void myDigitalWrite8 (struct wiringPiNodeStruct *node, int pin, int value)
+static void queueEdge (struct drcNetConnStruct *c, struct drcNetComStruct *edge)
 {
-  struct drcNetComStruct cmd ;
+  if (c->queueLen == EDGE_QUEUE)	// The handlers are too slow; drop it
+    return ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_DIGITAL_WRITE8 ;
-  cmd.data = value ;
+  c->queue [(c->queueHead + c->queueLen) % EDGE_QUEUE] = *edge ;
+  ++c->queueLen ;
+  pthread_cond_signal (&c->edgeCond) ;
+}
+
+static int isEdge (struct drcNetComStruct *cmd)
+{
+  uint32_t command = cmd->cmd & DRCN_CMD_MASK ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  return (command == DRCN_EDGE_RISING) || (command == DRCN_EDGE_FALLING) ;
 }
- */
 
 
 /*
- * myAnalogWrite:
+ * dispatch:
+ *	Sort out something the server sent: an edge, or the reply to one of
+ *	the commands waiting. Called with the lock held.
  *********************************************************************************
  */
 
-static void myAnalogWrite (struct wiringPiNodeStruct *node, int pin, int value)
+static void dispatch (struct drcNetConnStruct *c, struct drcNetComStruct *cmd)
 {
-  struct drcNetComStruct cmd ;
+  struct drcNetPendingStruct *p ;
+  uint32_t seq ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_ANALOG_WRITE ;
-  cmd.data = value ;
+  if (isEdge (cmd))
+  {
+    queueEdge (c, cmd) ;
+    return ;
+  }
+
+  if (c->protocol >= 3)
+    seq = (cmd->cmd & DRCN_SEQ_MASK) >> DRCN_SEQ_SHIFT ;
+  else
+    seq = c->nextReply ;
+  c->nextReply = (seq + 1) & SEQ_MAX ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  p = &c->pending [seq & (MAX_PENDING - 1)] ;
+  if ((p->state == PENDING_WAITING) && (p->seq == seq))
+  {
+    p->data  = cmd->data ;
+    p->state = PENDING_DONE ;
+    pthread_cond_broadcast (&c->cond) ;
+  }
 }
 
 
 /*
- * myPwmWrite:
+ * readReplies:
+ *	Read what the server has sent, waiting for it until deadline, and
+ *	dispatch it. Only one thread at a time does this, the one that has
+ *	set reading.
  *********************************************************************************
  */
 
-static void myPwmWrite (struct wiringPiNodeStruct *node, int pin, int value)
+static int readReplies (struct drcNetConnStruct *c, int fd, int64_t deadline)
 {
+  unsigned char buf [sizeof (struct drcNetComStruct) * 64] ;
   struct drcNetComStruct cmd ;
+  ssize_t len ;
+  int pos ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_PWM_WRITE ;
-  cmd.data = value ;
+  if (waitFd (fd, POLLIN, deadline) < 0)
+    return -1 ;
+
+  memcpy (buf, c->in, c->inLen) ;
+
+  if ((len = recv (fd, buf + c->inLen, sizeof (buf) - c->inLen, MSG_DONTWAIT)) == 0)
+  {
+    errno = ECONNRESET ;
+    return -1 ;
+  }
+
+  if (len < 0)
+    return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1 ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  len += c->inLen ;
+
+  pthread_mutex_lock (&c->lock) ;
+  for (pos = 0 ; pos + (int)sizeof (cmd) <= len ; pos += sizeof (cmd))
+  {
+    memcpy (&cmd, buf + pos, sizeof (cmd)) ;
+    dispatch (c, &cmd) ;
+  }
+  pthread_mutex_unlock (&c->lock) ;
+
+  c->inLen = len - pos ;
+  memcpy (c->in, buf + pos, c->inLen) ;
+
+  return 0 ;
 }
 
 
 /*
- * myAnalogRead:
+ * reconnect:
+ *	Thread started when a connection is dropped. It waits for everyone to
+ *	let go of the old socket, then tries to connect again, less often
+ *	the longer the server is away.
  *********************************************************************************
  */
 
-static int myAnalogRead (struct wiringPiNodeStruct *node, int pin)
+static void *reconnect (void *arg)
 {
-  struct drcNetComStruct cmd ;
+  struct drcNetConnStruct *c = (struct drcNetConnStruct *)arg ;
+  struct drcNetRingStruct *ring ;
+  int fd, protocol ;
+  int backoff = RETRY_MIN ;
+
+  pthread_mutex_lock (&c->sendLock) ;
+  pthread_mutex_lock (&c->lock) ;
+  while (c->reading)
+    pthread_cond_wait (&c->cond, &c->lock) ;
+  close (c->oldFd) ;
+  c->oldFd = -1 ;
+  c->inLen = 0 ;
+  pthread_mutex_unlock (&c->lock) ;
+  pthread_mutex_unlock (&c->sendLock) ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_ANALOG_READ ;
-  cmd.data = 0 ;
+  for (;;)
+  {
+    delay (backoff) ;
+
+    if ((fd = connectNode (c, &protocol, &ring)) >= 0)
+      break ;
+
+    if ((backoff *= 2) > RETRY_MAX)
+      backoff = RETRY_MAX ;
+  }
+
+  pthread_mutex_lock (&c->ringLock) ;
+  pthread_mutex_lock (&c->lock) ;
+
+  if (c->ring != NULL)
+    munmap (c->ring, sizeof (*c->ring)) ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  c->ring      = ring ;
+  c->protocol  = protocol ;
+  c->nextReply = c->nextSeq ;
+  c->fd        = fd ;
+  c->node->fd  = fd ;
 
-  return cmd.data ;
+  pthread_cond_broadcast (&c->cond) ;
+
+  pthread_mutex_unlock (&c->lock) ;
+  pthread_mutex_unlock (&c->ringLock) ;
+
+  return NULL ;
 }
 
 
 /*
- * myDigitalRead:
+ * dropConnection:
+ *	Give up on a connection that has failed or timed out, failing the
+ *	commands waiting on it, and start trying to make it again. The
+ *	socket is only shut down here, as others may still be in the middle
+ *	of using it; it is closed by the reconnect thread. Called with the
+ *	lock held.
  *********************************************************************************
  */
 
-static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
+static void dropConnection (struct drcNetConnStruct *c, int fd)
 {
-  struct drcNetComStruct cmd ;
+  pthread_t thread ;
+  int i ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_DIGITAL_READ ;
-  cmd.data = 0 ;
+  if ((fd < 0) || (c->fd != fd))	// Already gone
+    return ;
+
+  shutdown (fd, SHUT_RDWR) ;
+
+  c->oldFd    = fd ;
+  c->fd       = -1 ;
+  c->node->fd = -1 ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  for (i = 0 ; i < MAX_PENDING ; ++i)
+    if (c->pending [i].state == PENDING_WAITING)
+      c->pending [i].state = PENDING_FAILED ;
 
-  return cmd.data ;
+  pthread_cond_broadcast (&c->cond) ;
+
+  if (pthread_create (&thread, NULL, reconnect, c) == 0)
+    pthread_detach (thread) ;
 }
 
 
 /*
- * myDigitalRead8:
+ * waitCond:
+ *	Wait for something to change on a connection, until deadline, after
+ *	which it fails with ETIMEDOUT
  *********************************************************************************
+ */
 
-static unsigned int myDigitalRead8 (struct wiringPiNodeStruct *node, int pin)
+static int waitCond (struct drcNetConnStruct *c, int64_t deadline)
 {
-  struct drcNetComStruct cmd ;
+  struct timespec ts ;
 
-  cmd.pin  = pin - node->pinBase ;
-  cmd.cmd  = DRCN_DIGITAL_READ8 ;
-  cmd.data = 0 ;
+  ts.tv_sec  = deadline / 1000 ;
+  ts.tv_nsec = (deadline % 1000) * 1000000 ;
 
-  (void)send (node->fd, &cmd, sizeof (cmd), 0) ;
-  (void)recv (node->fd, &cmd, sizeof (cmd), 0) ;
+  if (pthread_cond_timedwait (&c->cond, &c->lock, &ts) == ETIMEDOUT)
+  {
+    errno = ETIMEDOUT ;
+    return -1 ;
+  }
 
-  return cmd.data ;
+  return 0 ;
 }
- */
 
 
 /*
- * drcNet:
- *	Create a new instance of an DRC GPIO interface.
- *	Could be a variable nunber of pins here - we might not know in advance.
+ * remoteCall:
+ *	Send a command and wait for it to come back, with the result of a
+ *	read in its data. Any number of threads can have commands out at
+ *	once, up to MAX_PENDING. In a batch, the command is pushed out along
+ *	with everything queued before it. Returns -1 with errno ENOTCONN
+ *	when there is no connection, or ETIMEDOUT when the reply doesn't
+ *	come in time - when the connection is dropped.
  *********************************************************************************
  */
 
-int drcSetupNet (const int pinBase, const int numPins, const char *ipAddress, const char *port, const char *password)
+static int remoteCall (struct drcNetConnStruct *c, int pin, int command, int data, uint32_t *result)
 {
-  int fd, len ;
-  struct wiringPiNodeStruct *node ;
+  struct drcNetPendingStruct *p ;
+  struct drcNetComStruct cmd ;
+  int64_t deadline = nowMs () + c->timeout ;
+  uint32_t seq ;
+  int fd, ok, timedOut = FALSE ;
+  int cork = 0 ;
 
-  if ((fd = _drcSetupNet (ipAddress, port, password)) < 0)
-    return FALSE ;
+  pthread_mutex_lock (&c->sendLock) ;
+  pthread_mutex_lock (&c->lock) ;
+
+  while (((fd = c->fd) >= 0) && (c->pending [c->nextSeq & (MAX_PENDING - 1)].state != PENDING_FREE))
+    if (waitCond (c, deadline) < 0)
+    {
+      pthread_mutex_unlock (&c->lock) ;
+      pthread_mutex_unlock (&c->sendLock) ;
+      errno = ETIMEDOUT ;
+      return -1 ;
+    }
 
-  len = sizeof (struct drcNetComStruct) ;
+  if (fd < 0)
+  {
+    pthread_mutex_unlock (&c->lock) ;
+    pthread_mutex_unlock (&c->sendLock) ;
+    errno = ENOTCONN ;
+    return -1 ;
+  }
 
-  if (setsockopt (fd, SOL_SOCKET, SO_RCVLOWAT, (void *)&len, sizeof (len)) < 0)
-    return FALSE ;
+  seq        = c->nextSeq ;
+  c->nextSeq = (seq + 1) & SEQ_MAX ;
+  p          = &c->pending [seq & (MAX_PENDING - 1)] ;
+  p->seq     = seq ;
+  p->state   = PENDING_WAITING ;
 
-  node = wiringPiNewNode (pinBase, numPins) ;
+  pthread_mutex_unlock (&c->lock) ;
 
-  node->fd               = fd ;
-  node->pinMode          = myPinMode ;
-  node->pullUpDnControl  = myPullUpDnControl ;
-  node->analogRead       = myAnalogRead ;
-  node->analogRead       = myAnalogRead ;
-  node->analogWrite      = myAnalogWrite ;
-  node->digitalRead      = myDigitalRead ;
-  node->digitalWrite     = myDigitalWrite ;
-//node->digitalRead8     = myDigitalRead8 ;
-//node->digitalWrite8    = myDigitalWrite8 ;
-  node->pwmWrite         = myPwmWrite ;
+  cmd.pin  = pin ;
+  cmd.cmd  = command ;
+  cmd.data = data ;
+  if (c->protocol >= 3)
+    cmd.cmd |= seq << DRCN_SEQ_SHIFT ;
 
-  return TRUE ;
+  ok = (sendAll (fd, &cmd, sizeof (cmd), c->timeout) == 0) ;
+
+  if (ok && c->cork)	// Uncorking sends what is held; cork again for the next
+  {
+    (void)setsockopt (fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof (cork)) ;
+    cork = 1 ;
+    (void)setsockopt (fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof (cork)) ;
+  }
+
+  pthread_mutex_unlock (&c->sendLock) ;
+
+  pthread_mutex_lock (&c->lock) ;
+
+  if (!ok)
+    dropConnection (c, fd) ;
+
+  while (p->state == PENDING_WAITING)
+  {
+    if (!c->reading)
+    {
+      c->reading = TRUE ;
+      pthread_mutex_unlock (&c->lock) ;
+      ok = (readReplies (c, fd, deadline) == 0) ;
+      pthread_mutex_lock (&c->lock) ;
+      c->reading = FALSE ;
+      pthread_cond_broadcast (&c->cond) ;
+    }
+    else
+      ok = (waitCond (c, deadline) == 0) ;
+
+    if (!ok && (p->state == PENDING_WAITING))
+    {
+      timedOut = (errno == ETIMEDOUT) ;
+      dropConnection (c, fd) ;
+    }
+  }
+
+  ok      = (p->state == PENDING_DONE) ;
+  *result = p->data ;
+  p->state = PENDING_FREE ;
+  pthread_cond_broadcast (&c->cond) ;
+
+  pthread_mutex_unlock (&c->lock) ;
+
+  if (!ok)
+  {
+    errno = timedOut ? ETIMEDOUT : ENOTCONN ;
+    return -1 ;
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * v1Replies:
+ *	Whether a protocol 1 server answers a command. It sets pull ups
+ *	without a word, and the 8, 16 and 32 bit port commands it either
+ *	doesn't know or does nothing for.
+ *********************************************************************************
+ */
+
+static int v1Replies (int command)
+{
+  switch (command)
+  {
+    case DRCN_PIN_MODE:
+    case DRCN_DIGITAL_WRITE:
+    case DRCN_ANALOG_WRITE:
+    case DRCN_PWM_WRITE:
+    case DRCN_DIGITAL_READ:
+    case DRCN_ANALOG_READ:
+      return TRUE ;
+  }
+
+  return FALSE ;
+}
+
+
+/*
+ * remoteCommand:
+ *	remoteCall for the node functions, which have no way to fail: they
+ *	get 0 back, and errno says why. What a protocol 1 server won't
+ *	answer isn't sent, rather than waiting out the timeout for it.
+ *********************************************************************************
+ */
+
+static unsigned int remoteCommand (struct wiringPiNodeStruct *node, int pin, int command, int data)
+{
+  struct drcNetConnStruct *c = conns [node->data2] ;
+  uint32_t result ;
+
+  if ((c->protocol < 2) && !v1Replies (command))
+  {
+    errno = EPROTONOSUPPORT ;
+    return 0 ;
+  }
+
+  if (remoteCall (c, pin - node->pinBase, command, data, &result) < 0)
+    return 0 ;
+
+  return result ;
+}
+
+
+/*
+ * sendCmd:
+ *	Send a command that has no reply
+ *********************************************************************************
+ */
+
+static int sendCmd (struct drcNetConnStruct *c, struct drcNetComStruct *cmd)
+{
+  int fd, ok ;
+
+  pthread_mutex_lock (&c->sendLock) ;
+
+  if ((fd = c->fd) < 0)
+  {
+    pthread_mutex_unlock (&c->sendLock) ;
+    errno = ENOTCONN ;
+    return -1 ;
+  }
+
+  ok = (sendAll (fd, cmd, sizeof (*cmd), c->timeout) == 0) ;
+
+  pthread_mutex_unlock (&c->sendLock) ;
+
+  if (!ok)
+  {
+    pthread_mutex_lock (&c->lock) ;
+    dropConnection (c, fd) ;
+    pthread_mutex_unlock (&c->lock) ;
+    return -1 ;
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * ringWrite:
+ *	Put a command on a local node's ring, and wake the daemon up for it
+ *	if it has gone to sleep - once, by taking the sleeping flag back
+ *	down. When the ring is full, wait for the daemon to make room rather
+ *	than send it another way, which could get it run out of order, but
+ *	not for longer than the timeout.
+ *********************************************************************************
+ */
+
+static int ringWrite (struct drcNetConnStruct *c, struct drcNetComStruct *cmd)
+{
+  struct drcNetRingStruct *ring ;
+  struct drcNetComStruct kick = { 0, DRCN_RING_KICK | DRCN_NO_REPLY, 0 } ;
+  int64_t deadline = -1 ;
+  int fd ;
+
+  pthread_mutex_lock (&c->ringLock) ;
+
+  if (((fd = c->fd) < 0) || ((ring = c->ring) == NULL))
+  {
+    pthread_mutex_unlock (&c->ringLock) ;
+    errno = ENOTCONN ;
+    return -1 ;
+  }
+
+  while (ring->head - ring->tail >= DRCN_RING_SIZE)
+  {
+    if (__sync_bool_compare_and_swap (&ring->sleeping, TRUE, FALSE))
+      (void)sendCmd (c, &kick) ;
+
+    if (deadline < 0)
+      deadline = nowMs () + c->timeout ;
+    else if (nowMs () > deadline)
+    {
+      pthread_mutex_lock (&c->lock) ;
+      dropConnection (c, fd) ;
+      pthread_mutex_unlock (&c->lock) ;
+      pthread_mutex_unlock (&c->ringLock) ;
+      errno = ETIMEDOUT ;
+      return -1 ;
+    }
+
+    sched_yield () ;
+  }
+
+  ring->cmds [ring->head & (DRCN_RING_SIZE - 1)] = *cmd ;
+  __sync_synchronize () ;
+  ring->head = ring->head + 1 ;
+  __sync_synchronize () ;
+
+  if (__sync_bool_compare_and_swap (&ring->sleeping, TRUE, FALSE))
+    (void)sendCmd (c, &kick) ;
+
+  pthread_mutex_unlock (&c->ringLock) ;
+
+  return 0 ;
+}
+
+
+/*
+ * remoteWrite:
+ *	A command with nothing to come back. Protocol 2 servers are told not
+ *	to reply, so writes go out one after the other without waiting for
+ *	a round trip each. Local nodes with a ring put them on that. A write
+ *	made while the server is away is lost. Protocol 1 servers reply to
+ *	most writes anyway, so those are waited for; a pull up is just sent,
+ *	as it gets no reply, and what they can't do is refused here.
+ *********************************************************************************
+ */
+
+static void remoteWrite (struct wiringPiNodeStruct *node, int pin, int command, int data)
+{
+  struct drcNetConnStruct *c = conns [node->data2] ;
+  struct drcNetComStruct cmd ;
+
+  cmd.pin  = pin - node->pinBase ;
+  cmd.cmd  = command | DRCN_NO_REPLY ;
+  cmd.data = data ;
+
+  if (c->protocol < 2)
+  {
+    if (command != DRCN_PULL_UP_DN)
+      (void)remoteCommand (node, pin, command, data) ;
+    else
+    {
+      cmd.cmd = command ;
+      (void)sendCmd (c, &cmd) ;
+    }
+    return ;
+  }
+
+  if (c->wantRing)
+    (void)ringWrite (c, &cmd) ;
+  else
+    (void)sendCmd (c, &cmd) ;
+}
+
+
+/*
+ * myPinMode:
+ *	Change the pin mode on the remote DRC device
+ *********************************************************************************
+ */
+
+static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
+{
+  remoteWrite (node, pin, DRCN_PIN_MODE, mode) ;
+}
+
+
+/*
+ * myPullUpDnControl:
+ *********************************************************************************
+ */
+
+static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mode)
+{
+  remoteWrite (node, pin, DRCN_PULL_UP_DN, mode) ;
+}
+
+
+/*
+ * myDigitalWrite:
+ *********************************************************************************
+ */
+
+static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  remoteWrite (node, pin, DRCN_DIGITAL_WRITE, value) ;
+}
+
+
+/*
+ * myDigitalWrite8: myDigitalWrite16: myDigitalWrite32:
+ *	A whole port in one command, bit n of value being pin + n
+ *********************************************************************************
+ */
+
+static void myDigitalWrite8  (struct wiringPiNodeStruct *node, int pin, int value) { remoteWrite (node, pin, DRCN_DIGITAL_WRITE8,  value) ; }
+static void myDigitalWrite16 (struct wiringPiNodeStruct *node, int pin, int value) { remoteWrite (node, pin, DRCN_DIGITAL_WRITE16, value) ; }
+static void myDigitalWrite32 (struct wiringPiNodeStruct *node, int pin, int value) { remoteWrite (node, pin, DRCN_DIGITAL_WRITE32, value) ; }
+
+
+/*
+ * myAnalogWrite:
+ *********************************************************************************
+ */
+
+static void myAnalogWrite (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  remoteWrite (node, pin, DRCN_ANALOG_WRITE, value) ;
+}
+
+
+/*
+ * myPwmWrite:
+ *********************************************************************************
+ */
+
+static void myPwmWrite (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  remoteWrite (node, pin, DRCN_PWM_WRITE, value) ;
+}
+
+
+/*
+ * myAnalogRead:
+ *********************************************************************************
+ */
+
+static int myAnalogRead (struct wiringPiNodeStruct *node, int pin)
+{
+  return remoteCommand (node, pin, DRCN_ANALOG_READ, 0) ;
+}
+
+
+/*
+ * myDigitalRead:
+ *********************************************************************************
+ */
+
+static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
+{
+  return remoteCommand (node, pin, DRCN_DIGITAL_READ, 0) ;
+}
+
+
+/*
+ * myDigitalRead8: myDigitalRead16: myDigitalRead32:
+ *********************************************************************************
+ */
+
+static unsigned int myDigitalRead8  (struct wiringPiNodeStruct *node, int pin) { return remoteCommand (node, pin, DRCN_DIGITAL_READ8,  0) ; }
+static unsigned int myDigitalRead16 (struct wiringPiNodeStruct *node, int pin) { return remoteCommand (node, pin, DRCN_DIGITAL_READ16, 0) ; }
+static unsigned int myDigitalRead32 (struct wiringPiNodeStruct *node, int pin) { return remoteCommand (node, pin, DRCN_DIGITAL_READ32, 0) ; }
+
+
+/*
+ * talk:
+ *	Send a command on a connection that is still being set up, and wait
+ *	for its reply. Any edges that come first are queued.
+ *********************************************************************************
+ */
+
+static int talk (struct drcNetConnStruct *c, int fd, struct drcNetComStruct *cmd)
+{
+  struct drcNetComStruct reply ;
+  int64_t deadline = nowMs () + c->timeout ;
+
+  if (sendAll (fd, cmd, sizeof (*cmd), c->timeout) < 0)
+    return -1 ;
+
+  for (;;)
+  {
+    if (recvAll (fd, &reply, sizeof (reply), deadline) < 0)
+      return -1 ;
+
+    if (!isEdge (&reply))
+      break ;
+
+    pthread_mutex_lock (&c->lock) ;
+    queueEdge (c, &reply) ;
+    pthread_mutex_unlock (&c->lock) ;
+  }
+
+  *cmd = reply ;
+
+  return 0 ;
+}
+
+
+/*
+ * connectNode:
+ *	Connect to a node's server and set it up as it was: its ring, the
+ *	batching and the pins being watched. Returns the socket.
+ *********************************************************************************
+ */
+
+static int connectNode (struct drcNetConnStruct *c, int *protocol, struct drcNetRingStruct **ring)
+{
+  struct drcNetComStruct cmd ;
+  int numPins = c->node->pinMax - c->node->pinBase + 1 ;
+  int fd, pin, watched, cork = 1 ;
+
+  *ring = NULL ;
+
+  if (c->path != NULL)
+    fd = _drcSetupLocal (c->path, protocol, c->timeout) ;
+  else
+    fd = _drcSetupNet (c->host, c->port, c->password, protocol, c->timeout) ;
+
+  if (fd < 0)
+    return -1 ;
+
+  if (c->wantRing)
+  {
+    if (*protocol < 2)
+      errno = EPROTONOSUPPORT ;
+    else
+      *ring = startRing (fd, c->timeout) ;
+
+    if (*ring == NULL)
+      goto fail ;
+  }
+
+  if (c->cork && (setsockopt (fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof (cork)) < 0))
+    goto fail ;
+
+  for (pin = 0 ; pin < numPins ; ++pin)
+  {
+    pthread_mutex_lock (&c->lock) ;
+    watched  = (c->functions != NULL) && (c->functions [pin] != NULL) ;
+    cmd.data = watched ? c->modes [pin] : 0 ;
+    pthread_mutex_unlock (&c->lock) ;
+
+    if (!watched)
+      continue ;
+
+    cmd.pin = pin ;
+    cmd.cmd = DRCN_SUBSCRIBE ;
+    if (talk (c, fd, &cmd) < 0)
+      goto fail ;
+  }
+
+  return fd ;
+
+fail:
+  if (*ring != NULL)
+    munmap (*ring, sizeof (**ring)) ;
+  close (fd) ;
+  return -1 ;
+}
+
+
+/*
+ * newNode:
+ *	Make the connection state for a new node, connect it and hang the
+ *	remote functions off it. Could be a variable nunber of pins here -
+ *	we might not know in advance.
+ *********************************************************************************
+ */
+
+static int newNode (struct drcNetConnStruct *c, const int pinBase, const int numPins)
+{
+  struct wiringPiNodeStruct probe ;
+  struct wiringPiNodeStruct *node ;
+  struct drcNetRingStruct *ring ;
+  pthread_condattr_t attr ;
+  int fd, protocol, index ;
+
+  c->fd      = -1 ;
+  c->oldFd   = -1 ;
+  c->timeout = DEFAULT_TIMEOUT ;
+
+  pthread_mutex_init (&c->sendLock, NULL) ;
+  pthread_mutex_init (&c->lock,     NULL) ;
+  pthread_mutex_init (&c->ringLock, NULL) ;
+  pthread_condattr_init     (&attr) ;
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC) ;
+  pthread_cond_init (&c->cond, &attr) ;
+  pthread_condattr_destroy  (&attr) ;
+  pthread_cond_init (&c->edgeCond, NULL) ;
+
+  probe.pinBase = pinBase ;
+  probe.pinMax  = pinBase + numPins - 1 ;
+  c->node       = &probe ;			// Just the pins, for connectNode
+
+  if ((fd = connectNode (c, &protocol, &ring)) < 0)
+    return FALSE ;
+
+  pthread_mutex_lock (&connsLock) ;
+  if ((index = numConns) == MAX_NODES)
+  {
+    pthread_mutex_unlock (&connsLock) ;
+    if (ring != NULL)
+      munmap (ring, sizeof (*ring)) ;
+    close (fd) ;
+    errno = ENOSPC ;
+    return FALSE ;
+  }
+  conns [numConns++] = c ;
+  pthread_mutex_unlock (&connsLock) ;
+
+  c->fd       = fd ;
+  c->protocol = protocol ;
+  c->ring     = ring ;
+
+  node = wiringPiNewNode (pinBase, numPins) ;
+
+  c->node                = node ;
+  node->fd               = fd ;
+  node->data2            = index ;
+  node->pinMode          = myPinMode ;
+  node->pullUpDnControl  = myPullUpDnControl ;
+  node->analogRead       = myAnalogRead ;
+  node->analogWrite      = myAnalogWrite ;
+  node->digitalRead      = myDigitalRead ;
+  node->digitalWrite     = myDigitalWrite ;
+  node->digitalRead8     = myDigitalRead8 ;
+  node->digitalRead16    = myDigitalRead16 ;
+  node->digitalRead32    = myDigitalRead32 ;
+  node->digitalWrite8    = myDigitalWrite8 ;
+  node->digitalWrite16   = myDigitalWrite16 ;
+  node->digitalWrite32   = myDigitalWrite32 ;
+  node->pwmWrite         = myPwmWrite ;
+
+  return TRUE ;
+}
+
+
+/*
+ * drcNet:
+ *	Create a new instance of an DRC GPIO interface.
+ *********************************************************************************
+ */
+
+int drcSetupNet (const int pinBase, const int numPins, const char *ipAddress, const char *port, const char *password)
+{
+  struct drcNetConnStruct *c ;
+
+  if ((c = calloc (1, sizeof (*c))) == NULL)
+    return FALSE ;
+
+  if (((c->host     = strdup (ipAddress)) == NULL) ||
+      ((c->port     = strdup (port))      == NULL) ||
+      ((c->password = strdup (password))  == NULL) ||
+      !newNode (c, pinBase, numPins))
+  {
+    free (c->host) ;
+    free (c->port) ;
+    free (c->password) ;
+    free (c) ;
+    return FALSE ;
+  }
+
+  return TRUE ;
+}
+
+
+/*
+ * drcSetupLocal:
+ *	Create a new instance of a DRC GPIO interface to the wiringPiD on this
+ *	machine, through its UNIX socket (path, or NULL for the default). With
+ *	ring set, writes go through shared memory instead of the socket, which
+ *	is about as fast as the daemon can run them.
+ *********************************************************************************
+ */
+
+int drcSetupLocal (const int pinBase, const int numPins, const char *path, const int ring)
+{
+  struct drcNetConnStruct *c ;
+
+  if ((c = calloc (1, sizeof (*c))) == NULL)
+    return FALSE ;
+
+  c->wantRing = ring ;
+
+  if (((c->path = strdup ((path == NULL) ? DEFAULT_SERVER_SOCKET : path)) == NULL) ||
+      !newNode (c, pinBase, numPins))
+  {
+    free (c->path) ;
+    free (c) ;
+    return FALSE ;
+  }
+
+  return TRUE ;
+}
+
+
+/*
+ * findConn:
+ *	The connection of the DRC node a pin is on
+ *********************************************************************************
+ */
+
+static struct drcNetConnStruct *findConn (int pin)
+{
+  struct wiringPiNodeStruct *node ;
+
+  if (((node = wiringPiFindNode (pin)) == NULL) || (node->pinMode != myPinMode))
+  {
+    errno = ENODEV ;
+    return NULL ;
+  }
+
+  return conns [node->data2] ;
+}
+
+
+/*
+ * drcNetBatch:
+ *	Start or end a batch of commands to the remote device at pinBase.
+ *	In a batch writes are held back and go out packed into as few
+ *	packets as will take them; a read, or ending the batch, sends what
+ *	is held. The kernel sends anyway after 200mS.
+ *********************************************************************************
+ */
+
+int drcNetBatch (const int pinBase, const int batch)
+{
+  struct drcNetConnStruct *c ;
+  int cork = (batch != 0) ;
+  int fd, ret = 0 ;
+
+  if ((c = findConn (pinBase)) == NULL)
+    return -1 ;
+
+  pthread_mutex_lock (&c->sendLock) ;
+
+  if ((fd = c->fd) >= 0)
+    ret = setsockopt (fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof (cork)) ;
+
+  if (ret == 0)
+    c->cork = cork ;
+
+  pthread_mutex_unlock (&c->sendLock) ;
+
+  return ret ;
+}
+
+
+/*
+ * drcNetTimeout:
+ *	Set how long, in mS, the remote device at pinBase gets to answer, or
+ *	to take what is sent, before it is taken to have gone and is
+ *	connected to again. The default is half a second.
+ *********************************************************************************
+ */
+
+int drcNetTimeout (const int pinBase, const int mS)
+{
+  struct drcNetConnStruct *c ;
+
+  if ((c = findConn (pinBase)) == NULL)
+    return -1 ;
+
+  if (mS <= 0)
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  c->timeout = mS ;
+
+  return 0 ;
+}
+
+
+/*
+ * drcNetConnected:
+ *	See if the remote device at pinBase is connected right now; while it
+ *	isn't, its writes are lost and its reads return 0.
+ *********************************************************************************
+ */
+
+int drcNetConnected (const int pinBase)
+{
+  struct drcNetConnStruct *c ;
+
+  if ((c = findConn (pinBase)) == NULL)
+    return FALSE ;
+
+  return c->fd >= 0 ;
+}
+
+
+/*
+ * edgeReader:
+ *	Read everything the server sends a node that has pins watched, so
+ *	that edges are seen when no command is waiting for a reply. It waits
+ *	out the times the server is away.
+ *********************************************************************************
+ */
+
+static void *edgeReader (void *arg)
+{
+  struct drcNetConnStruct *c = (struct drcNetConnStruct *)arg ;
+  int fd, ok ;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&c->lock) ;
+
+    while ((c->fd < 0) || c->reading)
+      pthread_cond_wait (&c->cond, &c->lock) ;
+
+    c->reading = TRUE ;
+    fd         = c->fd ;
+
+    pthread_mutex_unlock (&c->lock) ;
+
+    ok = (readReplies (c, fd, -1) == 0) ;
+
+    pthread_mutex_lock (&c->lock) ;
+    c->reading = FALSE ;
+    if (!ok)
+      dropConnection (c, fd) ;
+    pthread_cond_broadcast (&c->cond) ;
+    pthread_mutex_unlock (&c->lock) ;
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * edgeCaller:
+ *	Run the handlers for the edges the reader has queued, in order
+ *********************************************************************************
+ */
+
+static void *edgeCaller (void *arg)
+{
+  struct drcNetConnStruct *c = (struct drcNetConnStruct *)arg ;
+  struct drcNetComStruct edge ;
+  void (*function)(int pin, int level, unsigned int micros, void *userData) ;
+  void *userData ;
+  int numPins = c->node->pinMax - c->node->pinBase + 1 ;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&c->lock) ;
+
+    while (c->queueLen == 0)
+      pthread_cond_wait (&c->edgeCond, &c->lock) ;
+
+    edge         = c->queue [c->queueHead] ;
+    c->queueHead = (c->queueHead + 1) % EDGE_QUEUE ;
+    --c->queueLen ;
+
+    function = NULL ;
+    userData = NULL ;
+    if (edge.pin < (uint32_t)numPins)
+    {
+      function = c->functions [edge.pin] ;
+      userData = c->userData  [edge.pin] ;
+    }
+
+    pthread_mutex_unlock (&c->lock) ;
+
+    if (function != NULL)
+      function (c->node->pinBase + edge.pin, ((edge.cmd & DRCN_CMD_MASK) == DRCN_EDGE_RISING) ? HIGH : LOW, edge.data, userData) ;
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * startEdges:
+ *	Give a node its handler table and edge threads, the first time it is
+ *	asked for
+ *********************************************************************************
+ */
+
+static int startEdges (struct drcNetConnStruct *c)
+{
+  pthread_t reader, caller ;
+  int numPins = c->node->pinMax - c->node->pinBase + 1 ;
+  int ret = 0 ;
+
+  pthread_mutex_lock (&c->lock) ;
+
+  if (c->edges)
+  {
+    pthread_mutex_unlock (&c->lock) ;
+    return 0 ;
+  }
+
+  if (c->functions == NULL)
+  {
+    c->modes     = calloc (numPins, sizeof (*c->modes)) ;
+    c->functions = calloc (numPins, sizeof (*c->functions)) ;
+    c->userData  = calloc (numPins, sizeof (*c->userData)) ;
+
+    if ((c->modes == NULL) || (c->functions == NULL) || (c->userData == NULL))
+    {
+      free (c->modes) ;
+      free (c->functions) ;
+      free (c->userData) ;
+      c->modes     = NULL ;
+      c->functions = NULL ;
+      c->userData  = NULL ;
+      pthread_mutex_unlock (&c->lock) ;
+      return -1 ;
+    }
+  }
+
+  if (pthread_create (&caller, NULL, edgeCaller, c) != 0)
+    ret = -1 ;
+  else
+  {
+    pthread_detach (caller) ;
+
+    if (pthread_create (&reader, NULL, edgeReader, c) != 0)	// The caller just waits
+      ret = -1 ;
+    else
+    {
+      pthread_detach (reader) ;
+      c->edges = TRUE ;
+    }
+  }
+
+  pthread_mutex_unlock (&c->lock) ;
+
+  return ret ;
+}
+
+
+/*
+ * drcNetISR:
+ *	Have function called for edges on a pin of a remote device, as
+ *	wiringPiISR does for local ones, mode being INT_EDGE_FALLING, _RISING
+ *	or _BOTH. The server pushes the edges as they happen, so there is no
+ *	polling; function gets the pin, its new level and the server's
+ *	micros() time of the edge. The handlers for a node are run one at a
+ *	time on a thread of its own, and may use the node. Needs a protocol
+ *	2 server, and the remote pin has to be one of its own GPIO pins. The
+ *	pin is watched again whenever the connection is made again.
+ *********************************************************************************
+ */
+
+int drcNetISR (int pin, int mode, void (*function)(int pin, int level, unsigned int micros, void *userData), void *userData)
+{
+  struct drcNetConnStruct *c ;
+  uint32_t result = 0 ;
+  int remotePin ;
+
+  if ((c = findConn (pin)) == NULL)
+    return -1 ;
+
+  if (c->protocol < 2)
+  {
+    errno = EPROTONOSUPPORT ;
+    return -1 ;
+  }
+
+  if (startEdges (c) < 0)
+    return -1 ;
+
+  remotePin = pin - c->node->pinBase ;
+
+  pthread_mutex_lock (&c->lock) ;
+  c->functions [remotePin] = function ;
+  c->userData  [remotePin] = userData ;
+  c->modes     [remotePin] = mode ;
+  pthread_mutex_unlock (&c->lock) ;
+
+  if ((remoteCall (c, remotePin, DRCN_SUBSCRIBE, mode, &result) < 0) || ((int)result < 0))
+  {
+    if ((int)result < 0)
+      errno = EINVAL ;
+    pthread_mutex_lock (&c->lock) ;
+    c->functions [remotePin] = NULL ;
+    pthread_mutex_unlock (&c->lock) ;
+    return -1 ;
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * drcNetISRCancel:
+ *	Stop the edges on a remote pin
+ *********************************************************************************
+ */
+
+int drcNetISRCancel (int pin)
+{
+  struct drcNetConnStruct *c ;
+  uint32_t result ;
+  int remotePin ;
+
+  if (((c = findConn (pin)) == NULL) || !c->edges)
+  {
+    errno = ENODEV ;
+    return -1 ;
+  }
+
+  remotePin = pin - c->node->pinBase ;
+
+  pthread_mutex_lock (&c->lock) ;
+  c->functions [remotePin] = NULL ;
+  c->userData  [remotePin] = NULL ;
+  pthread_mutex_unlock (&c->lock) ;
+
+  (void)remoteCall (c, remotePin, DRCN_UNSUBSCRIBE, 0, &result) ;
+
+  return 0 ;
 }
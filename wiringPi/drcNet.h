@@ -36,6 +36,13 @@ extern "C" {
 #endif
 
 extern int drcSetupNet (const int pinBase, const int numPins, const char *ipAddress, const char *port, const char *password) ;
+extern int drcSetupLocal (const int pinBase, const int numPins, const char *path, const int ring) ;
+extern int drcNetBatch (const int pinBase, const int batch) ;
+extern int drcNetTimeout   (const int pinBase, const int mS) ;
+extern int drcNetConnected (const int pinBase) ;
+
+extern int drcNetISR       (int pin, int mode, void (*function)(int pin, int level, unsigned int micros, void *userData), void *userData) ;
+extern int drcNetISRCancel (int pin) ;
 
 #ifdef __cplusplus
 }
@@ -23,15 +23,236 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "wiringPi.h"
 #include "wiringSerial.h"
 
 #include "drcSerial.h"
 
+// The commands are a letter and a pin number, and for 'v' the value:
+//
+//	o p i	pin mode output, PWM, input
+//	0 1	digital write (pull-up off/on for an input)
+//	v	PWM write
+//	r	digital read, answered with '0' or '1'
+//	a	analog read, answered with the high then low byte
+//	@	ping, answered with '@'
+//
+//	The plain protocol just sends them. Boards running the framed
+//	firmware take them in frames instead, any number of commands to a
+//	frame:
+//
+//	DRC_FRAME_START, length, commands..., CRC-8
+//
+//	the CRC (polynomial 0x07, as avr-libc's _crc8_ccitt_update) being of
+//	the length and the commands. The board runs a frame only if it checks
+//	out, and answers a frame with reads in it with a frame of the same
+//	shape holding the answers, in order. Either way, commands are queued
+//	and sent with one write, and in a batch held until a read or the end
+//	of the batch.
+
+#define	DRC_FRAME_START		0xA5
+#define	DRC_FRAME_MAX		255		// Bytes of commands in one frame
+#define	DRC_TIMEOUT		100		// mS for a reply to come back
+#define	MAX_PORTS		16
+
+struct drcSerialStruct
+{
+  int fd ;
+  int framed, batch ;
+  int stale ;				// A reply went missing; it may yet turn up
+  pthread_mutex_t lock ;
+  int outLen ;
+  uint8_t out [DRC_FRAME_MAX + 3] ;	// Room for the frame start, length and CRC
+} ;
+
+static struct drcSerialStruct *ports [MAX_PORTS] ;
+static int numPorts = 0 ;
+static pthread_mutex_t portsLock = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/*
+ * crc8:
+ *	CRC-8, polynomial 0x07, as the ATmega works it out
+ *********************************************************************************
+ */
+
+static uint8_t crc8 (uint8_t crc, const uint8_t *data, int len)
+{
+  int i ;
+
+  while (len--)
+  {
+    crc ^= *data++ ;
+    for (i = 0 ; i < 8 ; ++i)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1) ;
+  }
+
+  return crc ;
+}
+
+
+/*
+ * flush:
+ *	Send what is queued, in one write, as a frame on framed boards.
+ *	Called with the lock held.
+ *********************************************************************************
+ */
+
+static int flush (struct drcSerialStruct *port)
+{
+  uint8_t *p = port->out + 2 ;
+  int len = port->outLen ;
+
+  if (len == 0)
+    return 0 ;
+
+  port->outLen = 0 ;
+
+  if (port->framed)
+  {
+    p           = port->out ;
+    p [0]       = DRC_FRAME_START ;
+    p [1]       = len ;
+    p [len + 2] = crc8 (0, p + 1, len + 1) ;
+    len        += 3 ;
+  }
+
+  return (serialWrite (port->fd, p, len) == len) ? 0 : -1 ;
+}
+
+
+/*
+ * append: queue:
+ *	Add a command to those waiting to go, sending what is there first if
+ *	there's no room for it. queue sends it now unless in a batch. Called
+ *	with the lock held.
+ *********************************************************************************
+ */
+
+static void append (struct drcSerialStruct *port, const uint8_t *cmd, int len)
+{
+  if (port->outLen + len > DRC_FRAME_MAX)
+    (void)flush (port) ;
+
+  memcpy (port->out + 2 + port->outLen, cmd, len) ;
+  port->outLen += len ;
+}
+
+static void queue (struct drcSerialStruct *port, const uint8_t *cmd, int len)
+{
+  append (port, cmd, len) ;
+
+  if (!port->batch)
+    (void)flush (port) ;
+}
+
+
+/*
+ * readReply:
+ *	Get the len bytes of answer to a read. Framed boards send them in a
+ *	frame: anything before the start of one is skipped, and one that
+ *	doesn't check out fails with EIO.
+ *********************************************************************************
+ */
+
+static int readReply (struct drcSerialStruct *port, uint8_t *reply, int len)
+{
+  uint8_t frame [DRC_FRAME_MAX + 2] ;
+  int got ;
+
+  if (!port->framed)
+  {
+    if (serialRead (port->fd, reply, len, DRC_TIMEOUT) != len)
+      goto timeout ;
+    return 0 ;
+  }
+
+  do
+  {
+    if (serialRead (port->fd, frame, 1, DRC_TIMEOUT) != 1)
+      goto timeout ;
+  }
+  while (frame [0] != DRC_FRAME_START) ;
+
+  if (serialRead (port->fd, frame, 1, DRC_TIMEOUT) != 1)
+    goto timeout ;
+
+  got = frame [0] ;
+  if (serialRead (port->fd, frame + 1, got + 1, DRC_TIMEOUT) != got + 1)
+    goto timeout ;
+
+  if ((got != len) || (crc8 (0, frame, got + 1) != frame [got + 1]))
+  {
+    errno = EIO ;
+    return -1 ;
+  }
+
+  memcpy (reply, frame + 1, len) ;
+  return 0 ;
+
+timeout:
+  errno = ETIMEDOUT ;
+  return -1 ;
+}
+
+
+/*
+ * command: request:
+ *	Send a command with nothing to come back, or one with len bytes of
+ *	reply, which goes out straight away along with everything queued
+ *	before it. Whatever is left over from a read that timed out is
+ *	thrown away first.
+ *********************************************************************************
+ */
+
+static void command (struct wiringPiNodeStruct *node, int cmd, int pin)
+{
+  struct drcSerialStruct *port = ports [node->data0] ;
+  uint8_t buf [2] ;
+
+  buf [0] = cmd ;
+  buf [1] = pin - node->pinBase ;
+
+  pthread_mutex_lock   (&port->lock) ;
+  queue (port, buf, 2) ;
+  pthread_mutex_unlock (&port->lock) ;
+}
+
+static int request (struct wiringPiNodeStruct *node, int cmd, int pin, uint8_t *reply, int len)
+{
+  struct drcSerialStruct *port = ports [node->data0] ;
+  uint8_t buf [2], junk [64] ;
+  int ret ;
+
+  buf [0] = cmd ;
+  buf [1] = pin - node->pinBase ;
+
+  pthread_mutex_lock (&port->lock) ;
+
+  if (port->stale)		// Don't take it for this one's
+  {
+    while (serialRead (port->fd, junk, sizeof (junk), 0) > 0)
+      ;
+    port->stale = FALSE ;
+  }
+
+  append (port, buf, 2) ;
+  if ((ret = flush (port)) == 0)
+    if ((ret = readReply (port, reply, len)) < 0)
+      port->stale = TRUE ;
+
+  pthread_mutex_unlock (&port->lock) ;
+
+  return ret ;
+}
+
 
 /*
  * myPinMode:
@@ -42,13 +263,11 @@
 static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 {
   /**/ if (mode == OUTPUT)
-    serialPutchar (node->fd, 'o') ;       // Input
+    command (node, 'o', pin) ;       // Input
   else if (mode == PWM_OUTPUT)
-    serialPutchar (node->fd, 'p') ;       // PWM
+    command (node, 'p', pin) ;       // PWM
   else
-    serialPutchar (node->fd, 'i') ;       // Default to input
-
-  serialPutchar (node->fd, pin - node->pinBase) ;
+    command (node, 'i', pin) ;       // Default to input
 }
 
 
@@ -63,19 +282,12 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
 
 // Force pin into input mode
 
-  serialPutchar (node->fd, 'i' ) ;
-  serialPutchar (node->fd, pin - node->pinBase) ;
+  command (node, 'i', pin) ;
 
   /**/ if (mode == PUD_UP)
-  {
-    serialPutchar (node->fd, '1') ;
-    serialPutchar (node->fd, pin - node->pinBase) ;
-  }
+    command (node, '1', pin) ;
   else if (mode == PUD_OFF)
-  {
-    serialPutchar (node->fd, '0') ;
-    serialPutchar (node->fd, pin - node->pinBase) ;
-  }
+    command (node, '0', pin) ;
 }
 
 
@@ -86,8 +298,7 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
 
 static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
 {
-  serialPutchar (node->fd, value == 0 ? '0' : '1') ;
-  serialPutchar (node->fd, pin - node->pinBase) ;
+  command (node, value == 0 ? '0' : '1', pin) ;
 }
 
 
@@ -98,9 +309,16 @@ static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
 
 static void myPwmWrite (struct wiringPiNodeStruct *node, int pin, int value)
 {
-  serialPutchar (node->fd, 'v') ;
-  serialPutchar (node->fd, pin - node->pinBase) ;
-  serialPutchar (node->fd, value & 0xFF) ;
+  struct drcSerialStruct *port = ports [node->data0] ;
+  uint8_t buf [3] ;
+
+  buf [0] = 'v' ;
+  buf [1] = pin - node->pinBase ;
+  buf [2] = value & 0xFF ;
+
+  pthread_mutex_lock   (&port->lock) ;
+  queue (port, buf, 3) ;
+  pthread_mutex_unlock (&port->lock) ;
 }
 
 
@@ -111,14 +329,12 @@ static void myPwmWrite (struct wiringPiNodeStruct *node, int pin, int value)
 
 static int myAnalogRead (struct wiringPiNodeStruct *node, int pin)
 {
-  int vHi, vLo ;
+  uint8_t v [2] ;
 
-  serialPutchar (node->fd, 'a') ;
-  serialPutchar (node->fd, pin - node->pinBase) ;
-  vHi = serialGetchar (node->fd) ;
-  vLo = serialGetchar (node->fd) ;
+  if (request (node, 'a', pin, v, 2) < 0)
+    return 0 ;
 
-  return (vHi << 8) | vLo ;
+  return (v [0] << 8) | v [1] ;
 }
 
 
@@ -129,30 +345,80 @@ static int myAnalogRead (struct wiringPiNodeStruct *node, int pin)
 
 static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
 {
-  serialPutchar (node->fd, 'r') ; // Send read command
-  serialPutchar (node->fd, pin - node->pinBase) ;
-  return (serialGetchar (node->fd) == '0') ? 0 : 1 ;
+  uint8_t v ;
+
+  if (request (node, 'r', pin, &v, 1) < 0)
+    return 0 ;
+
+  return (v == '0') ? 0 : 1 ;
+}
+
+
+/*
+ * ping:
+ *	See if the board is there, and talking the right protocol
+ *********************************************************************************
+ */
+
+static int ping (struct drcSerialStruct *port)
+{
+  static const uint8_t pingFrame [] = { DRC_FRAME_START, 1, '@', 0 } ;
+  uint8_t frame [sizeof (pingFrame)] ;
+  uint8_t c ;
+  time_t then ;
+  int tries ;
+
+  memcpy (frame, pingFrame, sizeof (frame)) ;
+  frame [3] = crc8 (0, frame + 1, 2) ;
+
+  for (tries = 1 ; tries < 5 ; ++tries)
+  {
+    if (port->framed)
+      (void)serialWrite (port->fd, frame, sizeof (frame)) ;
+    else
+      serialPutchar (port->fd, '@') ;		// Ping
+
+    then = time (NULL) + 2 ;
+    while (time (NULL) < then)
+    {
+      if (port->framed)
+      {
+	if ((readReply (port, &c, 1) == 0) && (c == '@'))
+	  return TRUE ;
+      }
+      else if (serialDataAvail (port->fd))
+      {
+        if (serialGetchar (port->fd) == '@')
+	  return TRUE ;
+      }
+    }
+  }
+
+  return FALSE ;
 }
 
 
 /*
- * drcSetup:
+ * setup:
  *	Create a new instance of an DRC GPIO interface.
  *	Could be a variable nunber of pins here - we might not know in advance
  *	if it's an ATmega with 14 pins, or something with less or more!
  *********************************************************************************
  */
 
-int drcSetupSerial (const int pinBase, const int numPins, const char *device, const int baud)
+static int setup (const int pinBase, const int numPins, const char *device, const int baud, int framed)
 {
-  int fd ;
-  int ok, tries ;
-  time_t then ;
+  struct drcSerialStruct *port ;
   struct wiringPiNodeStruct *node ;
+  int fd, index ;
 
   if ((fd = serialOpen (device, baud)) < 0)
     return FALSE ;
 
+// Replies are small and want to come back straight away
+
+  (void)serialSetLowLatency (fd, TRUE) ;
+
   delay (10) ;	// May need longer if it's an Uno that reboots on the open...
 
 // Flush any pending input
@@ -160,31 +426,39 @@ int drcSetupSerial (const int pinBase, const int numPins, const char *device, co
   while (serialDataAvail (fd))
     (void)serialGetchar (fd) ;
 
-  ok = FALSE ;
-  for (tries = 1 ; (tries < 5) && (!ok) ; ++tries)
+  if ((port = calloc (1, sizeof (*port))) == NULL)
   {
-    serialPutchar (fd, '@') ;		// Ping
-    then = time (NULL) + 2 ;
-    while (time (NULL) < then)
-      if (serialDataAvail (fd))
-      {
-        if (serialGetchar (fd) == '@')
-        {
-          ok = TRUE ;
-          break ;
-        }
-      }
+    serialClose (fd) ;
+    return FALSE ;
+  }
+
+  port->fd     = fd ;
+  port->framed = framed ;
+  pthread_mutex_init (&port->lock, NULL) ;
+
+  if (!ping (port))
+  {
+    serialClose (fd) ;
+    free (port) ;
+    return FALSE ;
   }
 
-  if (!ok)
+  pthread_mutex_lock (&portsLock) ;
+  if ((index = numPorts) == MAX_PORTS)
   {
+    pthread_mutex_unlock (&portsLock) ;
     serialClose (fd) ;
+    free (port) ;
+    errno = ENOSPC ;
     return FALSE ;
   }
+  ports [numPorts++] = port ;
+  pthread_mutex_unlock (&portsLock) ;
 
   node = wiringPiNewNode (pinBase, numPins) ;
 
   node->fd              = fd ;
+  node->data0           = index ;
   node->pinMode         = myPinMode ;
   node->pullUpDnControl = myPullUpDnControl ;
   node->analogRead      = myAnalogRead ;
@@ -194,3 +468,55 @@ int drcSetupSerial (const int pinBase, const int numPins, const char *device, co
 
   return TRUE ;
 }
+
+
+/*
+ * drcSetupSerial: drcSetupSerialFramed:
+ *	Set up a DRC board on a serial port, talking the plain protocol, or
+ *	the framed one, with its checksums, for boards running the firmware
+ *	for it
+ *********************************************************************************
+ */
+
+int drcSetupSerial (const int pinBase, const int numPins, const char *device, const int baud)
+{
+  return setup (pinBase, numPins, device, baud, FALSE) ;
+}
+
+int drcSetupSerialFramed (const int pinBase, const int numPins, const char *device, const int baud)
+{
+  return setup (pinBase, numPins, device, baud, TRUE) ;
+}
+
+
+/*
+ * drcSerialBatch:
+ *	Start or end a batch of commands to the board at pinBase. In a batch
+ *	writes are held back and sent together - in one frame, on framed
+ *	boards - when a read comes along, when there are as many as will
+ *	fit, or at the end of the batch.
+ *********************************************************************************
+ */
+
+int drcSerialBatch (const int pinBase, const int batch)
+{
+  struct wiringPiNodeStruct *node ;
+  struct drcSerialStruct *port ;
+  int ret = 0 ;
+
+  if (((node = wiringPiFindNode (pinBase)) == NULL) || (node->pinMode != myPinMode))
+  {
+    errno = ENODEV ;
+    return -1 ;
+  }
+
+  port = ports [node->data0] ;
+
+  pthread_mutex_lock (&port->lock) ;
+  port->batch = (batch != 0) ;
+  if (!port->batch)
+    ret = flush (port) ;
+  pthread_mutex_unlock (&port->lock) ;
+
+  return ret ;
+}
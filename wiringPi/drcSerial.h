@@ -26,7 +26,9 @@
 extern "C" {
 #endif
 
-extern int drcSetupSerial (const int pinBase, const int numPins, const char *device, const int baud) ;
+extern int drcSetupSerial       (const int pinBase, const int numPins, const char *device, const int baud) ;
+extern int drcSetupSerialFramed (const int pinBase, const int numPins, const char *device, const int baud) ;
+extern int drcSerialBatch       (const int pinBase, const int batch) ;
 
 #ifdef __cplusplus
 }
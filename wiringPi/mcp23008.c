@@ -27,11 +27,29 @@
 
 #include "wiringPi.h"
 #include "wiringPiI2C.h"
+#include "wiringPiRegCache.h"
 #include "mcp23x0817.h"
 
 #include "mcp23008.h"
 
 
+/*
+ * myReadReg: myWriteReg:
+ *	Register access for the register cache
+ *********************************************************************************
+ */
+
+static int myReadReg (struct wiringPiNodeStruct *node, int reg)
+{
+  return wiringPiI2CReadReg8 (node->fd, reg) ;
+}
+
+static int myWriteReg (struct wiringPiNodeStruct *node, int reg, int value)
+{
+  return wiringPiI2CWriteReg8 (node->fd, reg, value) ;
+}
+
+
 /*
  * myPinMode:
  *********************************************************************************
@@ -39,18 +57,12 @@
 
 static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   reg  = MCP23x08_IODIR ;
   mask = 1 << (pin - node->pinBase) ;
-  old  = wiringPiI2CReadReg8 (node->fd, reg) ;
-
-  if (mode == OUTPUT)
-    old &= (~mask) ;
-  else
-    old |=   mask ;
 
-  wiringPiI2CWriteReg8 (node->fd, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == OUTPUT) ? 0 : mask) ;
 }
 
 
@@ -61,19 +73,12 @@ static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 
 static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   reg  = MCP23x08_GPPU ;
   mask = 1 << (pin - node->pinBase) ;
 
-  old  = wiringPiI2CReadReg8 (node->fd, reg) ;
-
-  if (mode == PUD_UP)
-    old |=   mask ;
-  else
-    old &= (~mask) ;
-
-  wiringPiI2CWriteReg8 (node->fd, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == PUD_UP) ? mask : 0) ;
 }
 
 
@@ -84,18 +89,11 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
 
 static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
 {
-  int bit, old ;
+  int bit ;
 
   bit  = 1 << ((pin - node->pinBase) & 7) ;
 
-  old = node->data2 ;
-  if (value == LOW)
-    old &= (~bit) ;
-  else
-    old |=   bit ;
-
-  wiringPiI2CWriteReg8 (node->fd, MCP23x08_GPIO, old) ;
-  node->data2 = old ;
+  wiringPiRegCacheUpdate (node, MCP23x08_OLAT, bit, (value == LOW) ? 0 : bit) ;
 }
 
 
@@ -118,6 +116,30 @@ static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
 }
 
 
+/*
+ * myDigitalRead8: myDigitalWrite8:
+ *	The whole port in one register access. Bit n of the value is
+ *	pin + n; with only 8 pins these serve for 16 and 32-bit access too.
+ *********************************************************************************
+ */
+
+static unsigned int myDigitalRead8 (struct wiringPiNodeStruct *node, int pin)
+{
+  int value ;
+
+  value = wiringPiI2CReadReg8 (node->fd, MCP23x08_GPIO) ;
+
+  return (value < 0) ? 0 : (unsigned int)value >> (pin - node->pinBase) ;
+}
+
+static void myDigitalWrite8 (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  pin -= node->pinBase ;
+
+  wiringPiRegCacheUpdate (node, MCP23x08_OLAT, (0xFF << pin) & 0xFF, ((unsigned int)value << pin) & 0xFF) ;
+}
+
+
 /*
  * mcp23008Setup:
  *	Create a new instance of an MCP23008 I2C GPIO interface. We know it
@@ -143,7 +165,18 @@ int mcp23008Setup (const int pinBase, const int i2cAddress)
   node->pullUpDnControl = myPullUpDnControl ;
   node->digitalRead     = myDigitalRead ;
   node->digitalWrite    = myDigitalWrite ;
-  node->data2           = wiringPiI2CReadReg8 (fd, MCP23x08_OLAT) ;
+  node->digitalRead8    = myDigitalRead8 ;
+  node->digitalRead16   = myDigitalRead8 ;
+  node->digitalRead32   = myDigitalRead8 ;
+  node->digitalWrite8   = myDigitalWrite8 ;
+  node->digitalWrite16  = myDigitalWrite8 ;
+  node->digitalWrite32  = myDigitalWrite8 ;
+
+  if (wiringPiRegCacheSetup (node, myReadReg, myWriteReg) < 0)
+    return FALSE ;
+
+  // Output latch is read once here and only ever written after this
+  wiringPiRegCacheRead (node, MCP23x08_OLAT) ;
 
   return TRUE ;
 }
@@ -27,11 +27,42 @@
 
 #include "wiringPi.h"
 #include "wiringPiI2C.h"
+#include "wiringPiRegCache.h"
 #include "mcp23x0817.h"
+#include "mcp23x17isr.h"
 
 #include "mcp23017.h"
 
 
+/*
+ * myReadReg: myWriteReg:
+ *	Register access for the register cache
+ *********************************************************************************
+ */
+
+static int myReadReg (struct wiringPiNodeStruct *node, int reg)
+{
+  return wiringPiI2CReadReg8 (node->fd, reg) ;
+}
+
+static int myWriteReg (struct wiringPiNodeStruct *node, int reg, int value)
+{
+  return wiringPiI2CWriteReg8 (node->fd, reg, value) ;
+}
+
+
+/*
+ * myReadWord:
+ *	A register and its B-side partner in one transfer, for the
+ *	interrupt handler
+ *********************************************************************************
+ */
+
+static int myReadWord (struct wiringPiNodeStruct *node, int reg)
+{
+  return wiringPiI2CReadReg16 (node->fd, reg) ;
+}
+
 /*
  * myPinMode:
  *********************************************************************************
@@ -39,7 +70,7 @@
 
 static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   pin -= node->pinBase ;
 
@@ -52,14 +83,8 @@ static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
   }
 
   mask = 1 << pin ;
-  old  = wiringPiI2CReadReg8 (node->fd, reg) ;
-
-  if (mode == OUTPUT)
-    old &= (~mask) ;
-  else
-    old |=   mask ;
 
-  wiringPiI2CWriteReg8 (node->fd, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == OUTPUT) ? 0 : mask) ;
 }
 
 
@@ -70,7 +95,7 @@ static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 
 static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   pin -= node->pinBase ;
 
@@ -83,14 +108,8 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
   }
 
   mask = 1 << pin ;
-  old  = wiringPiI2CReadReg8 (node->fd, reg) ;
 
-  if (mode == PUD_UP)
-    old |=   mask ;
-  else
-    old &= (~mask) ;
-
-  wiringPiI2CWriteReg8 (node->fd, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == PUD_UP) ? mask : 0) ;
 }
 
 
@@ -101,36 +120,18 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
 
 static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
 {
-  int bit, old ;
+  int bit, reg ;
 
   pin -= node->pinBase ;	// Pin now 0-15
 
   bit = 1 << (pin & 7) ;
 
   if (pin < 8)			// Bank A
-  {
-    old = node->data2 ;
-
-    if (value == LOW)
-      old &= (~bit) ;
-    else
-      old |=   bit ;
-
-    wiringPiI2CWriteReg8 (node->fd, MCP23x17_GPIOA, old) ;
-    node->data2 = old ;
-  }
+    reg = MCP23x17_OLATA ;
   else				// Bank B
-  {
-    old = node->data3 ;
-
-    if (value == LOW)
-      old &= (~bit) ;
-    else
-      old |=   bit ;
+    reg = MCP23x17_OLATB ;
 
-    wiringPiI2CWriteReg8 (node->fd, MCP23x17_GPIOB, old) ;
-    node->data3 = old ;
-  }
+  wiringPiRegCacheUpdate (node, reg, bit, (value == LOW) ? 0 : bit) ;
 }
 
 
@@ -163,6 +164,115 @@ static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
 }
 
 
+/*
+ * readPort:
+ *	Both GPIO ports in one go. With IOCON.BANK = 0 the address pointer
+ *	toggles between GPIOA and GPIOB, so a 2-byte read gets A then B.
+ *********************************************************************************
+ */
+
+static unsigned int readPort (struct wiringPiNodeStruct *node)
+{
+  int value ;
+
+  value = wiringPiI2CReadReg16 (node->fd, MCP23x17_GPIOA) ;
+
+  return (value < 0) ? 0 : (unsigned int)value ;
+}
+
+
+/*
+ * writePort:
+ *	Change the masked bits of the 16-bit output latch. A change confined
+ *	to one bank is a single register write, anything else writes OLATA
+ *	and OLATB together in one transfer.
+ *********************************************************************************
+ */
+
+static void writePort (struct wiringPiNodeStruct *node, unsigned int mask, unsigned int value)
+{
+  int latA, latB ;
+  unsigned int old, new ;
+
+  if ((mask & 0xFF00) == 0)
+  {
+    wiringPiRegCacheUpdate (node, MCP23x17_OLATA, mask, value) ;
+    return ;
+  }
+  if ((mask & 0x00FF) == 0)
+  {
+    wiringPiRegCacheUpdate (node, MCP23x17_OLATB, mask >> 8, value >> 8) ;
+    return ;
+  }
+
+  if (((latA = wiringPiRegCacheRead (node, MCP23x17_OLATA)) < 0) ||
+      ((latB = wiringPiRegCacheRead (node, MCP23x17_OLATB)) < 0))
+    return ;
+
+  old = (unsigned int)latA | ((unsigned int)latB << 8) ;
+  new = (old & ~mask) | (value & mask) ;
+
+  if (wiringPiI2CWriteReg16 (node->fd, MCP23x17_OLATA, new) < 0)
+  {
+    wiringPiRegCacheInvalidate (node) ;
+    return ;
+  }
+
+  wiringPiRegCacheSet (node, MCP23x17_OLATA, new & 0xFF) ;
+  wiringPiRegCacheSet (node, MCP23x17_OLATB, new >> 8) ;
+}
+
+
+/*
+ * myDigitalRead8: myDigitalRead16:
+ *	Bit n of the result is pin + n. A read that lines up with a bank
+ *	only touches that bank's register.
+ *********************************************************************************
+ */
+
+static unsigned int myDigitalRead8 (struct wiringPiNodeStruct *node, int pin)
+{
+  int value ;
+
+  pin -= node->pinBase ;
+
+  if ((pin == 0) || (pin == 8))
+  {
+    value = wiringPiI2CReadReg8 (node->fd, (pin == 0) ? MCP23x17_GPIOA : MCP23x17_GPIOB) ;
+    return (value < 0) ? 0 : (value & 0xFF) ;
+  }
+
+  return (readPort (node) >> pin) & 0xFF ;
+}
+
+static unsigned int myDigitalRead16 (struct wiringPiNodeStruct *node, int pin)
+{
+  return readPort (node) >> (pin - node->pinBase) ;
+}
+
+
+/*
+ * myDigitalWrite8: myDigitalWrite16:
+ *	Bit n of value drives pin + n, bits beyond the last pin are dropped,
+ *	so the 16-bit versions serve for 32-bit access as well.
+ *********************************************************************************
+ */
+
+static void myDigitalWrite8 (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  pin -= node->pinBase ;
+
+  writePort (node, (0xFF << pin) & 0xFFFF, ((unsigned int)value << pin) & 0xFFFF) ;
+}
+
+static void myDigitalWrite16 (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  pin -= node->pinBase ;
+
+  writePort (node, (0xFFFF << pin) & 0xFFFF, ((unsigned int)value << pin) & 0xFFFF) ;
+}
+
+
 /*
  * mcp23017Setup:
  *	Create a new instance of an MCP23017 I2C GPIO interface. We know it
@@ -188,8 +298,38 @@ int mcp23017Setup (const int pinBase, const int i2cAddress)
   node->pullUpDnControl = myPullUpDnControl ;
   node->digitalRead     = myDigitalRead ;
   node->digitalWrite    = myDigitalWrite ;
-  node->data2           = wiringPiI2CReadReg8 (fd, MCP23x17_OLATA) ;
-  node->data3           = wiringPiI2CReadReg8 (fd, MCP23x17_OLATB) ;
+  node->digitalRead8    = myDigitalRead8 ;
+  node->digitalRead16   = myDigitalRead16 ;
+  node->digitalRead32   = myDigitalRead16 ;
+  node->digitalWrite8   = myDigitalWrite8 ;
+  node->digitalWrite16  = myDigitalWrite16 ;
+  node->digitalWrite32  = myDigitalWrite16 ;
+
+  if (wiringPiRegCacheSetup (node, myReadReg, myWriteReg) < 0)
+    return FALSE ;
+
+  // Output latches are read once here and only ever written after this
+  wiringPiRegCacheRead (node, MCP23x17_OLATA) ;
+  wiringPiRegCacheRead (node, MCP23x17_OLATB) ;
 
   return TRUE ;
 }
+
+
+/*
+ * mcp23017InterruptSetup:
+ *	The INT line of the MCP23017 at pinBase is wired to hostPin. Input
+ *	changes are then picked up from the interrupt instead of polling the
+ *	I2C bus - see mcp23x17ISR() to attach a function to an expander pin.
+ *********************************************************************************
+ */
+
+int mcp23017InterruptSetup (const int pinBase, const int hostPin)
+{
+  struct wiringPiNodeStruct *node ;
+
+  if (((node = wiringPiFindNode (pinBase)) == NULL) || (node->digitalRead != myDigitalRead))
+    return FALSE ;
+
+  return mcp23x17InterruptSetup (node, hostPin, myReadWord) ;
+}
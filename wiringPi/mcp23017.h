@@ -27,6 +27,7 @@ extern "C" {
 #endif
 
 extern int mcp23017Setup (const int pinBase, const int i2cAddress) ;
+extern int mcp23017InterruptSetup (const int pinBase, const int hostPin) ;
 
 #ifdef __cplusplus
 }
@@ -27,6 +27,7 @@
 
 #include "wiringPi.h"
 #include "wiringPiSPI.h"
+#include "wiringPiRegCache.h"
 #include "mcp23x0817.h"
 
 #include "mcp23s08.h"
@@ -49,7 +50,7 @@ static void writeByte (uint8_t spiPort, uint8_t devId, uint8_t reg, uint8_t data
   spiData [1] = reg ;
   spiData [2] = data ;
 
-  wiringPiSPIDataRW (spiPort, spiData, 3) ;
+  wiringPiSPIXfer (spiPort, spiData, NULL, 3) ;
 }
 
 /*
@@ -71,6 +72,24 @@ static uint8_t readByte (uint8_t spiPort, uint8_t devId, uint8_t reg)
 }
 
 
+/*
+ * myReadReg: myWriteReg:
+ *	Register access for the register cache
+ *********************************************************************************
+ */
+
+static int myReadReg (struct wiringPiNodeStruct *node, int reg)
+{
+  return readByte (node->data0, node->data1, reg) ;
+}
+
+static int myWriteReg (struct wiringPiNodeStruct *node, int reg, int value)
+{
+  writeByte (node->data0, node->data1, reg, value) ;
+  return 0 ;
+}
+
+
 /*
  * myPinMode:
  *********************************************************************************
@@ -78,18 +97,12 @@ static uint8_t readByte (uint8_t spiPort, uint8_t devId, uint8_t reg)
 
 static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   reg  = MCP23x08_IODIR ;
   mask = 1 << (pin - node->pinBase) ;
-  old  = readByte (node->data0, node->data1, reg) ;
-
-  if (mode == OUTPUT)
-    old &= (~mask) ;
-  else
-    old |=   mask ;
 
-  writeByte (node->data0, node->data1, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == OUTPUT) ? 0 : mask) ;
 }
 
 
@@ -100,19 +113,12 @@ static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 
 static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   reg  = MCP23x08_GPPU ;
   mask = 1 << (pin - node->pinBase) ;
 
-  old  = readByte (node->data0, node->data1, reg) ;
-
-  if (mode == PUD_UP)
-    old |=   mask ;
-  else
-    old &= (~mask) ;
-
-  writeByte (node->data0, node->data1, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == PUD_UP) ? mask : 0) ;
 }
 
 
@@ -123,18 +129,11 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
 
 static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
 {
-  int bit, old ;
+  int bit ;
 
   bit  = 1 << ((pin - node->pinBase) & 7) ;
 
-  old = node->data2 ;
-  if (value == LOW)
-    old &= (~bit) ;
-  else
-    old |=   bit ;
-
-  writeByte (node->data0, node->data1, MCP23x08_GPIO, old) ;
-  node->data2 = old ;
+  wiringPiRegCacheUpdate (node, MCP23x08_OLAT, bit, (value == LOW) ? 0 : bit) ;
 }
 
 
@@ -157,6 +156,30 @@ static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
 }
 
 
+/*
+ * myDigitalRead8: myDigitalWrite8:
+ *	The whole port in one register access. Bit n of the value is
+ *	pin + n; with only 8 pins these serve for 16 and 32-bit access too.
+ *********************************************************************************
+ */
+
+static unsigned int myDigitalRead8 (struct wiringPiNodeStruct *node, int pin)
+{
+  int value ;
+
+  value = readByte (node->data0, node->data1, MCP23x08_GPIO) ;
+
+  return (value < 0) ? 0 : (unsigned int)value >> (pin - node->pinBase) ;
+}
+
+static void myDigitalWrite8 (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  pin -= node->pinBase ;
+
+  wiringPiRegCacheUpdate (node, MCP23x08_OLAT, (0xFF << pin) & 0xFF, ((unsigned int)value << pin) & 0xFF) ;
+}
+
+
 /*
  * mcp23s08Setup:
  *	Create a new instance of an MCP23s08 SPI GPIO interface. We know it
@@ -182,7 +205,18 @@ int mcp23s08Setup (const int pinBase, const int spiPort, const int devId)
   node->pullUpDnControl = myPullUpDnControl ;
   node->digitalRead     = myDigitalRead ;
   node->digitalWrite    = myDigitalWrite ;
-  node->data2           = readByte (spiPort, devId, MCP23x08_OLAT) ;
+  node->digitalRead8    = myDigitalRead8 ;
+  node->digitalRead16   = myDigitalRead8 ;
+  node->digitalRead32   = myDigitalRead8 ;
+  node->digitalWrite8   = myDigitalWrite8 ;
+  node->digitalWrite16  = myDigitalWrite8 ;
+  node->digitalWrite32  = myDigitalWrite8 ;
+
+  if (wiringPiRegCacheSetup (node, myReadReg, myWriteReg) < 0)
+    return FALSE ;
+
+  // Output latch is read once here and only ever written after this
+  wiringPiRegCacheRead (node, MCP23x08_OLAT) ;
 
   return TRUE ;
 }
@@ -27,7 +27,9 @@
 
 #include "wiringPi.h"
 #include "wiringPiSPI.h"
+#include "wiringPiRegCache.h"
 #include "mcp23x0817.h"
+#include "mcp23x17isr.h"
 
 #include "mcp23s17.h"
 
@@ -49,7 +51,7 @@ static void writeByte (uint8_t spiPort, uint8_t devId, uint8_t reg, uint8_t data
   spiData [1] = reg ;
   spiData [2] = data ;
 
-  wiringPiSPIDataRW (spiPort, spiData, 3) ;
+  wiringPiSPIXfer (spiPort, spiData, NULL, 3) ;
 }
 
 /*
@@ -71,6 +73,66 @@ static uint8_t readByte (uint8_t spiPort, uint8_t devId, uint8_t reg)
 }
 
 
+/*
+ * readWord: writeWord:
+ *	Two registers in one transfer, the register given and then its
+ *	pair, low byte first.
+ *********************************************************************************
+ */
+
+static int readWord (uint8_t spiPort, uint8_t devId, uint8_t reg)
+{
+  uint8_t tx [4] = { CMD_READ | ((devId & 7) << 1), reg, 0, 0 } ;
+  uint8_t rx [4] ;
+
+  if (wiringPiSPIXfer (spiPort, tx, rx, 4) < 0)
+    return -1 ;
+
+  return rx [2] | (rx [3] << 8) ;
+}
+
+static int writeWord (uint8_t spiPort, uint8_t devId, uint8_t reg, unsigned int data)
+{
+  uint8_t spiData [4] ;
+
+  spiData [0] = CMD_WRITE | ((devId & 7) << 1) ;
+  spiData [1] = reg ;
+  spiData [2] = data & 0xFF ;
+  spiData [3] = (data >> 8) & 0xFF ;
+
+  return wiringPiSPIXfer (spiPort, spiData, NULL, 4) ;
+}
+
+/*
+ * myReadReg: myWriteReg:
+ *	Register access for the register cache
+ *********************************************************************************
+ */
+
+static int myReadReg (struct wiringPiNodeStruct *node, int reg)
+{
+  return readByte (node->data0, node->data1, reg) ;
+}
+
+static int myWriteReg (struct wiringPiNodeStruct *node, int reg, int value)
+{
+  writeByte (node->data0, node->data1, reg, value) ;
+  return 0 ;
+}
+
+
+/*
+ * myReadWord:
+ *	A register and its B-side partner in one transfer, for the
+ *	interrupt handler
+ *********************************************************************************
+ */
+
+static int myReadWord (struct wiringPiNodeStruct *node, int reg)
+{
+  return readWord (node->data0, node->data1, reg) ;
+}
+
 /*
  * myPinMode:
  *********************************************************************************
@@ -78,7 +140,7 @@ static uint8_t readByte (uint8_t spiPort, uint8_t devId, uint8_t reg)
 
 static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   pin -= node->pinBase ;
 
@@ -91,14 +153,8 @@ static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
   }
 
   mask = 1 << pin ;
-  old  = readByte (node->data0, node->data1, reg) ;
-
-  if (mode == OUTPUT)
-    old &= (~mask) ;
-  else
-    old |=   mask ;
 
-  writeByte (node->data0, node->data1, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == OUTPUT) ? 0 : mask) ;
 }
 
 
@@ -109,7 +165,7 @@ static void myPinMode (struct wiringPiNodeStruct *node, int pin, int mode)
 
 static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mode)
 {
-  int mask, old, reg ;
+  int mask, reg ;
 
   pin -= node->pinBase ;
 
@@ -122,14 +178,8 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
   }
 
   mask = 1 << pin ;
-  old  = readByte (node->data0, node->data1, reg) ;
 
-  if (mode == PUD_UP)
-    old |=   mask ;
-  else
-    old &= (~mask) ;
-
-  writeByte (node->data0, node->data1, reg, old) ;
+  wiringPiRegCacheUpdate (node, reg, mask, (mode == PUD_UP) ? mask : 0) ;
 }
 
 
@@ -140,36 +190,18 @@ static void myPullUpDnControl (struct wiringPiNodeStruct *node, int pin, int mod
 
 static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
 {
-  int bit, old ;
+  int bit, reg ;
 
   pin -= node->pinBase ;	// Pin now 0-15
 
   bit = 1 << (pin & 7) ;
 
   if (pin < 8)			// Bank A
-  {
-    old = node->data2 ;
-
-    if (value == LOW)
-      old &= (~bit) ;
-    else
-      old |=   bit ;
-
-    writeByte (node->data0, node->data1, MCP23x17_GPIOA, old) ;
-    node->data2 = old ;
-  }
+    reg = MCP23x17_OLATA ;
   else				// Bank B
-  {
-    old = node->data3 ;
-
-    if (value == LOW)
-      old &= (~bit) ;
-    else
-      old |=   bit ;
+    reg = MCP23x17_OLATB ;
 
-    writeByte (node->data0, node->data1, MCP23x17_GPIOB, old) ;
-    node->data3 = old ;
-  }
+  wiringPiRegCacheUpdate (node, reg, bit, (value == LOW) ? 0 : bit) ;
 }
 
 
@@ -202,6 +234,115 @@ static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
 }
 
 
+/*
+ * readPort:
+ *	Both GPIO ports in one go. With IOCON.BANK = 0 the address pointer
+ *	toggles between GPIOA and GPIOB, so a 2-byte read gets A then B.
+ *********************************************************************************
+ */
+
+static unsigned int readPort (struct wiringPiNodeStruct *node)
+{
+  int value ;
+
+  value = readWord (node->data0, node->data1, MCP23x17_GPIOA) ;
+
+  return (value < 0) ? 0 : (unsigned int)value ;
+}
+
+
+/*
+ * writePort:
+ *	Change the masked bits of the 16-bit output latch. A change confined
+ *	to one bank is a single register write, anything else writes OLATA
+ *	and OLATB together in one transfer.
+ *********************************************************************************
+ */
+
+static void writePort (struct wiringPiNodeStruct *node, unsigned int mask, unsigned int value)
+{
+  int latA, latB ;
+  unsigned int old, new ;
+
+  if ((mask & 0xFF00) == 0)
+  {
+    wiringPiRegCacheUpdate (node, MCP23x17_OLATA, mask, value) ;
+    return ;
+  }
+  if ((mask & 0x00FF) == 0)
+  {
+    wiringPiRegCacheUpdate (node, MCP23x17_OLATB, mask >> 8, value >> 8) ;
+    return ;
+  }
+
+  if (((latA = wiringPiRegCacheRead (node, MCP23x17_OLATA)) < 0) ||
+      ((latB = wiringPiRegCacheRead (node, MCP23x17_OLATB)) < 0))
+    return ;
+
+  old = (unsigned int)latA | ((unsigned int)latB << 8) ;
+  new = (old & ~mask) | (value & mask) ;
+
+  if (writeWord (node->data0, node->data1, MCP23x17_OLATA, new) < 0)
+  {
+    wiringPiRegCacheInvalidate (node) ;
+    return ;
+  }
+
+  wiringPiRegCacheSet (node, MCP23x17_OLATA, new & 0xFF) ;
+  wiringPiRegCacheSet (node, MCP23x17_OLATB, new >> 8) ;
+}
+
+
+/*
+ * myDigitalRead8: myDigitalRead16:
+ *	Bit n of the result is pin + n. A read that lines up with a bank
+ *	only touches that bank's register.
+ *********************************************************************************
+ */
+
+static unsigned int myDigitalRead8 (struct wiringPiNodeStruct *node, int pin)
+{
+  int value ;
+
+  pin -= node->pinBase ;
+
+  if ((pin == 0) || (pin == 8))
+  {
+    value = readByte (node->data0, node->data1, (pin == 0) ? MCP23x17_GPIOA : MCP23x17_GPIOB) ;
+    return (value < 0) ? 0 : (value & 0xFF) ;
+  }
+
+  return (readPort (node) >> pin) & 0xFF ;
+}
+
+static unsigned int myDigitalRead16 (struct wiringPiNodeStruct *node, int pin)
+{
+  return readPort (node) >> (pin - node->pinBase) ;
+}
+
+
+/*
+ * myDigitalWrite8: myDigitalWrite16:
+ *	Bit n of value drives pin + n, bits beyond the last pin are dropped,
+ *	so the 16-bit versions serve for 32-bit access as well.
+ *********************************************************************************
+ */
+
+static void myDigitalWrite8 (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  pin -= node->pinBase ;
+
+  writePort (node, (0xFF << pin) & 0xFFFF, ((unsigned int)value << pin) & 0xFFFF) ;
+}
+
+static void myDigitalWrite16 (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  pin -= node->pinBase ;
+
+  writePort (node, (0xFFFF << pin) & 0xFFFF, ((unsigned int)value << pin) & 0xFFFF) ;
+}
+
+
 /*
  * mcp23s17Setup:
  *	Create a new instance of an MCP23s17 SPI GPIO interface. We know it
@@ -228,8 +369,38 @@ int mcp23s17Setup (const int pinBase, const int spiPort, const int devId)
   node->pullUpDnControl = myPullUpDnControl ;
   node->digitalRead     = myDigitalRead ;
   node->digitalWrite    = myDigitalWrite ;
-  node->data2           = readByte (spiPort, devId, MCP23x17_OLATA) ;
-  node->data3           = readByte (spiPort, devId, MCP23x17_OLATB) ;
+  node->digitalRead8    = myDigitalRead8 ;
+  node->digitalRead16   = myDigitalRead16 ;
+  node->digitalRead32   = myDigitalRead16 ;
+  node->digitalWrite8   = myDigitalWrite8 ;
+  node->digitalWrite16  = myDigitalWrite16 ;
+  node->digitalWrite32  = myDigitalWrite16 ;
+
+  if (wiringPiRegCacheSetup (node, myReadReg, myWriteReg) < 0)
+    return FALSE ;
+
+  // Output latches are read once here and only ever written after this
+  wiringPiRegCacheRead (node, MCP23x17_OLATA) ;
+  wiringPiRegCacheRead (node, MCP23x17_OLATB) ;
 
   return TRUE ;
 }
+
+
+/*
+ * mcp23s17InterruptSetup:
+ *	The INT line of the MCP23S17 at pinBase is wired to hostPin. Input
+ *	changes are then picked up from the interrupt instead of polling the
+ *	SPI bus - see mcp23x17ISR() to attach a function to an expander pin.
+ *********************************************************************************
+ */
+
+int mcp23s17InterruptSetup (const int pinBase, const int hostPin)
+{
+  struct wiringPiNodeStruct *node ;
+
+  if (((node = wiringPiFindNode (pinBase)) == NULL) || (node->digitalRead != myDigitalRead))
+    return FALSE ;
+
+  return mcp23x17InterruptSetup (node, hostPin, myReadWord) ;
+}
@@ -27,6 +27,7 @@ extern "C" {
 #endif
 
 extern int mcp23s17Setup (int pinBase, int spiPort, int devId) ;
+extern int mcp23s17InterruptSetup (const int pinBase, const int hostPin) ;
 
 #ifdef __cplusplus
 }
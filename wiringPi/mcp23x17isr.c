@@ -0,0 +1,390 @@
+/*
+ * mcp23x17isr.c:
+ *	Interrupt driven input for the MCP23017 and MCP23S17 GPIO expanders.
+ *
+ *	Rather than polling the GPIO registers over the bus, the expander is
+ *	set to interrupt on change and its INT line is wired to a host pin.
+ *	Only when that pin falls do we read INTF/INTCAP (and GPIO, to catch
+ *	anything that changed while the line was held) and hand each changed
+ *	expander pin to its own callback.
+ *
+ *	INTA and INTB are mirrored and open-drain, so the INT lines of any
+ *	number of expanders may be tied together onto one host pin.
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "wiringPi.h"
+#include "wiringPiRegCache.h"
+#include "mcp23x0817.h"
+
+#include "mcp23x17isr.h"
+
+// Times round the expanders on one host pin before giving up on a
+//	line that will not go high again
+
+#define	MCP_INT_PASSES	4
+
+struct mcpIntDev
+{
+  struct wiringPiNodeStruct *node ;
+  int (*readWord) (struct wiringPiNodeStruct *node, int reg) ;
+
+  unsigned int enabled ;		// Pins with a callback
+  unsigned int last ;			// Port state last seen
+  int   modes [16] ;
+  void (*functions [16]) (int pin, int value, void *userData) ;
+  void *userData [16] ;
+
+  struct mcpIntDev *next ;
+} ;
+
+struct mcpIntHost
+{
+  int used ;
+  int pin ;
+  struct mcpIntDev *devs ;
+} ;
+
+static struct mcpIntHost hosts [MCP23x17_INT_HOSTS] ;
+
+static pthread_mutex_t intMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/*
+ * findDev:
+ *	Expander with an interrupt line that owns the given pin.
+ *	Called with intMutex held.
+ *********************************************************************************
+ */
+
+static struct mcpIntDev *findDev (int pin)
+{
+  struct mcpIntDev *dev ;
+  int slot ;
+
+  for (slot = 0 ; slot < MCP23x17_INT_HOSTS ; ++slot)
+    for (dev = hosts [slot].devs ; dev != NULL ; dev = dev->next)
+      if ((pin >= dev->node->pinBase) && (pin <= dev->node->pinMax))
+	return dev ;
+
+  return NULL ;
+}
+
+
+/*
+ * report:
+ *	Hand one pin change to its callback if the edge is wanted
+ *********************************************************************************
+ */
+
+static void report (struct mcpIntDev *dev, int bit, int value, int mode,
+	void (*function) (int pin, int value, void *userData), void *userData)
+{
+  if ((mode == INT_EDGE_BOTH) ||
+      ((mode == INT_EDGE_RISING)  && (value == HIGH)) ||
+      ((mode == INT_EDGE_FALLING) && (value == LOW)))
+    function (dev->node->pinBase + bit, value, userData) ;
+}
+
+
+/*
+ * serviceDev:
+ *	See if an expander has an interrupt pending and deal with it.
+ *	INTCAP holds the port as it was when the interrupt was raised and
+ *	reading it releases the INT line; GPIO then shows whatever has
+ *	changed since.
+ *********************************************************************************
+ */
+
+static int serviceDev (struct mcpIntDev *dev)
+{
+  int intf, cap, gpio, bit, mask ;
+  unsigned int enabled, last ;
+  int   modes [16] ;
+  void (*functions [16]) (int pin, int value, void *userData) ;
+  void *userData [16] ;
+
+  if ((intf = dev->readWord (dev->node, MCP23x17_INTFA)) <= 0)
+    return FALSE ;
+
+  if (((cap  = dev->readWord (dev->node, MCP23x17_INTCAPA)) < 0) ||
+      ((gpio = dev->readWord (dev->node, MCP23x17_GPIOA))   < 0))
+    return FALSE ;
+
+  // Take a copy so the callbacks may (un)register pins themselves
+
+  pthread_mutex_lock (&intMutex) ;
+    enabled   = dev->enabled ;
+    last      = dev->last ;
+    dev->last = gpio ;
+    for (bit = 0 ; bit < 16 ; ++bit)
+    {
+      modes     [bit] = dev->modes     [bit] ;
+      functions [bit] = dev->functions [bit] ;
+      userData  [bit] = dev->userData  [bit] ;
+    }
+  pthread_mutex_unlock (&intMutex) ;
+
+  for (bit = 0 ; bit < 16 ; ++bit)
+  {
+    mask = 1 << bit ;
+
+    if ((enabled & mask) == 0)
+      continue ;
+
+    if ((intf & mask) != 0)
+    {
+      report (dev, bit, (cap & mask) ? HIGH : LOW, modes [bit], functions [bit], userData [bit]) ;
+      if (((cap ^ gpio) & mask) != 0)
+	report (dev, bit, (gpio & mask) ? HIGH : LOW, modes [bit], functions [bit], userData [bit]) ;
+    }
+    else if (((last ^ gpio) & mask) != 0)
+      report (dev, bit, (gpio & mask) ? HIGH : LOW, modes [bit], functions [bit], userData [bit]) ;
+  }
+
+  return TRUE ;
+}
+
+
+/*
+ * hostInterrupt:
+ *	A host pin has fallen. Go round every expander on it until none has
+ *	anything pending - the line is shared, so another one may have
+ *	pulled it low while we were busy with the first.
+ *********************************************************************************
+ */
+
+static void hostInterrupt (int slot)
+{
+  struct mcpIntDev *dev, *devs ;
+  int pass, busy ;
+
+  pthread_mutex_lock (&intMutex) ;
+    devs = hosts [slot].devs ;
+  pthread_mutex_unlock (&intMutex) ;
+
+  for (pass = 0 ; pass < MCP_INT_PASSES ; ++pass)
+  {
+    busy = FALSE ;
+    for (dev = devs ; dev != NULL ; dev = dev->next)
+      if (serviceDev (dev))
+	busy = TRUE ;
+    if (!busy)
+      break ;
+  }
+}
+
+// wiringPiISR has no user data, so one small function per host pin
+
+static void hostInterrupt0 (void) { hostInterrupt (0) ; }
+static void hostInterrupt1 (void) { hostInterrupt (1) ; }
+static void hostInterrupt2 (void) { hostInterrupt (2) ; }
+static void hostInterrupt3 (void) { hostInterrupt (3) ; }
+static void hostInterrupt4 (void) { hostInterrupt (4) ; }
+static void hostInterrupt5 (void) { hostInterrupt (5) ; }
+static void hostInterrupt6 (void) { hostInterrupt (6) ; }
+static void hostInterrupt7 (void) { hostInterrupt (7) ; }
+
+static void (*hostInterrupts [MCP23x17_INT_HOSTS]) (void) =
+{
+  hostInterrupt0, hostInterrupt1, hostInterrupt2, hostInterrupt3,
+  hostInterrupt4, hostInterrupt5, hostInterrupt6, hostInterrupt7,
+} ;
+
+
+/*
+ * mcp23x17InterruptSetup:
+ *	Called by the MCP23017/MCP23S17 drivers to say the INT line of the
+ *	expander behind node is wired to hostPin. readWord must read a
+ *	register and its B-side partner in one transfer, A in the low byte.
+ *********************************************************************************
+ */
+
+int mcp23x17InterruptSetup (struct wiringPiNodeStruct *node, int hostPin,
+	int (*readWord) (struct wiringPiNodeStruct *node, int reg))
+{
+  struct mcpIntDev *dev ;
+  int slot, spare, gpio, attach ;
+
+  pthread_mutex_lock (&intMutex) ;
+
+  if (findDev (node->pinBase) != NULL)
+  {
+    pthread_mutex_unlock (&intMutex) ;
+    return TRUE ;
+  }
+
+  spare = -1 ;
+  for (slot = 0 ; slot < MCP23x17_INT_HOSTS ; ++slot)
+    if (hosts [slot].used && (hosts [slot].pin == hostPin))
+      break ;
+    else if (!hosts [slot].used && (spare == -1))
+      spare = slot ;
+
+  attach = (slot == MCP23x17_INT_HOSTS) ;
+  if (attach)
+  {
+    if (spare == -1)
+    {
+      pthread_mutex_unlock (&intMutex) ;
+      wiringPiFailure (WPI_ALMOST, "mcp23x17InterruptSetup: No free host interrupt slots\n") ;
+      return FALSE ;
+    }
+    slot = spare ;
+    hosts [slot].used = TRUE ;
+    hosts [slot].pin  = hostPin ;
+  }
+
+  pthread_mutex_unlock (&intMutex) ;
+
+  // Interrupt on change from the previous value, nothing enabled yet,
+  //	INTA/INTB mirrored and open-drain so lines can be shared
+
+  wiringPiRegCacheWrite  (node, MCP23x17_GPINTENA, 0) ;
+  wiringPiRegCacheWrite  (node, MCP23x17_GPINTENB, 0) ;
+  wiringPiRegCacheWrite  (node, MCP23x17_INTCONA,  0) ;
+  wiringPiRegCacheWrite  (node, MCP23x17_INTCONB,  0) ;
+  wiringPiRegCacheUpdate (node, MCP23x17_IOCON, IOCON_MIRROR | IOCON_ODR, IOCON_MIRROR | IOCON_ODR) ;
+
+  readWord (node, MCP23x17_INTCAPA) ;
+  gpio = readWord (node, MCP23x17_GPIOA) ;
+
+  if ((gpio < 0) || ((dev = calloc (1, sizeof (*dev))) == NULL))
+  {
+    if (attach)
+    {
+      pthread_mutex_lock (&intMutex) ;
+	hosts [slot].used = FALSE ;
+      pthread_mutex_unlock (&intMutex) ;
+    }
+    wiringPiFailure (WPI_ALMOST, "mcp23x17InterruptSetup: Unable to set up the expander at pin %d\n", node->pinBase) ;
+    return FALSE ;
+  }
+
+  dev->node     = node ;
+  dev->readWord = readWord ;
+  dev->last     = gpio ;
+
+  pthread_mutex_lock (&intMutex) ;
+    dev->next = hosts [slot].devs ;
+    hosts [slot].devs = dev ;
+  pthread_mutex_unlock (&intMutex) ;
+
+  // Not under intMutex - the host ISR runs with pinMutex held and then
+  //	takes intMutex, so wiringPiISR must not be called the other way round
+
+  if (attach)
+  {
+    pinMode         (hostPin, INPUT) ;
+    pullUpDnControl (hostPin, PUD_UP) ;
+    if (wiringPiISR (hostPin, INT_EDGE_FALLING, hostInterrupts [slot]) < 0)
+      return FALSE ;
+  }
+
+  return TRUE ;
+}
+
+
+/*
+ * mcp23x17ISR:
+ *	Call function whenever an expander pin changes. mode is one of
+ *	INT_EDGE_FALLING, INT_EDGE_RISING or INT_EDGE_BOTH. The pin should
+ *	already be an input and its expander must have had its interrupt
+ *	line set up.
+ *********************************************************************************
+ */
+
+int mcp23x17ISR (int pin, int mode,
+	void (*function) (int pin, int value, void *userData), void *userData)
+{
+  struct mcpIntDev *dev ;
+  int bit, gpio ;
+
+  if ((mode != INT_EDGE_FALLING) && (mode != INT_EDGE_RISING) && (mode != INT_EDGE_BOTH))
+    return wiringPiFailure (WPI_ALMOST, "mcp23x17ISR: Invalid mode %d for pin %d\n", mode, pin) ;
+
+  pthread_mutex_lock (&intMutex) ;
+
+  if ((dev = findDev (pin)) == NULL)
+  {
+    pthread_mutex_unlock (&intMutex) ;
+    return wiringPiFailure (WPI_ALMOST, "mcp23x17ISR: Pin %d has no interrupt line\n", pin) ;
+  }
+
+  bit = pin - dev->node->pinBase ;
+
+  dev->modes     [bit] = mode ;
+  dev->functions [bit] = function ;
+  dev->userData  [bit] = userData ;
+
+  if ((gpio = dev->readWord (dev->node, MCP23x17_GPIOA)) >= 0)
+    dev->last = (dev->last & ~(1u << bit)) | (gpio & (1u << bit)) ;
+
+  dev->enabled |= 1u << bit ;
+
+  if (bit < 8)
+    wiringPiRegCacheUpdate (dev->node, MCP23x17_GPINTENA, 1 << bit, 1 << bit) ;
+  else
+    wiringPiRegCacheUpdate (dev->node, MCP23x17_GPINTENB, 1 << (bit - 8), 1 << (bit - 8)) ;
+
+  pthread_mutex_unlock (&intMutex) ;
+
+  return 0 ;
+}
+
+
+/*
+ * mcp23x17ISRCancel:
+ *	Stop interrupts from an expander pin
+ *********************************************************************************
+ */
+
+int mcp23x17ISRCancel (int pin)
+{
+  struct mcpIntDev *dev ;
+  int bit ;
+
+  pthread_mutex_lock (&intMutex) ;
+
+  if ((dev = findDev (pin)) == NULL)
+  {
+    pthread_mutex_unlock (&intMutex) ;
+    return wiringPiFailure (WPI_ALMOST, "mcp23x17ISRCancel: Pin %d has no interrupt line\n", pin) ;
+  }
+
+  bit = pin - dev->node->pinBase ;
+
+  if (bit < 8)
+    wiringPiRegCacheUpdate (dev->node, MCP23x17_GPINTENA, 1 << bit, 0) ;
+  else
+    wiringPiRegCacheUpdate (dev->node, MCP23x17_GPINTENB, 1 << (bit - 8), 0) ;
+
+  dev->enabled &= ~(1u << bit) ;
+  dev->functions [bit] = NULL ;
+  dev->userData  [bit] = NULL ;
+
+  pthread_mutex_unlock (&intMutex) ;
+
+  return 0 ;
+}
@@ -0,0 +1,41 @@
+/*
+ * mcp23x17isr.h:
+ *	Interrupt driven input for the MCP23017 and MCP23S17 GPIO expanders
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of distinct host pins expander INT lines can be wired to
+
+#define	MCP23x17_INT_HOSTS	8
+
+extern int mcp23x17InterruptSetup (struct wiringPiNodeStruct *node, int hostPin,
+	int (*readWord) (struct wiringPiNodeStruct *node, int reg)) ;
+
+extern int mcp23x17ISR       (int pin, int mode,
+	void (*function) (int pin, int value, void *userData), void *userData) ;
+extern int mcp23x17ISRCancel (int pin) ;
+
+#ifdef __cplusplus
+}
+#endif
@@ -88,6 +88,7 @@ static const int phyToGpio[64] = {
 /*----------------------------------------------------------------------------*/
 /* ADC file descriptor */
 static int adcFds[2];
+static const char *adcNodes[2];
 
 /* GPIO mmap control */
 static volatile uint32_t *gpio;
@@ -116,6 +117,7 @@ static int		_pullUpDnControl	(int pin, int pud);
 static int		_digitalRead		(int pin);
 static int		_digitalWrite		(int pin, int value);
 static int		_analogRead		(int pin);
+static const char *	_getAdcNode		(int pin);
 static int		_digitalWriteByte	(const unsigned int value);
 static unsigned int	_digitalReadByte	(void);
 
@@ -537,13 +539,8 @@ UNU static int _digitalWrite (int pin, int value)
 }
 
 /*----------------------------------------------------------------------------*/
-static int _analogRead (int pin)
+static int _adcChannel (int pin)
 {
-	char value[5] = {0,};
-
-	if (lib->mode == MODE_GPIO_SYS)
-		return	-1;
-
 	/* wiringPi ADC number = pin 25, pin 29 */
 	switch (pin) {
 #if defined(ARDUINO)
@@ -563,13 +560,23 @@ static int _analogRead (int pin)
 	break;
 #endif
 	default:
-		return	0;
+		return	-1;
 	}
-	if (adcFds [pin] == -1)
+	return	pin;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _analogRead (int pin)
+{
+	char value[5] = {0,};
+
+	if (lib->mode == MODE_GPIO_SYS)
+		return	-1;
+
+	if ((pin = _adcChannel(pin)) < 0 || adcFds [pin] == -1)
 		return 0;
 
-	lseek(adcFds [pin], 0L, SEEK_SET);
-	if (read(adcFds [pin], &value[0], 4) < 0) {
+	if (pread(adcFds [pin], &value[0], 4, 0) < 0) {
 		msg(MSG_WARN, "%s: Error occurs when it reads from ADC file descriptor. \n", __func__);
 		return -1;
 	}
@@ -577,6 +584,15 @@ static int _analogRead (int pin)
 	return	atoi(value);
 }
 
+/*----------------------------------------------------------------------------*/
+static const char *_getAdcNode (int pin)
+{
+	if ((pin = _adcChannel(pin)) < 0)
+		return	NULL;
+
+	return	adcNodes [pin];
+}
+
 /*----------------------------------------------------------------------------*/
 static int _digitalWriteByte (const unsigned int value)
 {
@@ -698,6 +714,9 @@ static void init_adc_fds (void)
 
 	adcFds[0] = open(AIN0_NODE, O_RDONLY);
 	adcFds[1] = open(AIN1_NODE, O_RDONLY);
+
+	adcNodes[0] = AIN0_NODE;
+	adcNodes[1] = AIN1_NODE;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -712,6 +731,7 @@ void init_odroidc1 (struct libodroid *libwiring)
 	libwiring->digitalRead		= _digitalRead;
 	libwiring->digitalWrite		= _digitalWrite;
 	libwiring->analogRead		= _analogRead;
+	libwiring->getAdcNode		= _getAdcNode;
 	libwiring->digitalWriteByte	= _digitalWriteByte;
 	libwiring->digitalReadByte	= _digitalReadByte;
 
@@ -98,6 +98,37 @@ static int myDigitalRead (struct wiringPiNodeStruct *node, int pin)
 }
 
 
+/*
+ * myDigitalRead8: myDigitalWrite8:
+ *	The whole port in one bus transfer. Bit n of the value is pin + n;
+ *	with only 8 pins these serve for 16 and 32-bit access too.
+ *********************************************************************************
+ */
+
+static unsigned int myDigitalRead8 (struct wiringPiNodeStruct *node, int pin)
+{
+  int value ;
+
+  if ((value = wiringPiI2CRead (node->fd)) < 0)
+    return 0 ;
+
+  return (unsigned int)value >> (pin - node->pinBase) ;
+}
+
+static void myDigitalWrite8 (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  int mask, old ;
+
+  pin -= node->pinBase ;
+  mask = (0xFF << pin) & 0xFF ;
+
+  old = (node->data2 & ~mask) | ((value << pin) & mask) ;
+
+  wiringPiI2CWrite (node->fd, old) ;
+  node->data2 = old ;
+}
+
+
 /*
  * pcf8574Setup:
  *	Create a new instance of a PCF8574 I2C GPIO interface. We know it
@@ -120,6 +151,12 @@ int pcf8574Setup (const int pinBase, const int i2cAddress)
   node->pinMode      = myPinMode ;
   node->digitalRead  = myDigitalRead ;
   node->digitalWrite = myDigitalWrite ;
+  node->digitalRead8   = myDigitalRead8 ;
+  node->digitalRead16  = myDigitalRead8 ;
+  node->digitalRead32  = myDigitalRead8 ;
+  node->digitalWrite8  = myDigitalWrite8 ;
+  node->digitalWrite16 = myDigitalWrite8 ;
+  node->digitalWrite32 = myDigitalWrite8 ;
   node->data2        = wiringPiI2CRead (fd) ;
 
   return TRUE ;
@@ -0,0 +1,399 @@
+/*
+ * softI2c.c:
+ *	I2C master bit-banged on any pins. Transfers are given as i2c_msg
+ *	lists, as for the I2C_RDWR ioctl, so wiringPiI2C can put a soft bus
+ *	behind the same handles as a /dev/i2c one.
+ *
+ *	The lines are open-drain: a pin is released by making it an input
+ *	and the external (or internal) pull-up takes it high, and only ever
+ *	driven low. Slaves may hold SCL low to stretch the clock.
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/i2c.h>
+
+#include "wiringPi.h"
+#include "softI2c.h"
+
+// How long a slave may stretch the clock before the transfer is given up,
+//	the SMBus limit.
+
+#define	STRETCH_TIMEOUT_NS	25000000L
+
+struct softI2cStruct
+{
+  struct wiringPiPinStruct sda, scl ;
+  unsigned halfNs ;		// Each half clock, on top of the pin changes
+  pthread_mutex_t lock ;
+} ;
+
+
+/*
+ * Line control:
+ *	release lets the pull-up take a line high, drive pulls it low. The
+ *	output latches are set low once at create, so switching the mode is
+ *	all that is needed after that.
+ *********************************************************************************
+ */
+
+static inline void release (struct wiringPiPinStruct *pin)
+{
+  wiringPiPinMode (pin, INPUT) ;
+}
+
+static inline void drive (struct wiringPiPinStruct *pin)
+{
+  wiringPiPinMode (pin, OUTPUT) ;
+}
+
+
+/*
+ * sclHigh:
+ *	Release SCL and wait for it to go high, which it won't while a slave
+ *	is stretching the clock.
+ *********************************************************************************
+ */
+
+static int sclHigh (struct softI2cStruct *i2c)
+{
+  struct timespec start, now ;
+
+  release (&i2c->scl) ;
+  if (wiringPiPinRead (&i2c->scl) == HIGH)
+    return 0 ;
+
+  clock_gettime (CLOCK_MONOTONIC, &start) ;
+  while (wiringPiPinRead (&i2c->scl) == LOW)
+  {
+    clock_gettime (CLOCK_MONOTONIC, &now) ;
+    if ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) > STRETCH_TIMEOUT_NS)
+    {
+      errno = ETIMEDOUT ;
+      return -1 ;
+    }
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * start: stop:
+ *	Generate a (repeated) start or a stop condition. Both are left with
+ *	SCL low, ready for the first bit, except stop, which leaves the bus
+ *	idle with both lines released.
+ *********************************************************************************
+ */
+
+static int start (struct softI2cStruct *i2c)
+{
+  release (&i2c->sda) ;
+  delayNanoseconds (i2c->halfNs) ;
+  if (sclHigh (i2c) < 0)
+    return -1 ;
+  delayNanoseconds (i2c->halfNs) ;
+
+  if (wiringPiPinRead (&i2c->sda) == LOW)	// Someone else has the bus
+  {
+    errno = EAGAIN ;
+    return -1 ;
+  }
+
+  drive (&i2c->sda) ;
+  delayNanoseconds (i2c->halfNs) ;
+  drive (&i2c->scl) ;
+
+  return 0 ;
+}
+
+static void stop (struct softI2cStruct *i2c)
+{
+  drive (&i2c->sda) ;
+  delayNanoseconds (i2c->halfNs) ;
+  sclHigh (i2c) ;
+  delayNanoseconds (i2c->halfNs) ;
+  release (&i2c->sda) ;
+  delayNanoseconds (i2c->halfNs) ;
+}
+
+
+/*
+ * writeBit: readBit:
+ *	Clock a single bit, SCL starting and ending low
+ *********************************************************************************
+ */
+
+static int writeBit (struct softI2cStruct *i2c, int bit)
+{
+  if (bit)
+    release (&i2c->sda) ;
+  else
+    drive (&i2c->sda) ;
+
+  delayNanoseconds (i2c->halfNs) ;
+  if (sclHigh (i2c) < 0)
+    return -1 ;
+  delayNanoseconds (i2c->halfNs) ;
+  drive (&i2c->scl) ;
+
+  return 0 ;
+}
+
+static int readBit (struct softI2cStruct *i2c)
+{
+  int bit ;
+
+  release (&i2c->sda) ;
+  delayNanoseconds (i2c->halfNs) ;
+  if (sclHigh (i2c) < 0)
+    return -1 ;
+  bit = wiringPiPinRead (&i2c->sda) ;
+  delayNanoseconds (i2c->halfNs) ;
+  drive (&i2c->scl) ;
+
+  return bit ;
+}
+
+
+/*
+ * writeByte: readByte:
+ *	Send a byte and return the acknowledge bit the slave sent (0 for
+ *	ACK), or receive one and acknowledge it if ack is set.
+ *********************************************************************************
+ */
+
+static int writeByte (struct softI2cStruct *i2c, int byte)
+{
+  int bit ;
+
+  for (bit = 7 ; bit >= 0 ; --bit)
+    if (writeBit (i2c, (byte >> bit) & 1) < 0)
+      return -1 ;
+
+  return readBit (i2c) ;
+}
+
+static int readByte (struct softI2cStruct *i2c, int ack)
+{
+  int bit, b, byte = 0 ;
+
+  for (bit = 0 ; bit < 8 ; ++bit)
+  {
+    if ((b = readBit (i2c)) < 0)
+      return -1 ;
+    byte = (byte << 1) | b ;
+  }
+
+  if (writeBit (i2c, !ack) < 0)
+    return -1 ;
+
+  return byte ;
+}
+
+
+/*
+ * softI2cCreate:
+ *	Set up a bus on the given pins at roughly speed Hz (100000 for
+ *	standard mode). The internal pull-ups are turned on, but are weak;
+ *	the usual external resistors are still wanted on anything but a
+ *	short, slow bus. Returns NULL with errno set on failure.
+ *********************************************************************************
+ */
+
+struct softI2cStruct *softI2cCreate (int sdaPin, int sclPin, int speed)
+{
+  struct softI2cStruct *i2c ;
+  struct timespec t0, t1 ;
+  unsigned modeNs ;
+  int i ;
+
+  if (speed <= 0)
+  {
+    errno = EINVAL ;
+    return NULL ;
+  }
+
+  if ((i2c = calloc (1, sizeof (*i2c))) == NULL)
+    return NULL ;
+
+  if ((wiringPiPinResolve (sdaPin, &i2c->sda) < 0) ||
+      (wiringPiPinResolve (sclPin, &i2c->scl) < 0))
+  {
+    free (i2c) ;
+    return NULL ;
+  }
+
+  pullUpDnControl (sdaPin, PUD_UP) ;
+  pullUpDnControl (sclPin, PUD_UP) ;
+
+  release (&i2c->sda) ;
+  release (&i2c->scl) ;
+  wiringPiPinWrite (&i2c->sda, LOW) ;
+  wiringPiPinWrite (&i2c->scl, LOW) ;
+
+// Time a line change, releasing SCL which is where it is anyway
+
+  clock_gettime (CLOCK_MONOTONIC, &t0) ;
+  for (i = 0 ; i < 64 ; ++i)
+    release (&i2c->scl) ;
+  clock_gettime (CLOCK_MONOTONIC, &t1) ;
+
+  modeNs      = ((t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec)) / 64 ;
+  i2c->halfNs = 500000000U / speed ;
+  i2c->halfNs = (i2c->halfNs > modeNs) ? i2c->halfNs - modeNs : 0 ;
+
+  pthread_mutex_init (&i2c->lock, NULL) ;
+
+  return i2c ;
+}
+
+
+/*
+ * softI2cFree:
+ *	Let go of the bus, leaving both lines released
+ *********************************************************************************
+ */
+
+void softI2cFree (struct softI2cStruct *i2c)
+{
+  if (i2c == NULL)
+    return ;
+
+  pthread_mutex_destroy (&i2c->lock) ;
+  free (i2c) ;
+}
+
+
+/*
+ * transferMsg:
+ *	Address a slave and move the data of one segment. The address is
+ *	left out for I2C_M_NOSTART. For I2C_M_RECV_LEN the first byte read
+ *	is the count of those to follow and is added on to the length, as
+ *	the kernel does - the buffer has to have room for that.
+ *********************************************************************************
+ */
+
+static int transferMsg (struct softI2cStruct *i2c, struct i2c_msg *msg)
+{
+  int ignoreNak = msg->flags & I2C_M_IGNORE_NAK ;
+  int i, len, b ;
+
+  if (!(msg->flags & I2C_M_NOSTART))
+  {
+    if ((b = writeByte (i2c, (msg->addr << 1) | ((msg->flags & I2C_M_RD) ? 1 : 0))) < 0)
+      return -1 ;
+    if (b && !ignoreNak)
+    {
+      errno = ENXIO ;
+      return -1 ;
+    }
+  }
+
+  len = msg->len ;
+
+  if (msg->flags & I2C_M_RD)
+  {
+    for (i = 0 ; i < len ; ++i)
+    {
+      if ((b = readByte (i2c, i < len - 1 || ((msg->flags & I2C_M_RECV_LEN) && (i == 0)))) < 0)
+	return -1 ;
+      msg->buf [i] = b ;
+
+      if ((msg->flags & I2C_M_RECV_LEN) && (i == 0))
+      {
+	if ((b == 0) || (b > I2C_SMBUS_BLOCK_MAX))
+	{
+	  errno = EPROTO ;
+	  return -1 ;
+	}
+	len      += b ;
+	msg->len  = len ;
+      }
+    }
+  }
+  else
+  {
+    for (i = 0 ; i < len ; ++i)
+    {
+      if ((b = writeByte (i2c, msg->buf [i])) < 0)
+	return -1 ;
+      if (b && !ignoreNak)
+      {
+	errno = EIO ;
+	return -1 ;
+      }
+    }
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * softI2cTransfer:
+ *	Run a list of segments with repeated starts between them and one stop
+ *	at the end, as I2C_RDWR does. Returns the number of segments done, or
+ *	-1 with errno ENXIO when a slave doesn't answer its address, EIO when
+ *	it refuses data, ETIMEDOUT when it stretches the clock too long and
+ *	EOPNOTSUPP for 10-bit addresses.
+ *********************************************************************************
+ */
+
+int softI2cTransfer (struct softI2cStruct *i2c, struct i2c_msg *msgs, int nmsgs)
+{
+  int i, err, ret = 0 ;
+
+  if ((i2c == NULL) || (nmsgs <= 0))
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  for (i = 0 ; i < nmsgs ; ++i)
+    if (msgs [i].flags & I2C_M_TEN)
+    {
+      errno = EOPNOTSUPP ;
+      return -1 ;
+    }
+
+  pthread_mutex_lock (&i2c->lock) ;
+
+  for (i = 0 ; (i < nmsgs) && (ret == 0) ; ++i)
+  {
+    if ((i == 0) || !(msgs [i].flags & I2C_M_NOSTART))
+      ret = start (i2c) ;
+    if (ret == 0)
+      ret = transferMsg (i2c, &msgs [i]) ;
+  }
+
+  err = errno ;
+  stop (i2c) ;
+  errno = err ;
+
+  pthread_mutex_unlock (&i2c->lock) ;
+
+  return (ret < 0) ? -1 : nmsgs ;
+}
@@ -0,0 +1,37 @@
+/*
+ * softI2c.h:
+ *	I2C master bit-banged on any pins
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct softI2cStruct ;
+struct i2c_msg ;
+
+extern struct softI2cStruct *softI2cCreate (int sdaPin, int sclPin, int speed) ;
+extern void softI2cFree     (struct softI2cStruct *i2c) ;
+extern int  softI2cTransfer (struct softI2cStruct *i2c, struct i2c_msg *msgs, int nmsgs) ;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,258 @@
+/*
+ * softSpi.c:
+ *	SPI master bit-banged on any pins, for boards without a hardware
+ *	SPI controller (or with it on the wrong pins). Transfers are given
+ *	as spidev spi_ioc_transfer lists, so wiringPiSPI can put a soft bus
+ *	behind the same handles as a /dev/spidev one.
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/spi/spidev.h>
+
+#include "wiringPi.h"
+#include "softSpi.h"
+
+// MOSI, MISO and CS are optional: a pin of -1 is simply not driven or
+//	sampled, e.g. for write-only displays or a chip select handled by
+//	the caller.
+
+struct softSpiStruct
+{
+  struct wiringPiPinStruct sclk, mosi, miso, cs ;
+  int      haveMosi, haveMiso, haveCs ;
+  unsigned writeNs ;		// What one pin write costs, measured at create
+  pthread_mutex_t lock ;
+} ;
+
+
+/*
+ * softSpiCreate:
+ *	Resolve the pins, make them outputs (MISO an input), park chip select
+ *	high and time a pin write so the clock delays can allow for it.
+ *	Returns NULL with errno set on failure.
+ *********************************************************************************
+ */
+
+struct softSpiStruct *softSpiCreate (int sclkPin, int mosiPin, int misoPin, int csPin)
+{
+  struct softSpiStruct *spi ;
+  struct timespec start, end ;
+  int i ;
+
+  if ((spi = calloc (1, sizeof (*spi))) == NULL)
+    return NULL ;
+
+  spi->haveMosi = (mosiPin >= 0) ;
+  spi->haveMiso = (misoPin >= 0) ;
+  spi->haveCs   = (csPin   >= 0) ;
+
+  if ((wiringPiPinResolve (sclkPin, &spi->sclk) < 0) ||
+      (spi->haveMosi && (wiringPiPinResolve (mosiPin, &spi->mosi) < 0)) ||
+      (spi->haveMiso && (wiringPiPinResolve (misoPin, &spi->miso) < 0)) ||
+      (spi->haveCs   && (wiringPiPinResolve (csPin,   &spi->cs)   < 0)))
+  {
+    free (spi) ;
+    return NULL ;
+  }
+
+  if (spi->haveCs)
+  {
+    wiringPiPinWrite (&spi->cs, HIGH) ;
+    wiringPiPinMode  (&spi->cs, OUTPUT) ;
+  }
+  if (spi->haveMosi)
+    wiringPiPinMode (&spi->mosi, OUTPUT) ;
+  if (spi->haveMiso)
+    wiringPiPinMode (&spi->miso, INPUT) ;
+  wiringPiPinMode (&spi->sclk, OUTPUT) ;
+
+  clock_gettime (CLOCK_MONOTONIC, &start) ;
+  for (i = 0 ; i < 64 ; ++i)
+    wiringPiPinWrite (&spi->sclk, LOW) ;
+  clock_gettime (CLOCK_MONOTONIC, &end) ;
+
+  spi->writeNs = ((end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec)) / 64 ;
+
+  pthread_mutex_init (&spi->lock, NULL) ;
+
+  return spi ;
+}
+
+
+/*
+ * softSpiFree:
+ *	Let go of the pins. Chip select is left high, the rest as they are.
+ *********************************************************************************
+ */
+
+void softSpiFree (struct softSpiStruct *spi)
+{
+  if (spi == NULL)
+    return ;
+
+  pthread_mutex_destroy (&spi->lock) ;
+  free (spi) ;
+}
+
+
+/*
+ * shiftWord:
+ *	Clock one word of bits out and in, MSB first, in the given mode.
+ *	With CPHA 0 the data is set up before the leading clock edge and
+ *	sampled on it, with CPHA 1 it changes on the leading edge and is
+ *	sampled on the trailing one.
+ *********************************************************************************
+ */
+
+static uint32_t shiftWord (struct softSpiStruct *spi, int mode, uint32_t out, int bits, unsigned halfNs)
+{
+  int idle   = (mode & SPI_CPOL) ? HIGH : LOW ;
+  int active = !idle ;
+  uint32_t in = 0 ;
+  int bit ;
+
+  for (bit = bits - 1 ; bit >= 0 ; --bit)
+  {
+    if (mode & SPI_CPHA)
+    {
+      wiringPiPinWrite (&spi->sclk, active) ;
+      if (spi->haveMosi)
+	wiringPiPinWrite (&spi->mosi, (out >> bit) & 1) ;
+      delayNanoseconds (halfNs) ;
+      wiringPiPinWrite (&spi->sclk, idle) ;
+      if (spi->haveMiso)
+	in = (in << 1) | (wiringPiPinRead (&spi->miso) & 1) ;
+      delayNanoseconds (halfNs) ;
+    }
+    else
+    {
+      if (spi->haveMosi)
+	wiringPiPinWrite (&spi->mosi, (out >> bit) & 1) ;
+      delayNanoseconds (halfNs) ;
+      wiringPiPinWrite (&spi->sclk, active) ;
+      if (spi->haveMiso)
+	in = (in << 1) | (wiringPiPinRead (&spi->miso) & 1) ;
+      delayNanoseconds (halfNs) ;
+      wiringPiPinWrite (&spi->sclk, idle) ;
+    }
+  }
+
+  return in ;
+}
+
+
+/*
+ * softSpiTransfer:
+ *	Run a list of transfers the way SPI_IOC_MESSAGE(n) would: chip select
+ *	is taken low for the lot and only raised between transfers marked
+ *	cs_change, and after the last one. Each transfer's speed_hz and
+ *	bits_per_word are honoured (0 meaning as fast as the pins go, and 8
+ *	bits); words wider than 8 bits take 2 or 4 bytes in native order,
+ *	as spidev has them. Only the CPOL and CPHA bits of mode are used.
+ *	Returns the number of bytes transferred.
+ *********************************************************************************
+ */
+
+int softSpiTransfer (struct softSpiStruct *spi, int mode, struct spi_ioc_transfer *xfer, int n)
+{
+  const uint8_t *tx ;
+  uint8_t *rx ;
+  unsigned halfNs ;
+  uint32_t out, in ;
+  int i, bits, width, pos, total = 0 ;
+
+  if ((spi == NULL) || (n <= 0))
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  for (i = 0 ; i < n ; ++i)
+    if (xfer [i].bits_per_word > 32)
+    {
+      errno = EINVAL ;
+      return -1 ;
+    }
+
+  pthread_mutex_lock (&spi->lock) ;
+
+  wiringPiPinWrite (&spi->sclk, (mode & SPI_CPOL) ? HIGH : LOW) ;
+  if (spi->haveCs)
+    wiringPiPinWrite (&spi->cs, LOW) ;
+
+  for (i = 0 ; i < n ; ++i)
+  {
+    tx     = (const uint8_t *)(uintptr_t)xfer [i].tx_buf ;
+    rx     = (uint8_t *)(uintptr_t)xfer [i].rx_buf ;
+    bits   = (xfer [i].bits_per_word == 0) ? 8 : xfer [i].bits_per_word ;
+    width  = (bits <= 8) ? 1 : (bits <= 16) ? 2 : 4 ;
+    halfNs = 0 ;
+
+    if (xfer [i].speed_hz != 0)
+    {
+      halfNs = 500000000U / xfer [i].speed_hz ;
+      halfNs = (halfNs > spi->writeNs) ? halfNs - spi->writeNs : 0 ;
+    }
+
+    for (pos = 0 ; pos + width <= (int)xfer [i].len ; pos += width)
+    {
+      out = 0 ;
+      if (tx != NULL)
+      {
+	if      (width == 1) out = tx [pos] ;
+	else if (width == 2) out = *(const uint16_t *)(tx + pos) ;
+	else                 out = *(const uint32_t *)(tx + pos) ;
+      }
+
+      in = shiftWord (spi, mode, out, bits, halfNs) ;
+
+      if (rx != NULL)
+      {
+	if      (width == 1) rx [pos] = in ;
+	else if (width == 2) *(uint16_t *)(rx + pos) = in ;
+	else                 *(uint32_t *)(rx + pos) = in ;
+      }
+    }
+    total += xfer [i].len ;
+
+    if (xfer [i].delay_usecs != 0)
+      delayMicroseconds (xfer [i].delay_usecs) ;
+
+    if (spi->haveCs && xfer [i].cs_change && (i < n - 1))
+    {
+      wiringPiPinWrite (&spi->cs, HIGH) ;
+      delayMicroseconds (1) ;
+      wiringPiPinWrite (&spi->cs, LOW) ;
+    }
+  }
+
+  if (spi->haveCs)
+    wiringPiPinWrite (&spi->cs, HIGH) ;
+
+  pthread_mutex_unlock (&spi->lock) ;
+
+  return total ;
+}
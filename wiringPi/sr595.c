@@ -2,9 +2,12 @@
  * sr595.c:
  *	Extend wiringPi with the 74x595 shift register as a GPIO
  *	expander chip.
- *	Note that the code can cope with a number of 595's
- *	daisy-chained together - up to 4 for now as we're storing
- *	the output "register" in a single unsigned int.
+ *	Note that the code can cope with any number of 595's
+ *	daisy-chained together. The outputs are kept in memory and
+ *	only shifted out when they change - or, between sr595Begin()
+ *	and sr595Commit(), once at the end for the whole group.
+ *	The chain can be clocked by bit-banging any 3 pins, or from
+ *	a hardware SPI channel with just the latch on a GPIO pin.
  *
  *	Copyright (c) 2013 Gordon Henderson
  ***********************************************************************
@@ -29,50 +32,263 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "wiringPi.h"
+#include "wiringPiSPI.h"
 
 #include "sr595.h"
 
 
+struct sr595Chain
+{
+  int spiChannel ;		// -1 when bit-banging
+  int delayUs ;			// Around each clock edge when bit-banging
+  int depth ;			// Nested sr595Begin() calls
+  int dirty ;			// Outputs changed since the last shift
+  int bytes ;
+  uint8_t *output ;		// output [0] holds pins 0-7
+} ;
+
+static struct sr595Chain **chains = NULL ;
+static int numChains = 0 ;
+
+
 /*
- * myDigitalWrite:
+ * getChain:
+ *	The chain behind a node, or NULL if it isn't a 74x595 node.
+ *	node->data3 holds our index into chains [].
  *********************************************************************************
  */
 
-static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
+static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value) ;
+
+static struct sr595Chain *getChain (const int pinBase)
 {
-  unsigned int mask ;
+  struct wiringPiNodeStruct *node ;
+
+  if (((node = wiringPiFindNode (pinBase)) == NULL) || (node->digitalWrite != myDigitalWrite))
+    return NULL ;
+
+  return chains [node->data3] ;
+}
+
+
+/*
+ * shiftOutput:
+ *	Clock the output register out to the chain and latch it. The last
+ *	pin goes out first so that pin 0 ends up on the first chip.
+ *********************************************************************************
+ */
+
+static void shiftOutput (struct wiringPiNodeStruct *node)
+{
+  struct sr595Chain *chain = chains [node->data3] ;
+  uint8_t spiData [chain->bytes] ;
   int  dataPin, clockPin, latchPin ;
-  int  bit, bits, output ;
+  int  bit, bits, delayUs, i ;
+
+  if (chain->depth > 0)			// Inside sr595Begin/Commit
+  {
+    chain->dirty = TRUE ;
+    return ;
+  }
+  chain->dirty = FALSE ;
 
-  pin     -= node->pinBase ;				// Normalise pin number
   bits     = node->pinMax - node->pinBase + 1 ;		// ie. number of clock pulses
   dataPin  = node->data0 ;
   clockPin = node->data1 ;
   latchPin = node->data2 ;
-  output   = node->data3 ;
-
-  mask = 1 << pin ;
-
-  if (value == LOW)
-    output &= (~mask) ;
-  else
-    output |=   mask ;
-
-  node->data3 = output ;
+  delayUs  = chain->delayUs ;
 
 // A low -> high latch transition copies the latch to the output pins
 
-  digitalWrite (latchPin, LOW) ; delayMicroseconds (1) ;
+  digitalWrite (latchPin, LOW) ; if (delayUs) delayMicroseconds (delayUs) ;
+
+  if (chain->spiChannel >= 0)		// Whole bytes, MSB of the last chip first
+  {
+    for (i = 0 ; i < chain->bytes ; ++i)
+      spiData [i] = chain->output [chain->bytes - 1 - i] ;
+    wiringPiSPIXfer (chain->spiChannel, spiData, NULL, chain->bytes) ;
+  }
+  else
     for (bit = bits - 1 ; bit >= 0 ; --bit)
     {
-      digitalWrite (dataPin, output & (1 << bit)) ;
+      digitalWrite (dataPin, (chain->output [bit >> 3] >> (bit & 7)) & 1) ;
 
-      digitalWrite (clockPin, HIGH) ; delayMicroseconds (1) ;
-      digitalWrite (clockPin, LOW) ;  delayMicroseconds (1) ;
+      digitalWrite (clockPin, HIGH) ; if (delayUs) delayMicroseconds (delayUs) ;
+      digitalWrite (clockPin, LOW) ;  if (delayUs) delayMicroseconds (delayUs) ;
     }
-  digitalWrite (latchPin, HIGH) ; delayMicroseconds (1) ;
+
+  digitalWrite (latchPin, HIGH) ; if (delayUs) delayMicroseconds (delayUs) ;
+}
+
+
+/*
+ * setBits:
+ *	Change count outputs from pin onwards, bit n of value being pin + n.
+ *	Nothing is shifted out if none of them actually change.
+ *********************************************************************************
+ */
+
+static void setBits (struct wiringPiNodeStruct *node, int pin, unsigned int value, int count)
+{
+  struct sr595Chain *chain = chains [node->data3] ;
+  uint8_t old, mask ;
+  int i, changed = FALSE ;
+
+  pin -= node->pinBase ;
+
+  for (i = 0 ; (i < count) && (pin + i <= node->pinMax - node->pinBase) ; ++i)
+  {
+    mask = 1 << ((pin + i) & 7) ;
+    old  = chain->output [(pin + i) >> 3] ;
+
+    if ((value >> i) & 1)
+      chain->output [(pin + i) >> 3] |= mask ;
+    else
+      chain->output [(pin + i) >> 3] &= ~mask ;
+
+    if (chain->output [(pin + i) >> 3] != old)
+      changed = TRUE ;
+  }
+
+  if (changed || chain->dirty)
+    shiftOutput (node) ;
+}
+
+
+/*
+ * myDigitalWrite:
+ * myDigitalWrite8: myDigitalWrite16: myDigitalWrite32:
+ *********************************************************************************
+ */
+
+static void myDigitalWrite (struct wiringPiNodeStruct *node, int pin, int value)
+{
+  setBits (node, pin, (value == LOW) ? 0 : 1, 1) ;
+}
+
+static void myDigitalWrite8  (struct wiringPiNodeStruct *node, int pin, int value) { setBits (node, pin, value, 8) ; }
+static void myDigitalWrite16 (struct wiringPiNodeStruct *node, int pin, int value) { setBits (node, pin, value, 16) ; }
+static void myDigitalWrite32 (struct wiringPiNodeStruct *node, int pin, int value) { setBits (node, pin, value, 32) ; }
+
+
+/*
+ * sr595Write:
+ *	Set the whole chain from a byte array, data [0] being pins 0-7
+ *	of the first chip. Any outputs beyond len bytes are left alone.
+ *********************************************************************************
+ */
+
+void sr595Write (const int pinBase, const unsigned char *data, const int len)
+{
+  struct sr595Chain *chain ;
+  int n ;
+
+  if ((chain = getChain (pinBase)) == NULL)
+    return ;
+
+  n = (len < chain->bytes) ? len : chain->bytes ;
+  if ((n <= 0) || ((memcmp (chain->output, data, n) == 0) && !chain->dirty))
+    return ;
+
+  memcpy (chain->output, data, n) ;
+  shiftOutput (wiringPiFindNode (pinBase)) ;
+}
+
+
+/*
+ * sr595Begin: sr595Commit:
+ *	Group any number of writes to the chain into one shift and latch:
+ *	between these the outputs are only changed in memory. Calls may be
+ *	nested, the chain is latched by the outermost sr595Commit().
+ *********************************************************************************
+ */
+
+void sr595Begin (const int pinBase)
+{
+  struct sr595Chain *chain ;
+
+  if ((chain = getChain (pinBase)) != NULL)
+    ++chain->depth ;
+}
+
+void sr595Commit (const int pinBase)
+{
+  struct sr595Chain *chain ;
+
+  if (((chain = getChain (pinBase)) == NULL) || (chain->depth == 0))
+    return ;
+
+  if ((--chain->depth == 0) && chain->dirty)
+    shiftOutput (wiringPiFindNode (pinBase)) ;
+}
+
+
+/*
+ * sr595SetDelay:
+ *	Delay in uS around each clock and latch edge. The default of 1 suits
+ *	long wires to the chain; 0 clocks it as fast as the pins will go.
+ *********************************************************************************
+ */
+
+void sr595SetDelay (const int pinBase, const int delayUs)
+{
+  struct sr595Chain *chain ;
+
+  if ((chain = getChain (pinBase)) != NULL)
+    chain->delayUs = (delayUs < 0) ? 0 : delayUs ;
+}
+
+
+/*
+ * newChain:
+ *	Create the node and its output register
+ *********************************************************************************
+ */
+
+static struct wiringPiNodeStruct *newChain (const int pinBase, const int numPins, const int spiChannel)
+{
+  struct wiringPiNodeStruct *node ;
+  struct sr595Chain *chain, **table ;
+
+  if (numPins <= 0)
+    return NULL ;
+
+  if ((chain = calloc (1, sizeof (*chain))) == NULL)
+    return NULL ;
+
+  chain->spiChannel = spiChannel ;
+  chain->delayUs    = (spiChannel >= 0) ? 0 : 1 ;
+  chain->bytes      = (numPins + 7) / 8 ;
+  chain->dirty      = TRUE ;		// Chips power up in any state
+
+  if ((chain->output = calloc (chain->bytes, 1)) == NULL)
+  {
+    free (chain) ;
+    return NULL ;
+  }
+
+  if ((table = realloc (chains, (numChains + 1) * sizeof (*table))) == NULL)
+  {
+    free (chain->output) ;
+    free (chain) ;
+    return NULL ;
+  }
+  chains = table ;
+  chains [numChains] = chain ;
+
+  node = wiringPiNewNode (pinBase, numPins) ;
+
+  node->data3           = numChains++ ;
+  node->digitalWrite    = myDigitalWrite ;
+  node->digitalWrite8   = myDigitalWrite8 ;
+  node->digitalWrite16  = myDigitalWrite16 ;
+  node->digitalWrite32  = myDigitalWrite32 ;
+
+  return node ;
 }
 
 
@@ -87,13 +303,12 @@ int sr595Setup (const int pinBase, const int numPins,
 {
   struct wiringPiNodeStruct *node ;
 
-  node = wiringPiNewNode (pinBase, numPins) ;
+  if ((node = newChain (pinBase, numPins, -1)) == NULL)
+    return FALSE ;
 
   node->data0           = dataPin ;
   node->data1           = clockPin ;
   node->data2           = latchPin ;
-  node->data3           = 0 ;		// Output register
-  node->digitalWrite    = myDigitalWrite ;
 
 // Initialise the underlying hardware
 
@@ -107,3 +322,32 @@ int sr595Setup (const int pinBase, const int numPins,
 
   return TRUE ;
 }
+
+
+/*
+ * sr595SetupSPI:
+ *	As above, but the chain's data and clock inputs are on the MOSI and
+ *	SCLK pins of an SPI channel, which shifts the bytes out in hardware.
+ *	Only the latch needs a GPIO pin. The chain is always sent in whole
+ *	bytes, so numPins should be a multiple of 8.
+ *********************************************************************************
+ */
+
+int sr595SetupSPI (const int pinBase, const int numPins,
+	const int spiChannel, const int speed, const int latchPin)
+{
+  struct wiringPiNodeStruct *node ;
+
+  if (wiringPiSPISetup (spiChannel, speed) < 0)
+    return FALSE ;
+
+  if ((node = newChain (pinBase, numPins, spiChannel)) == NULL)
+    return FALSE ;
+
+  node->data2           = latchPin ;
+
+  digitalWrite (latchPin, HIGH) ;
+  pinMode      (latchPin, OUTPUT) ;
+
+  return TRUE ;
+}
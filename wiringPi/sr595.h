@@ -26,8 +26,15 @@
 extern "C" {
 #endif
 
-extern int sr595Setup (const int pinBase, const int numPins,
+extern int  sr595Setup    (const int pinBase, const int numPins,
 	const int dataPin, const int clockPin, const int latchPin) ;
+extern int  sr595SetupSPI (const int pinBase, const int numPins,
+	const int spiChannel, const int speed, const int latchPin) ;
+
+extern void sr595Write    (const int pinBase, const unsigned char *data, const int len) ;
+extern void sr595Begin    (const int pinBase) ;
+extern void sr595Commit   (const int pinBase) ;
+extern void sr595SetDelay (const int pinBase, const int delayUs) ;
 
 #ifdef __cplusplus
 }
@@ -782,12 +782,21 @@ int getPUPD (int pin)
 /*----------------------------------------------------------------------------*/
 /*
  * Core Functions
+ *	Pins from 64 up belong to extension nodes and are handed straight
+ *	to the node that owns them.
  */
 /*----------------------------------------------------------------------------*/
 void pinMode (int pin, int mode)
 {
+	struct wiringPiNodeStruct *node;
+
 	setupCheck(__func__);
 
+	if ((node = wiringPiFindNode(pin)) != NULL) {
+		node->pinMode(node, pin, mode);
+		return;
+	}
+
 	if (libwiring.pinMode)
 		if (libwiring.pinMode(pin, mode) < 0)
 			msg(MSG_WARN, "%s: Not available for pin %d. \n", __func__, pin);
@@ -797,8 +806,15 @@ void pinMode (int pin, int mode)
 /*----------------------------------------------------------------------------*/
 void pullUpDnControl (int pin, int pud)
 {
+	struct wiringPiNodeStruct *node;
+
 	setupCheck(__func__);
 
+	if ((node = wiringPiFindNode(pin)) != NULL) {
+		node->pullUpDnControl(node, pin, pud);
+		return;
+	}
+
 	if (libwiring.pullUpDnControl)
 		if (libwiring.pullUpDnControl(pin, pud) < 0)
 			msg(MSG_WARN, "%s: Not available for pin %d. \n", __func__, pin);
@@ -807,9 +823,13 @@ void pullUpDnControl (int pin, int pud)
 /*----------------------------------------------------------------------------*/
 int digitalRead (int pin)
 {
+	struct wiringPiNodeStruct *node;
 	int ret = -1;
 	setupCheck(__func__);
 
+	if ((node = wiringPiFindNode(pin)) != NULL)
+		return	node->digitalRead(node, pin);
+
 	if (libwiring.digitalRead) {
 		if ((ret = libwiring.digitalRead(pin)) < 0) {
 			if (wiringPiDebug)
@@ -823,8 +843,15 @@ int digitalRead (int pin)
 /*----------------------------------------------------------------------------*/
 void digitalWrite (int pin, int value)
 {
+	struct wiringPiNodeStruct *node;
+
 	setupCheck(__func__);
 
+	if ((node = wiringPiFindNode(pin)) != NULL) {
+		node->digitalWrite(node, pin, value);
+		return;
+	}
+
 	if (libwiring.digitalWrite)
 		if (libwiring.digitalWrite(pin, value) < 0)
 			msg(MSG_WARN, "%s: Not available for pin %d. \n", __func__, pin);
@@ -833,8 +860,15 @@ void digitalWrite (int pin, int value)
 /*----------------------------------------------------------------------------*/
 void pwmWrite(int pin, int value)
 {
+	struct wiringPiNodeStruct *node;
+
 	setupCheck(__func__);
 
+	if ((node = wiringPiFindNode(pin)) != NULL) {
+		node->pwmWrite(node, pin, value);
+		return;
+	}
+
 	if (libwiring.pwmWrite) {
 		if (libwiring.pwmWrite(pin, value) < 0)
 			msg(MSG_WARN, "%s: Not available for pin %d. \n", __func__, pin);
@@ -846,14 +880,49 @@ void pwmWrite(int pin, int value)
 /*----------------------------------------------------------------------------*/
 int analogRead (int pin)
 {
+	struct wiringPiNodeStruct *node;
+
 	setupCheck(__func__);
 
+	if ((node = wiringPiFindNode(pin)) != NULL)
+		return	node->analogRead(node, pin);
+
 	if (libwiring.analogRead)
 		return	libwiring.analogRead(pin);
 
 	return	-1;
 }
 
+/*----------------------------------------------------------------------------*/
+/*
+ * getAdcNode:
+ *	The sysfs node an on-board ADC pin is read through, or NULL. For an
+ *	IIO converter this also names the device and channel for streaming.
+ */
+/*----------------------------------------------------------------------------*/
+const char *getAdcNode (int pin)
+{
+	setupCheck(__func__);
+
+	if (libwiring.getAdcNode)
+		return	libwiring.getAdcNode(pin);
+
+	return	NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+void analogWrite (int pin, int value)
+{
+	struct wiringPiNodeStruct *node;
+
+	setupCheck(__func__);
+
+	if ((node = wiringPiFindNode(pin)) != NULL)
+		node->analogWrite(node, pin, value);
+	else
+		warn_msg(__func__);
+}
+
 /*----------------------------------------------------------------------------*/
 void digitalWriteByte (const int value)
 {
@@ -875,6 +944,113 @@ unsigned int digitalReadByte (void)
 	return	-1;
 }
 
+/*----------------------------------------------------------------------------*/
+/*
+ * digitalRead8: digitalRead16: digitalRead32:
+ * digitalWrite8: digitalWrite16: digitalWrite32:
+ *	Read or write 8, 16 or 32 consecutive pins starting at pin in one go,
+ *	bit n of the value being pin + n. Extension nodes do this with as
+ *	few bus transfers as they can.
+ */
+/*----------------------------------------------------------------------------*/
+static unsigned int pinReadBits (int pin, int count)
+{
+	struct wiringPiNodeStruct *node ;
+	unsigned int value = 0 ;
+	int i ;
+
+	setupCheck(__func__);
+
+	if ((node = wiringPiFindNode (pin)) != NULL)
+		switch (count) {
+		case 8:		return node->digitalRead8  (node, pin) ;
+		case 16:	return node->digitalRead16 (node, pin) ;
+		default:	return node->digitalRead32 (node, pin) ;
+		}
+
+	for (i = 0 ; i < count ; ++i)
+		if (digitalRead (pin + i) == HIGH)
+			value |= 1u << i ;
+
+	return value ;
+}
+
+static void pinWriteBits (int pin, int value, int count)
+{
+	struct wiringPiNodeStruct *node ;
+	int i ;
+
+	setupCheck(__func__);
+
+	if ((node = wiringPiFindNode (pin)) != NULL) {
+		switch (count) {
+		case 8:		node->digitalWrite8  (node, pin, value) ;	break ;
+		case 16:	node->digitalWrite16 (node, pin, value) ;	break ;
+		default:	node->digitalWrite32 (node, pin, value) ;	break ;
+		}
+		return ;
+	}
+
+	for (i = 0 ; i < count ; ++i)
+		digitalWrite (pin + i, (value >> i) & 1) ;
+}
+
+unsigned int digitalRead8	(int pin)		{ return pinReadBits  (pin, 8) ; }
+unsigned int digitalRead16	(int pin)		{ return pinReadBits  (pin, 16) ; }
+unsigned int digitalRead32	(int pin)		{ return pinReadBits  (pin, 32) ; }
+void	digitalWrite8		(int pin, int value)	{ pinWriteBits (pin, value, 8) ; }
+void	digitalWrite16		(int pin, int value)	{ pinWriteBits (pin, value, 16) ; }
+void	digitalWrite32		(int pin, int value)	{ pinWriteBits (pin, value, 32) ; }
+
+/*----------------------------------------------------------------------------*/
+/*
+ * wiringPiPinResolve: wiringPiPinRead: wiringPiPinWrite:
+ *	Look a pin up once - node or on-board - so that reads and writes
+ *	through the handle skip the checks digitalRead/digitalWrite make
+ *	on every call. Errors are not reported per access either, so only
+ *	use a handle for a pin already known to work.
+ */
+/*----------------------------------------------------------------------------*/
+int wiringPiPinResolve (int pin, struct wiringPiPinStruct *handle)
+{
+	setupCheck(__func__);
+
+	handle->pin  = pin;
+	handle->node = wiringPiFindNode(pin);
+	handle->pinMode      = libwiring.pinMode;
+	handle->digitalRead  = libwiring.digitalRead;
+	handle->digitalWrite = libwiring.digitalWrite;
+
+	if ((handle->node == NULL) && ((handle->digitalRead == NULL) || (handle->digitalWrite == NULL)))
+		return	-1;
+
+	return	0;
+}
+
+void wiringPiPinMode (const struct wiringPiPinStruct *handle, int mode)
+{
+	if (handle->node != NULL)
+		handle->node->pinMode(handle->node, handle->pin, mode);
+	else if (handle->pinMode != NULL)
+		handle->pinMode(handle->pin, mode);
+}
+
+int wiringPiPinRead (const struct wiringPiPinStruct *handle)
+{
+	if (handle->node != NULL)
+		return	handle->node->digitalRead(handle->node, handle->pin);
+
+	return	handle->digitalRead(handle->pin);
+}
+
+void wiringPiPinWrite (const struct wiringPiPinStruct *handle, int value)
+{
+	if (handle->node != NULL)
+		handle->node->digitalWrite(handle->node, handle->pin, value);
+	else
+		handle->digitalWrite(handle->pin, value);
+}
+
 /*----------------------------------------------------------------------------*/
 int waitForInterrupt (int pin, int mS)
 {
@@ -1142,6 +1318,29 @@ void delayMicroseconds (unsigned int howLong)
 	}
 }
 
+/*----------------------------------------------------------------------------*/
+/*
+ * delayNanoseconds:
+ *	Busy-wait, for the sub-microsecond delays of bit-banged buses.
+ *	The cost of reading the clock (tens of nS) puts a floor under it.
+ */
+/*----------------------------------------------------------------------------*/
+void delayNanoseconds (unsigned int howLong)
+{
+	struct timespec tStart, tNow;
+	int64_t elapsed;
+
+	if (howLong == 0)
+		return ;
+
+	clock_gettime (CLOCK_MONOTONIC, &tStart);
+	do {
+		clock_gettime (CLOCK_MONOTONIC, &tNow);
+		elapsed = (int64_t)(tNow.tv_sec - tStart.tv_sec) * 1000000000 +
+			(tNow.tv_nsec - tStart.tv_nsec);
+	} while (elapsed < howLong);
+}
+
 /*----------------------------------------------------------------------------*/
 unsigned int millis (void)
 {
@@ -1193,7 +1392,6 @@ static 	void UNU piGpioLayoutOops	(const char UNU *why)	{ warn_msg(__func__); re
 
 	/* core unsupport function */
 	void pinModeAlt		(int UNU pin, int UNU mode)	{ warn_msg(__func__); return; }
-	void analogWrite	(int UNU pin, int UNU value)	{ warn_msg(__func__); return; }
 	void pwmToneWrite	(int UNU pin, int UNU freq)	{ warn_msg(__func__); return; }
 	void digitalWriteByte2	(const int UNU value)	{ warn_msg(__func__); return; }
 	unsigned int digitalReadByte2 (void)		{ warn_msg(__func__); return -1; }
@@ -1204,25 +1402,76 @@ static 	void UNU piGpioLayoutOops	(const char UNU *why)	{ warn_msg(__func__); re
 /*----------------------------------------------------------------------------*/
 struct wiringPiNodeStruct *wiringPiNodes = NULL ;
 
-struct wiringPiNodeStruct *wiringPiFindNode (int UNU pin) {	return NULL; }
+// Direct pin to node index, nodeTable [pin - NODE_PIN_BASE]. It only
+//	grows when a node is added, which is expected to happen at setup
+//	time before the pins are in use.
+
+#define	NODE_PIN_BASE	64
+
+static struct wiringPiNodeStruct **nodeTable = NULL ;
+static int nodeTableSize = 0 ;
+
+struct wiringPiNodeStruct *wiringPiFindNode (int pin)
+{
+	pin -= NODE_PIN_BASE ;
+
+	if ((pin < 0) || (pin >= nodeTableSize))
+		return NULL ;
+
+	return nodeTable [pin] ;
+}
 
 static		void pinModeDummy		(UNU struct wiringPiNodeStruct *node, UNU int pin, UNU int mode)  { return ; }
 static		void pullUpDnControlDummy	(UNU struct wiringPiNodeStruct *node, UNU int pin, UNU int pud)   { return ; }
-static	unsigned int UNU digitalRead8Dummy		(UNU struct wiringPiNodeStruct *node, UNU int UNU pin)            { return 0 ; }
-static		void UNU digitalWrite8Dummy		(UNU struct wiringPiNodeStruct *node, UNU int pin, UNU int value) { return ; }
 static		int  digitalReadDummy		(UNU struct wiringPiNodeStruct *node, UNU int UNU pin)            { return LOW ; }
 static		void digitalWriteDummy		(UNU struct wiringPiNodeStruct *node, UNU int pin, UNU int value) { return ; }
 static		void pwmWriteDummy		(UNU struct wiringPiNodeStruct *node, UNU int pin, UNU int value) { return ; }
 static		int  analogReadDummy		(UNU struct wiringPiNodeStruct *node, UNU int pin)            { return 0 ; }
 static		void analogWriteDummy		(UNU struct wiringPiNodeStruct *node, UNU int pin, UNU int value) { return ; }
 
+/*----------------------------------------------------------------------------*/
+/*
+ * Port wide access for nodes:
+ *	Bit n of the value is pin + n. Nodes that can move a whole port in
+ *	one transfer supply their own; the defaults go pin by pin, stopping
+ *	at the end of the node.
+ */
+/*----------------------------------------------------------------------------*/
+static unsigned int nodeReadBits (struct wiringPiNodeStruct *node, int pin, int count)
+{
+	unsigned int value = 0 ;
+	int i ;
+
+	for (i = 0 ; (i < count) && (pin + i <= node->pinMax) ; ++i)
+		if (node->digitalRead (node, pin + i) != LOW)
+			value |= 1u << i ;
+
+	return value ;
+}
+
+static void nodeWriteBits (struct wiringPiNodeStruct *node, int pin, int value, int count)
+{
+	int i ;
+
+	for (i = 0 ; (i < count) && (pin + i <= node->pinMax) ; ++i)
+		node->digitalWrite (node, pin + i, (value >> i) & 1) ;
+}
+
+static	unsigned int digitalRead8Generic	(struct wiringPiNodeStruct *node, int pin)            { return nodeReadBits  (node, pin, 8) ; }
+static	unsigned int digitalRead16Generic	(struct wiringPiNodeStruct *node, int pin)            { return nodeReadBits  (node, pin, 16) ; }
+static	unsigned int digitalRead32Generic	(struct wiringPiNodeStruct *node, int pin)            { return nodeReadBits  (node, pin, 32) ; }
+static		void digitalWrite8Generic	(struct wiringPiNodeStruct *node, int pin, int value) { nodeWriteBits (node, pin, value, 8) ; }
+static		void digitalWrite16Generic	(struct wiringPiNodeStruct *node, int pin, int value) { nodeWriteBits (node, pin, value, 16) ; }
+static		void digitalWrite32Generic	(struct wiringPiNodeStruct *node, int pin, int value) { nodeWriteBits (node, pin, value, 32) ; }
+
+/*----------------------------------------------------------------------------*/
 struct wiringPiNodeStruct *wiringPiNewNode (int pinBase, int numPins)
 {
 	int	pin ;
 	struct wiringPiNodeStruct *node ;
 
 	// Minimum pin base is 64
-	if (pinBase < 64)
+	if (pinBase < NODE_PIN_BASE)
 		(void)wiringPiFailure (WPI_FATAL, "wiringPiNewNode: pinBase of %d is < 64\n", pinBase) ;
 
 	// Check all pins in-case there is overlap:
@@ -1239,15 +1488,35 @@ struct wiringPiNodeStruct *wiringPiNewNode (int pinBase, int numPins)
 	node->pinMode		= pinModeDummy ;
 	node->pullUpDnControl	= pullUpDnControlDummy ;
 	node->digitalRead	= digitalReadDummy ;
-	//node->digitalRead8	= digitalRead8Dummy ;
+	node->digitalRead8	= digitalRead8Generic ;
+	node->digitalRead16	= digitalRead16Generic ;
+	node->digitalRead32	= digitalRead32Generic ;
 	node->digitalWrite	= digitalWriteDummy ;
-	//node->digitalWrite8	= digitalWrite8Dummy ;
+	node->digitalWrite8	= digitalWrite8Generic ;
+	node->digitalWrite16	= digitalWrite16Generic ;
+	node->digitalWrite32	= digitalWrite32Generic ;
 	node->pwmWrite		= pwmWriteDummy ;
 	node->analogRead	= analogReadDummy ;
 	node->analogWrite	= analogWriteDummy ;
 	node->next		= wiringPiNodes ;
 	wiringPiNodes		= node ;
 
+	if (node->pinMax - NODE_PIN_BASE >= nodeTableSize) {
+		struct wiringPiNodeStruct **table ;
+		int size = node->pinMax - NODE_PIN_BASE + 1 ;
+
+		table = (struct wiringPiNodeStruct **)realloc (nodeTable, size * sizeof (*table)) ;
+		if (table == NULL)
+			(void)wiringPiFailure (WPI_FATAL, "wiringPiNewNode: Unable to allocate memory: %s\n", strerror (errno)) ;
+
+		memset (table + nodeTableSize, 0, (size - nodeTableSize) * sizeof (*table)) ;
+		nodeTable     = table ;
+		nodeTableSize = size ;
+	}
+
+	for (pin = node->pinBase ; pin <= node->pinMax ; ++pin)
+		nodeTable [pin - NODE_PIN_BASE] = node ;
+
 	return node ;
 }
 
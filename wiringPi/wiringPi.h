@@ -164,6 +164,7 @@ struct libodroid
 	int		(*digitalWrite)		(int pin, int value);
 	int		(*pwmWrite)		(int pin, int value);
 	int		(*analogRead)		(int pin);
+	const char *	(*getAdcNode)		(int pin);
 	int		(*digitalWriteByte)	(const unsigned int value);
 	unsigned int	(*digitalReadByte)	(void);
 	void		(*pwmSetRange)		(unsigned int range);
@@ -231,10 +232,8 @@ union	reg_bitfield {
 // wiringPiNodeStruct:
 //	This describes additional device nodes in the extended wiringPi
 //	2.0 scheme of things.
-//	It's a simple linked list for now, but will hopefully migrate to
-//	a binary tree for efficiency reasons - but then again, the chances
-//	of more than 1 or 2 devices being added are fairly slim, so who
-//	knows....
+//	They are kept in a simple linked list, and wiringPiFindNode()
+//	looks a pin up in a table indexed directly by pin number.
 /*----------------------------------------------------------------------------*/
 struct wiringPiNodeStruct
 {
@@ -250,18 +249,40 @@ struct wiringPiNodeStruct
 	void		(*pinMode)		(struct wiringPiNodeStruct *node, int pin, int mode);
 	void		(*pullUpDnControl)	(struct wiringPiNodeStruct *node, int pin, int mode);
 	int		(*digitalRead)		(struct wiringPiNodeStruct *node, int pin);
-	// unsigned int	(*digitalRead8)		(struct wiringPiNodeStruct *node, int pin);
+	unsigned int	(*digitalRead8)		(struct wiringPiNodeStruct *node, int pin);
+	unsigned int	(*digitalRead16)	(struct wiringPiNodeStruct *node, int pin);
+	unsigned int	(*digitalRead32)	(struct wiringPiNodeStruct *node, int pin);
 	void		(*digitalWrite)		(struct wiringPiNodeStruct *node, int pin, int value);
-	// void		(*digitalWrite8)	(struct wiringPiNodeStruct *node, int pin, int value);
+	void		(*digitalWrite8)	(struct wiringPiNodeStruct *node, int pin, int value);
+	void		(*digitalWrite16)	(struct wiringPiNodeStruct *node, int pin, int value);
+	void		(*digitalWrite32)	(struct wiringPiNodeStruct *node, int pin, int value);
 	void		(*pwmWrite)		(struct wiringPiNodeStruct *node, int pin, int value);
 	int		(*analogRead)		(struct wiringPiNodeStruct *node, int pin);
 	void		(*analogWrite)		(struct wiringPiNodeStruct *node, int pin, int value);
 
+	struct wiringPiRegCacheStruct *regCache;	// Optional, see wiringPiRegCache.h
+
 	struct wiringPiNodeStruct *next;
 };
 
 extern struct wiringPiNodeStruct *wiringPiNodes;
 
+/*----------------------------------------------------------------------------*/
+// wiringPiPinStruct:
+//	A pin resolved once to whatever drives it, for code that toggles
+//	the same few pins at high rates (bit-banged buses, shift registers).
+//	See wiringPiPinResolve().
+/*----------------------------------------------------------------------------*/
+struct wiringPiPinStruct
+{
+	int	pin;
+	struct wiringPiNodeStruct *node;	// NULL for on-board pins
+
+	int	(*pinMode)	(int pin, int mode);
+	int	(*digitalRead)	(int pin);
+	int	(*digitalWrite)	(int pin, int value);
+};
+
 /*----------------------------------------------------------------------------*/
 // kernelVersionStruct:
 //	Contains the kernel version of the operating board's.
@@ -318,8 +339,20 @@ extern		int  digitalRead	(int pin);
 extern		void digitalWrite	(int pin, int value);
 extern unsigned int  digitalReadByte	(void);
 extern		void digitalWriteByte	(const int value);
+extern unsigned int  digitalRead8	(int pin);
+extern unsigned int  digitalRead16	(int pin);
+extern unsigned int  digitalRead32	(int pin);
+extern		void digitalWrite8	(int pin, int value);
+extern		void digitalWrite16	(int pin, int value);
+extern		void digitalWrite32	(int pin, int value);
+extern		int  wiringPiPinResolve	(int pin, struct wiringPiPinStruct *handle);
+extern		void wiringPiPinMode	(const struct wiringPiPinStruct *handle, int mode);
+extern		int  wiringPiPinRead	(const struct wiringPiPinStruct *handle);
+extern		void wiringPiPinWrite	(const struct wiringPiPinStruct *handle, int value);
 extern		void pwmWrite		(int pin, int value);
 extern		int  analogRead		(int pin);
+extern const	char *getAdcNode	(int pin);
+extern		void analogWrite	(int pin, int value);
 
 // Hardware specific stuffs
 extern		int  piGpioLayout	(void);
@@ -346,12 +379,12 @@ extern		int  piHiPri		(const int pri);
 // From Arduino land
 extern		void delay		(unsigned int howLong);
 extern		void delayMicroseconds	(unsigned int howLong);
+extern		void delayNanoseconds	(unsigned int howLong);
 extern unsigned int  millis		(void);
 extern unsigned int  micros		(void);
 
 // Unsupoorted
 extern		void pinModeAlt		(int pin, int mode) UNU;
-extern		void analogWrite	(int pin, int value) UNU;
 extern		void pwmToneWrite	(int pin, int freq) UNU;
 extern		void gpioClockSet	(int pin, int freq) UNU;
 extern unsigned int  digitalReadByte	(void) UNU;
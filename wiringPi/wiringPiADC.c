@@ -0,0 +1,983 @@
+/*
+ * wiringPiADC.c:
+ *	Streaming access to the on-board ADC. analogRead() goes through
+ *	the sysfs in_voltageN_raw node, a system call and a conversion per
+ *	sample, which tops out at a few thousand samples a second. Here the
+ *	IIO buffered interface is used instead: the channels are enabled as
+ *	scan elements, a trigger (an hrtimer one if the device has none set)
+ *	clocks the conversions and the kernel fills its ring buffer, which
+ *	is read back in batches of whole scans from /dev/iio:deviceN.
+ *
+ *	On top of that sits a sampler: a thread which keeps a ring of recent
+ *	samples for each of a set of ADC pins, streamed where the converter
+ *	allows or polled with analogRead() where it doesn't (expansion
+ *	boards such as the ads1115 or mcp3004), optionally oversampled and
+ *	averaged down, for any number of readers to look at without waiting.
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "wiringPi.h"
+#include "wiringPiADC.h"
+
+// hrtimer triggers are made through configfs (CONFIG_IIO_HRTIMER_TRIGGER)
+
+#define	ADC_HRTIMER_DIR		"/sys/kernel/config/iio/triggers/hrtimer"
+#define	ADC_TRIGGER_DIR		"/sys/bus/iio/devices"
+
+// Most scans taken from the kernel in one read()
+
+#define	ADC_READ_SCANS		256
+
+struct adcChannel
+{
+	char		name[32];	// e.g. in_voltage2
+	int		index;		// Position in the scan
+	int		offset;		// Byte offset in the scan
+	int		bytes;		// Storage size
+	int		bits;
+	int		shift;
+	int		isSigned;
+	int		bigEndian;
+};
+
+struct wiringPiADCStream
+{
+	char		dir[256];	// sysfs directory of the IIO device
+	char		trigger[32];	// hrtimer trigger made for the stream, if any
+	int		claimed;	// The device's scan elements have been changed
+	char		enabled[512];	// Scan elements it had on, to put back
+	char		rateDir[256];	// Trigger or device whose rate was changed
+	char		rate[32];	// and the sampling_frequency it had
+	int		fd;
+	int		nchans;
+	struct adcChannel chans[WPI_ADC_MAX_CHANNELS];	// In the order asked for
+	int		scanSize;
+	uint8_t		*buf;
+};
+
+
+/*
+ * adcWrite: adcWriteInt: adcRead:
+ *	Small sysfs attribute helpers, relative to a directory
+ *********************************************************************************
+ */
+
+static int adcWrite (const char *dir, const char *file, const char *value)
+{
+	char	path[320];
+	int	fd, ret;
+
+	snprintf (path, sizeof (path), "%s/%s", dir, file);
+	if ((fd = open (path, O_WRONLY)) < 0)
+		return -1;
+
+	ret = write (fd, value, strlen (value));
+	close (fd);
+
+	return (ret < 0) ? -1 : 0;
+}
+
+static int adcWriteInt (const char *dir, const char *file, int value)
+{
+	char	buf[16];
+
+	snprintf (buf, sizeof (buf), "%d", value);
+
+	return adcWrite (dir, file, buf);
+}
+
+static int adcRead (const char *dir, const char *file, char *value, int len)
+{
+	char	path[320];
+	int	fd, n;
+
+	snprintf (path, sizeof (path), "%s/%s", dir, file);
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return -1;
+
+	n = read (fd, value, len - 1);
+	close (fd);
+
+	if (n < 0)
+		return -1;
+
+	while (n > 0 && (value[n - 1] == '\n' || value[n - 1] == ' '))
+		n--;
+	value[n] = '\0';
+
+	return 0;
+}
+
+
+/*
+ * adcDisableAll:
+ *	Turn off every scan element of the device, so the scan holds only
+ *	the channels turned on after it. The ones that were on are listed
+ *	in was, if given, so they can be turned on again.
+ *********************************************************************************
+ */
+
+static void adcDisableAll (const char *dir, char *was, int wasLen)
+{
+	char		path[320], file[320], value[16];
+	DIR		*d;
+	struct dirent	*de;
+	int		len, used = 0;
+
+	snprintf (path, sizeof (path), "%s/scan_elements", dir);
+	if ((d = opendir (path)) == NULL)
+		return;
+
+	while ((de = readdir (d)) != NULL) {
+		len = strlen (de->d_name);
+		if (len > 3 && strcmp (de->d_name + len - 3, "_en") == 0) {
+			snprintf (file, sizeof (file), "scan_elements/%s", de->d_name);
+			if (was != NULL && adcRead (dir, file, value, sizeof (value)) == 0 &&
+			    atoi (value) != 0 && used + len + 2 <= wasLen)
+				used += sprintf (was + used, "%s ", de->d_name);
+			adcWrite (dir, file, "0");
+		}
+	}
+	closedir (d);
+}
+
+
+/*
+ * adcSetChannel:
+ *	Work out the IIO device and channel behind a pin from the sysfs node
+ *	its analogRead() uses, .../iio:deviceN/in_<channel>_raw, and read
+ *	the channel's place and format in the scan.
+ *********************************************************************************
+ */
+
+static int adcSetChannel (struct wiringPiADCStream *stream, struct adcChannel *ch, int pin)
+{
+	const char	*node, *base;
+	char		dir[256], file[64], value[32];
+	char		endian, sign;
+	unsigned int	bits, storage, repeat, shift;
+	int		len;
+
+	if ((node = getAdcNode (pin)) == NULL || strstr (node, "/iio:device") == NULL) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	base = strrchr (node, '/') + 1;
+	len  = strlen (base);
+	if (len <= 4 || strcmp (base + len - 4, "_raw") != 0) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	snprintf (dir, sizeof (dir), "%.*s", (int)(base - 1 - node), node);
+	snprintf (ch->name, sizeof (ch->name), "%.*s", len - 4, base);
+
+	if (stream->dir[0] == '\0')
+		strcpy (stream->dir, dir);
+	else if (strcmp (stream->dir, dir) != 0) {
+		errno = EXDEV;		// All the pins have to be on one converter
+		return -1;
+	}
+
+	snprintf (file, sizeof (file), "scan_elements/%s_index", ch->name);
+	if (adcRead (stream->dir, file, value, sizeof (value)) < 0)
+		return -1;
+	ch->index = atoi (value);
+
+// The format is [be|le]:[s|u]bits/storagebits[Xrepeat]>>shift
+
+	snprintf (file, sizeof (file), "scan_elements/%s_type", ch->name);
+	if (adcRead (stream->dir, file, value, sizeof (value)) < 0)
+		return -1;
+
+	repeat = 1;
+	if (sscanf (value, "%ce:%c%u/%uX%u>>%u", &endian, &sign, &bits, &storage, &repeat, &shift) != 6 &&
+	    sscanf (value, "%ce:%c%u/%u>>%u", &endian, &sign, &bits, &storage, &shift) != 5) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	if (repeat != 1 || (storage != 8 && storage != 16 && storage != 32 && storage != 64) ||
+	    bits == 0 || bits + shift > storage) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	ch->bytes	= storage / 8;
+	ch->bits	= bits;
+	ch->shift	= shift;
+	ch->isSigned	= (sign == 's');
+	ch->bigEndian	= (endian == 'b');
+
+	return 0;
+}
+
+
+/*
+ * adcLayout:
+ *	Lay the scan out as the kernel does: enabled channels in index order,
+ *	each aligned to its own size, the whole padded to the largest one.
+ *********************************************************************************
+ */
+
+static void adcLayout (struct wiringPiADCStream *stream)
+{
+	struct adcChannel	*ch, *next;
+	int			i, offset = 0, align = 1, last = -1;
+
+	for (;;) {
+		next = NULL;
+		for (i = 0; i < stream->nchans; i++) {
+			ch = &stream->chans[i];
+			if (ch->index > last && (next == NULL || ch->index < next->index))
+				next = ch;
+		}
+		if (next == NULL)
+			break;
+
+		offset       = (offset + next->bytes - 1) / next->bytes * next->bytes;
+		next->offset = offset;
+		offset      += next->bytes;
+		if (next->bytes > align)
+			align = next->bytes;
+		last = next->index;
+
+// The same channel asked for twice just shares the place in the scan
+
+		for (i = 0; i < stream->nchans; i++)
+			if (stream->chans[i].index == last)
+				stream->chans[i].offset = next->offset;
+	}
+
+	stream->scanSize = (offset + align - 1) / align * align;
+}
+
+
+/*
+ * adcSetRate:
+ *	Set a sampling_frequency and make sure it took: converters with only
+ *	a few rates to choose from quietly pick the nearest one, which is
+ *	undone. With a stream given, the rate it had is kept for adcFree.
+ *********************************************************************************
+ */
+
+static int adcSetRate (struct wiringPiADCStream *stream, const char *dir, int rate)
+{
+	char	value[32], old[32];
+
+	if (adcRead (dir, "sampling_frequency", old, sizeof (old)) < 0 ||
+	    adcWriteInt (dir, "sampling_frequency", rate) < 0 ||
+	    adcRead (dir, "sampling_frequency", value, sizeof (value)) < 0)
+		return -1;
+
+	if ((int)(atof (value) + 0.5) != rate) {
+		adcWrite (dir, "sampling_frequency", old);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (stream != NULL) {
+		snprintf (stream->rateDir, sizeof (stream->rateDir), "%s", dir);
+		strcpy (stream->rate, old);
+	}
+
+	return 0;
+}
+
+
+/*
+ * adcFindTrigger:
+ *	Put the sysfs directory of the trigger called name into tdir
+ *********************************************************************************
+ */
+
+static int adcFindTrigger (const char *trigger, char *tdir, int len)
+{
+	char		name[64];
+	DIR		*d;
+	struct dirent	*de;
+	int		found = FALSE;
+
+	if ((d = opendir (ADC_TRIGGER_DIR)) == NULL)
+		return -1;
+
+	while (!found && (de = readdir (d)) != NULL) {
+		if (strncmp (de->d_name, "trigger", 7) != 0)
+			continue;
+		snprintf (tdir, len, "%s/%s", ADC_TRIGGER_DIR, de->d_name);
+		found = (adcRead (tdir, "name", name, sizeof (name)) == 0 && strcmp (name, trigger) == 0);
+	}
+	closedir (d);
+
+	if (!found) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * adcSetTrigger:
+ *	Set the conversions going at rate Hz. A trigger the device already
+ *	has is kept, but set to the rate - or, for one that fires when the
+ *	device has data, the device is; if neither will take it the device
+ *	is busy at some other rate. Otherwise an hrtimer trigger is made for
+ *	it, or for a device that runs without one its own sampling_frequency
+ *	is set. The rate has to be one the trigger or device can do.
+ *********************************************************************************
+ */
+
+static int adcSetTrigger (struct wiringPiADCStream *stream, int rate)
+{
+	char		path[320], tdir[320], current[64];
+	int		devNum = 0;
+
+	snprintf (path, sizeof (path), "%s/trigger/current_trigger", stream->dir);
+	if (access (path, F_OK) != 0)
+		return adcSetRate (stream, stream->dir, rate);
+
+	if (adcRead (stream->dir, "trigger/current_trigger", current, sizeof (current)) == 0 && current[0] != '\0') {
+		if (adcFindTrigger (current, tdir, sizeof (tdir)) == 0 && adcSetRate (stream, tdir, rate) == 0)
+			return 0;
+		if (adcSetRate (stream, stream->dir, rate) == 0)
+			return 0;
+		errno = EBUSY;
+		return -1;
+	}
+
+	sscanf (strrchr (stream->dir, '/'), "/iio:device%d", &devNum);
+	snprintf (stream->trigger, sizeof (stream->trigger), "wiringpi-adc%d", devNum);
+
+	snprintf (path, sizeof (path), "%s/%s", ADC_HRTIMER_DIR, stream->trigger);
+	if (mkdir (path, 0755) < 0 && errno != EEXIST) {
+		stream->trigger[0] = '\0';
+		return -1;
+	}
+
+	if (adcFindTrigger (stream->trigger, tdir, sizeof (tdir)) < 0 || adcSetRate (NULL, tdir, rate) < 0)
+		return -1;
+
+	return adcWrite (stream->dir, "trigger/current_trigger", stream->trigger);
+}
+
+
+/*
+ * adcStart:
+ *	Claim the device's buffer, enable the channels, start the trigger
+ *	and open the character device the scans are read from.
+ *********************************************************************************
+ */
+
+static int adcStart (struct wiringPiADCStream *stream, int rate, int bufferScans)
+{
+	char	file[64], value[16];
+	int	i;
+
+	if (adcRead (stream->dir, "buffer/enable", value, sizeof (value)) < 0) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (atoi (value) != 0) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	stream->claimed = TRUE;
+	adcDisableAll (stream->dir, stream->enabled, sizeof (stream->enabled));
+
+	for (i = 0; i < stream->nchans; i++) {
+		snprintf (file, sizeof (file), "scan_elements/%s_en", stream->chans[i].name);
+		if (adcWrite (stream->dir, file, "1") < 0)
+			return -1;
+	}
+
+	if (adcSetTrigger (stream, rate) < 0)
+		return -1;
+
+	if (adcWriteInt (stream->dir, "buffer/length", bufferScans) < 0)
+		return -1;
+
+// Wake readers once a quarter of the buffer is in, where the kernel
+//	supports a watermark, rather than on every scan.
+
+	adcWriteInt (stream->dir, "buffer/watermark", (bufferScans >= 4) ? bufferScans / 4 : 1);
+
+	if (adcWrite (stream->dir, "buffer/enable", "1") < 0)
+		return -1;
+
+	snprintf (file, sizeof (file), "/dev%s", strrchr (stream->dir, '/'));
+	if ((stream->fd = open (file, O_RDONLY | O_NONBLOCK)) < 0)
+		return -1;
+
+	return 0;
+}
+
+
+/*
+ * adcFree:
+ *	Put the device back the way it was found and release the stream
+ *********************************************************************************
+ */
+
+static void adcFree (struct wiringPiADCStream *stream)
+{
+	char	path[320], *name, *save;
+
+	if (stream->fd >= 0)
+		close (stream->fd);
+
+	if (stream->claimed) {
+		adcWrite (stream->dir, "buffer/enable", "0");
+		if (stream->trigger[0] != '\0') {
+			adcWrite (stream->dir, "trigger/current_trigger", "\n");
+			snprintf (path, sizeof (path), "%s/%s", ADC_HRTIMER_DIR, stream->trigger);
+			rmdir (path);
+		}
+		if (stream->rateDir[0] != '\0')
+			adcWrite (stream->rateDir, "sampling_frequency", stream->rate);
+
+		adcDisableAll (stream->dir, NULL, 0);
+		for (name = strtok_r (stream->enabled, " ", &save); name != NULL; name = strtok_r (NULL, " ", &save)) {
+			snprintf (path, sizeof (path), "scan_elements/%s", name);
+			adcWrite (stream->dir, path, "1");
+		}
+	}
+
+	free (stream->buf);
+	free (stream);
+}
+
+
+/*
+ * adcOpen:
+ *	Set a stream up, quietly - the sampler tries this first and falls
+ *	back to polling if it fails. Returns NULL with errno set.
+ *********************************************************************************
+ */
+
+static struct wiringPiADCStream *adcOpen (const int *pins, int npins, int rate, int bufferScans)
+{
+	struct wiringPiADCStream	*stream;
+	int				i, err;
+
+	if ((stream = calloc (1, sizeof (*stream))) == NULL)
+		return NULL;
+
+	stream->fd     = -1;
+	stream->nchans = npins;
+
+	for (i = 0; i < npins; i++)
+		if (adcSetChannel (stream, &stream->chans[i], pins[i]) < 0)
+			break;
+
+	if (i == npins) {
+		adcLayout (stream);
+		if ((stream->buf = malloc (ADC_READ_SCANS * stream->scanSize)) != NULL &&
+		    adcStart (stream, rate, bufferScans) == 0)
+			return stream;
+	}
+
+	err = errno;
+	adcFree (stream);
+	errno = err;
+
+	return NULL;
+}
+
+
+/*
+ * wiringPiADCStreamOpen:
+ *	Start streaming the ADC pins given at rate scans per second. Every
+ *	scan holds one sample of each pin and the kernel keeps up to
+ *	bufferScans of them (0 for 1024) until they are read. The pins have
+ *	to be on the same converter, and it has to be an IIO one with buffer
+ *	support - the older saradc class nodes of the C1 and C2 are not. A
+ *	rate it can't be set to exactly is an error.
+ *********************************************************************************
+ */
+
+struct wiringPiADCStream *wiringPiADCStreamOpen (const int *pins, int npins, int rate, int bufferScans)
+{
+	struct wiringPiADCStream	*stream;
+
+	if (pins == NULL || npins <= 0 || npins > WPI_ADC_MAX_CHANNELS || rate <= 0 || bufferScans < 0) {
+		errno = EINVAL;
+		wiringPiFailure (WPI_ALMOST, "Invalid ADC stream\n");
+		return NULL;
+	}
+
+	if ((stream = adcOpen (pins, npins, rate, (bufferScans == 0) ? 1024 : bufferScans)) == NULL)
+		wiringPiFailure (WPI_ALMOST, "Unable to start ADC stream: %s\n", strerror (errno));
+
+	return stream;
+}
+
+
+/*
+ * adcDecode:
+ *	Pull one channel's sample out of a scan, sign extended if need be
+ *********************************************************************************
+ */
+
+static int adcDecode (const struct adcChannel *ch, const uint8_t *scan)
+{
+	const uint8_t	*p = scan + ch->offset;
+	uint64_t	raw = 0, mask;
+	int		i;
+
+	for (i = 0; i < ch->bytes; i++)
+		raw |= (uint64_t)p[ch->bigEndian ? ch->bytes - 1 - i : i] << (8 * i);
+
+	raw  >>= ch->shift;
+	mask   = (ch->bits < 64) ? ((uint64_t)1 << ch->bits) - 1 : ~(uint64_t)0;
+	raw   &= mask;
+
+	if (ch->isSigned && (raw & ((uint64_t)1 << (ch->bits - 1))))
+		raw |= ~mask;
+
+	return (int)(int64_t)raw;
+}
+
+
+/*
+ * wiringPiADCStreamRead:
+ *	Take up to maxScans scans from the stream into samples, which gets
+ *	one int per pin per scan in the order the pins were given. Waits up
+ *	to timeoutMs (-1 for ever, 0 not at all) for the first one and
+ *	returns how many were read, 0 on timeout.
+ *********************************************************************************
+ */
+
+int wiringPiADCStreamRead (struct wiringPiADCStream *stream, int *samples, int maxScans, int timeoutMs)
+{
+	struct pollfd	pfd;
+	const uint8_t	*scan;
+	int		i, c, n;
+
+	if (stream == NULL || samples == NULL || maxScans <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (maxScans > ADC_READ_SCANS)
+		maxScans = ADC_READ_SCANS;
+
+	while ((n = read (stream->fd, stream->buf, maxScans * stream->scanSize)) < 0) {
+		if (errno != EAGAIN)
+			return -1;
+		if (timeoutMs == 0)
+			return 0;
+
+		pfd.fd     = stream->fd;
+		pfd.events = POLLIN;
+		if ((n = poll (&pfd, 1, timeoutMs)) <= 0)
+			return n;
+	}
+
+	n /= stream->scanSize;
+	for (i = 0; i < n; i++) {
+		scan = stream->buf + i * stream->scanSize;
+		for (c = 0; c < stream->nchans; c++)
+			*samples++ = adcDecode (&stream->chans[c], scan);
+	}
+
+	return n;
+}
+
+
+/*
+ * wiringPiADCStreamGetFd:
+ *	The fd the scans come in on, to wait for them with poll() or epoll
+ *	alongside other work. It is non-blocking.
+ *********************************************************************************
+ */
+
+int wiringPiADCStreamGetFd (struct wiringPiADCStream *stream)
+{
+	return (stream == NULL) ? -1 : stream->fd;
+}
+
+
+/*
+ * wiringPiADCStreamClose:
+ *	Stop the conversions and hand the converter back for analogRead()
+ *********************************************************************************
+ */
+
+void wiringPiADCStreamClose (struct wiringPiADCStream *stream)
+{
+	if (stream != NULL)
+		adcFree (stream);
+}
+
+
+/*
+ * The sampler:
+ *	Raw samples are taken at rate * oversample per second and every
+ *	oversample of them are averaged into one entry of the channel's ring.
+ *	All the rings move together, head counting the entries ever written.
+ *********************************************************************************
+ */
+
+struct wiringPiSampler
+{
+	int		npins;
+	int		pins[WPI_ADC_MAX_CHANNELS];
+	int		rate;
+	int		oversample;
+	int		depth;
+	int		*ring;		// depth entries of npins samples
+	unsigned int	head;
+	int64_t		acc[WPI_ADC_MAX_CHANNELS];
+	int		accCount;
+	struct wiringPiADCStream *stream;	// NULL when polling
+	volatile int	stopping;
+	volatile int	error;		// What stopped the thread, if anything did
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+};
+
+
+/*
+ * samplerPut:
+ *	Add a raw scan, closing an entry every oversample of them
+ *********************************************************************************
+ */
+
+static void samplerPut (struct wiringPiSampler *sampler, const int *scan)
+{
+	int	c, *entry;
+
+	for (c = 0; c < sampler->npins; c++)
+		sampler->acc[c] += scan[c];
+
+	if (++sampler->accCount < sampler->oversample)
+		return;
+
+	pthread_mutex_lock (&sampler->lock);
+	entry = sampler->ring + (sampler->head % sampler->depth) * sampler->npins;
+	for (c = 0; c < sampler->npins; c++) {
+		entry[c]         = sampler->acc[c] / sampler->oversample;
+		sampler->acc[c]  = 0;
+	}
+	sampler->head++;
+	pthread_mutex_unlock (&sampler->lock);
+
+	sampler->accCount = 0;
+}
+
+
+/*
+ * samplerThread:
+ *	Feed the rings from the stream, or by polling analogRead() on an
+ *	absolute timer. A poll that falls more than a period behind skips
+ *	ahead rather than trying to catch up in a burst. A stream that
+ *	fails stops the thread, and the reason is kept for the readers.
+ *********************************************************************************
+ */
+
+static void *samplerThread (void *arg)
+{
+	struct wiringPiSampler	*sampler = (struct wiringPiSampler *)arg;
+	struct timespec		next, now;
+	int			scan[WPI_ADC_MAX_CHANNELS], *buf;
+	int64_t			period, late;
+	int			c, i, n;
+
+	if (sampler->stream != NULL) {
+		if ((buf = malloc (ADC_READ_SCANS * sampler->npins * sizeof (int))) == NULL) {
+			sampler->error = ENOMEM;
+			return NULL;
+		}
+
+		while (!sampler->stopping) {
+			if ((n = wiringPiADCStreamRead (sampler->stream, buf, ADC_READ_SCANS, 100)) < 0) {
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				sampler->error = errno;
+				break;
+			}
+			for (i = 0; i < n; i++)
+				samplerPut (sampler, buf + i * sampler->npins);
+		}
+
+		free (buf);
+		return NULL;
+	}
+
+	period = 1000000000LL / ((int64_t)sampler->rate * sampler->oversample);
+	clock_gettime (CLOCK_MONOTONIC, &next);
+
+	while (!sampler->stopping) {
+		for (c = 0; c < sampler->npins; c++)
+			scan[c] = analogRead (sampler->pins[c]);
+		samplerPut (sampler, scan);
+
+		next.tv_nsec += period;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		late = (int64_t)(now.tv_sec - next.tv_sec) * 1000000000 + (now.tv_nsec - next.tv_nsec);
+		if (late > period)
+			next = now;
+		else
+			clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * samplerCanPoll:
+ *	Whether analogRead() of all the pins is quick enough to be polled
+ *	rate * oversample times a second. The better of two goes is taken,
+ *	as the first may have files to open.
+ *********************************************************************************
+ */
+
+static int samplerCanPoll (struct wiringPiSampler *sampler)
+{
+	struct timespec	start, end;
+	int64_t		took, best = INT64_MAX;
+	int		c, i;
+
+	for (i = 0; i < 2; i++) {
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (c = 0; c < sampler->npins; c++)
+			(void)analogRead (sampler->pins[c]);
+		clock_gettime (CLOCK_MONOTONIC, &end);
+
+		took = (int64_t)(end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+		if (took < best)
+			best = took;
+	}
+
+	return best * sampler->rate * sampler->oversample < 1000000000;
+}
+
+
+/*
+ * wiringPiSamplerStart:
+ *	Sample the ADC pins given (on-board or on an expansion node) rate
+ *	times a second each, averaging oversample raw readings into every
+ *	sample (1 for none), and keep the last depth samples of each. The
+ *	converter streams at that rate where it can, else it is polled; a
+ *	rate too fast to poll is an error.
+ *********************************************************************************
+ */
+
+struct wiringPiSampler *wiringPiSamplerStart (const int *pins, int npins, int rate, int oversample, int depth)
+{
+	struct wiringPiSampler	*sampler;
+
+	if (pins == NULL || npins <= 0 || npins > WPI_ADC_MAX_CHANNELS || rate <= 0 ||
+	    oversample <= 0 || depth <= 0 || (int64_t)rate * oversample > 1000000000) {
+		errno = EINVAL;
+		wiringPiFailure (WPI_ALMOST, "Invalid ADC sampler\n");
+		return NULL;
+	}
+
+	if ((sampler = calloc (1, sizeof (*sampler))) == NULL ||
+	    (sampler->ring = calloc ((size_t)depth * npins, sizeof (int))) == NULL) {
+		free (sampler);
+		wiringPiFailure (WPI_ALMOST, "Unable to allocate ADC sampler: %s\n", strerror (errno));
+		return NULL;
+	}
+
+	memcpy (sampler->pins, pins, npins * sizeof (int));
+	sampler->npins		= npins;
+	sampler->rate		= rate;
+	sampler->oversample	= oversample;
+	sampler->depth		= depth;
+	sampler->stream		= adcOpen (pins, npins, rate * oversample, 1024);
+
+	if (sampler->stream == NULL && !samplerCanPoll (sampler)) {
+		free (sampler->ring);
+		free (sampler);
+		errno = EINVAL;
+		wiringPiFailure (WPI_ALMOST, "ADC sampler can't poll at %d Hz\n", rate * oversample);
+		return NULL;
+	}
+
+	pthread_mutex_init (&sampler->lock, NULL);
+
+	if ((errno = pthread_create (&sampler->thread, NULL, samplerThread, sampler)) != 0) {
+		wiringPiADCStreamClose (sampler->stream);
+		pthread_mutex_destroy (&sampler->lock);
+		free (sampler->ring);
+		free (sampler);
+		wiringPiFailure (WPI_ALMOST, "Unable to start ADC sampler: %s\n", strerror (errno));
+		return NULL;
+	}
+
+	return sampler;
+}
+
+
+/*
+ * samplerChannel:
+ *	Position of a pin in the sampler's scan, or -1
+ *********************************************************************************
+ */
+
+static int samplerChannel (struct wiringPiSampler *sampler, int pin)
+{
+	int	c;
+
+	if (sampler == NULL)
+		return -1;
+
+	for (c = 0; c < sampler->npins; c++)
+		if (sampler->pins[c] == pin)
+			return c;
+
+	return -1;
+}
+
+
+/*
+ * wiringPiSamplerRead:
+ *	Copy out up to count of the most recent samples of a pin, oldest
+ *	first, and return how many there were. Fails with the error that
+ *	stopped the sampler, if it has stopped.
+ *********************************************************************************
+ */
+
+int wiringPiSamplerRead (struct wiringPiSampler *sampler, int pin, int *samples, int count)
+{
+	unsigned int	first;
+	int		c, i, n;
+
+	if ((c = samplerChannel (sampler, pin)) < 0 || samples == NULL || count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (sampler->error != 0) {
+		errno = sampler->error;
+		return -1;
+	}
+
+	pthread_mutex_lock (&sampler->lock);
+
+	n = (sampler->head < (unsigned int)sampler->depth) ? (int)sampler->head : sampler->depth;
+	if (n > count)
+		n = count;
+
+	first = sampler->head - n;
+	for (i = 0; i < n; i++)
+		samples[i] = sampler->ring[((first + i) % sampler->depth) * sampler->npins + c];
+
+	pthread_mutex_unlock (&sampler->lock);
+
+	return n;
+}
+
+
+/*
+ * wiringPiSamplerStats:
+ *	Minimum, maximum and mean of the last window samples of a pin (all
+ *	of those kept for a window of 0). Returns the number of samples
+ *	they cover, 0 if there are none yet, or fails as wiringPiSamplerRead.
+ *********************************************************************************
+ */
+
+int wiringPiSamplerStats (struct wiringPiSampler *sampler, int pin, int window, struct wiringPiSamplerStats *stats)
+{
+	unsigned int	first;
+	int64_t		sum = 0;
+	int		c, i, n, value;
+
+	if ((c = samplerChannel (sampler, pin)) < 0 || stats == NULL || window < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (sampler->error != 0) {
+		errno = sampler->error;
+		return -1;
+	}
+
+	pthread_mutex_lock (&sampler->lock);
+
+	n = (sampler->head < (unsigned int)sampler->depth) ? (int)sampler->head : sampler->depth;
+	if (window > 0 && n > window)
+		n = window;
+
+	first = sampler->head - n;
+	for (i = 0; i < n; i++) {
+		value = sampler->ring[((first + i) % sampler->depth) * sampler->npins + c];
+		if (i == 0 || value < stats->min)
+			stats->min = value;
+		if (i == 0 || value > stats->max)
+			stats->max = value;
+		sum += value;
+	}
+
+	pthread_mutex_unlock (&sampler->lock);
+
+	stats->count = n;
+	stats->mean  = (n > 0) ? (double)sum / n : 0.0;
+	if (n == 0)
+		stats->min = stats->max = 0;
+
+	return n;
+}
+
+
+/*
+ * wiringPiSamplerStop:
+ *	Stop the thread and free the sampler
+ *********************************************************************************
+ */
+
+void wiringPiSamplerStop (struct wiringPiSampler *sampler)
+{
+	if (sampler == NULL)
+		return;
+
+	sampler->stopping = TRUE;
+	pthread_join (sampler->thread, NULL);
+
+	wiringPiADCStreamClose (sampler->stream);
+	pthread_mutex_destroy (&sampler->lock);
+	free (sampler->ring);
+	free (sampler);
+}
@@ -0,0 +1,57 @@
+/*
+ * wiringPiADC.h:
+ *	Streaming access to the on-board ADC through the IIO buffer, and
+ *	a background sampler for any ADC pins
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most channels one stream can scan together
+
+#define	WPI_ADC_MAX_CHANNELS	8
+
+struct wiringPiADCStream ;
+struct wiringPiSampler ;
+
+struct wiringPiSamplerStats
+{
+	int	count;
+	int	min, max;
+	double	mean;
+};
+
+extern struct wiringPiADCStream *wiringPiADCStreamOpen (const int *pins, int npins, int rate, int bufferScans);
+extern int  wiringPiADCStreamRead  (struct wiringPiADCStream *stream, int *samples, int maxScans, int timeoutMs);
+extern int  wiringPiADCStreamGetFd (struct wiringPiADCStream *stream);
+extern void wiringPiADCStreamClose (struct wiringPiADCStream *stream);
+
+// Background sampler
+
+extern struct wiringPiSampler *wiringPiSamplerStart (const int *pins, int npins, int rate, int oversample, int depth);
+extern int  wiringPiSamplerRead  (struct wiringPiSampler *sampler, int pin, int *samples, int count);
+extern int  wiringPiSamplerStats (struct wiringPiSampler *sampler, int pin, int window, struct wiringPiSamplerStats *stats);
+extern void wiringPiSamplerStop  (struct wiringPiSampler *sampler);
+
+#ifdef __cplusplus
+}
+#endif
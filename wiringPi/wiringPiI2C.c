@@ -50,6 +50,9 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <asm/ioctl.h>
 #include <linux/i2c.h>
@@ -57,8 +60,109 @@
 
 #include "wiringPi.h"
 #include "wiringPiI2C.h"
+#include "softI2c.h"
 
-uint8_t fdToSlaveAddress[1024] = { 0xFF };
+// Each bus is opened once and shared by all the device handles on it.
+//	A handle is an index into i2cDevs and carries the device address,
+//	which goes into every I2C_RDWR message so no I2C_SLAVE switching is
+//	needed. Devices set up through the older fd based calls get their
+//	own fd as before and are remembered on the i2cLegacy list so the
+//	block functions know which address to use.
+//
+// Handles can also be put under the bus scheduler: a worker thread per
+//	bus which takes requests from any number of threads in arrival order,
+//	holds back devices that have a minimum interval between transactions,
+//	and sends whatever is ready in one I2C_RDWR of up to WPI_I2C_MAX_MSGS
+//	segments.
+//
+// A bus may also be bit-banged on any two pins (softI2c). It has no fd,
+//	but takes the same i2c_msg lists and is shared the same way, under
+//	a made up device name.
+
+struct i2cRequest
+{
+	struct i2cDev		*dev;
+	int			handle;
+	struct i2c_msg		*msgs;
+	int			nmsgs;
+	int			result;
+	int			done;
+	void			(*callback) (int handle, int result, void *userData);
+	void			*userData;
+	struct i2cRequest	*next;
+};
+
+struct i2cSched
+{
+	struct i2cBus		*bus;
+	int			stopping;
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		work;
+	pthread_cond_t		done;
+	struct i2cRequest	*head, *tail;
+};
+
+struct i2cBus
+{
+	char		*device;
+	int		fd;
+	struct softI2cStruct *soft;
+	int		refs;
+	struct i2cSched	*sched;
+	struct i2cBus	*next;
+};
+
+struct i2cDev
+{
+	struct i2cBus	*bus;
+	int		addr;
+
+	// Scheduler state, protected by the bus scheduler lock
+	int		scheduled;
+	int		pending;
+	unsigned int	interval;	// uS between transactions
+	uint64_t	nextSlot;	// Earliest time for the next one
+};
+
+struct i2cLegacy
+{
+	int		fd;
+	int		addr;
+	struct i2cLegacy *next;
+};
+
+static struct i2cBus	*i2cBuses   = NULL;
+static struct i2cDev	**i2cDevs   = NULL;
+static int		i2cNumDevs  = 0;
+static struct i2cLegacy	*i2cLegacy  = NULL;
+
+static pthread_mutex_t	i2cMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * i2cFdToAddress:
+ *	Return the device address a legacy fd was set up for
+ *********************************************************************************
+ */
+
+static int i2cFdToAddress (int fd)
+{
+	struct i2cLegacy *leg;
+	int addr = -1;
+
+	pthread_mutex_lock (&i2cMutex);
+	for (leg = i2cLegacy; leg != NULL; leg = leg->next)
+		if (leg->fd == fd) {
+			addr = leg->addr;
+			break;
+		}
+	pthread_mutex_unlock (&i2cMutex);
+
+	if (addr < 0)
+		errno = EBADF;
+
+	return addr;
+}
 
 static inline int i2c_smbus_access (int fd, char rw, uint8_t command, int size, union i2c_smbus_data *data)
 {
@@ -120,19 +224,19 @@ int wiringPiI2CReadReg16 (int fd, int reg)
  *	Read values from consecutive regisiters on the device
  *********************************************************************************
  */
-int wiringPiI2CReadBlock (int fd, int reg, uint8_t *buff, int size)
+static int i2cReadBlock (int fd, int addr, int reg, uint8_t *buff, int size)
 {
 	struct i2c_rdwr_ioctl_data	i2c;
 	struct i2c_msg 			msgs[2];
 
 	uint8_t reg_addr[1] = { reg };
 
-	msgs[0].addr	= fdToSlaveAddress[fd];
+	msgs[0].addr	= addr;
 	msgs[0].flags	= 0;
 	msgs[0].len	= 1;
 	msgs[0].buf	= reg_addr;
 
-	msgs[1].addr	= fdToSlaveAddress[fd];
+	msgs[1].addr	= addr;
 	msgs[1].flags	= I2C_M_RD;
 	msgs[1].len	= size;
 	msgs[1].buf	= buff;
@@ -143,6 +247,16 @@ int wiringPiI2CReadBlock (int fd, int reg, uint8_t *buff, int size)
 	return ioctl( fd, I2C_RDWR, &i2c );
 }
 
+int wiringPiI2CReadBlock (int fd, int reg, uint8_t *buff, int size)
+{
+	int addr;
+
+	if ((addr = i2cFdToAddress (fd)) < 0)
+		return -1;
+
+	return i2cReadBlock (fd, addr, reg, buff, size);
+}
+
 
 /*
  * wiringPiI2CWrite:
@@ -180,20 +294,32 @@ int wiringPiI2CWriteReg16 (int fd, int reg, int value)
 
 
 /*
- * wiringPiI2CReadBlock:
- *	Write values from consecutive regisiters on the device
+ * wiringPiI2CWriteBlock:
+ *	Write values to consecutive regisiters on the device
+ *	The register number has to go out in the same message as the data,
+ *	so small blocks are assembled on the stack and larger ones on the heap.
  *********************************************************************************
  */
-int wiringPiI2CWriteBlock (int fd, int reg, uint8_t *buff, int size)
+static int i2cWriteBlock (int fd, int addr, int reg, const uint8_t *buff, int size)
 {
-	uint8_t temp[50];
-	temp[0] = reg;
-	memcpy(&temp[1], buff, size);
-
 	struct i2c_rdwr_ioctl_data	i2c;
 	struct i2c_msg			msgs;
+	uint8_t				stackBuf[64];
+	uint8_t				*temp = stackBuf;
+	int				ret;
+
+	if (size < 0 || size > 0xFFFE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (size + 1 > (int)sizeof(stackBuf) && (temp = malloc(size + 1)) == NULL)
+		return -1;
 
-	msgs.addr	= fdToSlaveAddress[fd];
+	temp[0] = reg;
+	memcpy(&temp[1], buff, size);
+
+	msgs.addr	= addr;
 	msgs.flags	= 0;
 	msgs.len	= size + 1;
 	msgs.buf	= temp;
@@ -201,10 +327,837 @@ int wiringPiI2CWriteBlock (int fd, int reg, uint8_t *buff, int size)
 	i2c.msgs	= &msgs;
 	i2c.nmsgs	= 1;
 
+	ret = ioctl( fd, I2C_RDWR, &i2c );
+
+	if (temp != stackBuf)
+		free(temp);
+
+	return ret;
+}
+
+int wiringPiI2CWriteBlock (int fd, int reg, uint8_t *buff, int size)
+{
+	int addr;
+
+	if ((addr = i2cFdToAddress (fd)) < 0)
+		return -1;
+
+	return i2cWriteBlock (fd, addr, reg, buff, size);
+}
+
+
+/*
+ * wiringPiI2CXferInit:
+ *	Start a new combined transaction.
+ *	A transaction is a list of read and write segments, possibly to
+ *	different devices, which go out with repeated starts between them and
+ *	a single stop at the end - all in one I2C_RDWR ioctl. The caller's
+ *	buffers are used directly and have to stay valid until it is submitted.
+ *********************************************************************************
+ */
+void wiringPiI2CXferInit (struct wiringPiI2CXferStruct *xfer)
+{
+	xfer->nmsgs = 0;
+}
+
+
+static int i2cXferAdd (struct wiringPiI2CXferStruct *xfer, int devId, int flags, uint8_t *buff, int size)
+{
+	struct i2c_msg *msg;
+
+	if (xfer->nmsgs >= WPI_I2C_MAX_MSGS || size < 0 || size > 0xFFFF || (size > 0 && buff == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	msg		= &xfer->msgs[xfer->nmsgs++];
+	msg->addr	= devId;
+	msg->flags	= flags;
+	msg->len	= size;
+	msg->buf	= buff;
+
+	return 0;
+}
+
+
+/*
+ * wiringPiI2CXferWrite: wiringPiI2CXferRead:
+ *	Add a segment writing or reading size bytes to/from a device.
+ *	For a register write the register number is simply the first byte
+ *	of the buffer.
+ *********************************************************************************
+ */
+int wiringPiI2CXferWrite (struct wiringPiI2CXferStruct *xfer, int devId, const uint8_t *buff, int size)
+{
+	return i2cXferAdd (xfer, devId, 0, (uint8_t *)buff, size);
+}
+
+int wiringPiI2CXferRead (struct wiringPiI2CXferStruct *xfer, int devId, uint8_t *buff, int size)
+{
+	return i2cXferAdd (xfer, devId, I2C_M_RD, buff, size);
+}
+
+
+/*
+ * wiringPiI2CXferReadReg:
+ *	Add a register address write followed by a repeated-start read of
+ *	size bytes from consecutive regisiters on the device. Nothing is
+ *	added unless both segments can be.
+ *********************************************************************************
+ */
+int wiringPiI2CXferReadReg (struct wiringPiI2CXferStruct *xfer, int devId, int reg, uint8_t *buff, int size)
+{
+	if (xfer->nmsgs + 2 > WPI_I2C_MAX_MSGS || size <= 0 || size > 0xFFFF || buff == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	xfer->regs[xfer->nmsgs] = reg;
+	i2cXferAdd (xfer, devId, 0, &xfer->regs[xfer->nmsgs], 1);
+
+	return i2cXferAdd (xfer, devId, I2C_M_RD, buff, size);
+}
+
+
+/*
+ * wiringPiI2CXferSubmit:
+ *	Run all the segments of a transaction in one go. The fd can be any
+ *	open handle on the bus, the device addresses come from the segments.
+ *********************************************************************************
+ */
+int wiringPiI2CXferSubmit (int fd, struct wiringPiI2CXferStruct *xfer)
+{
+	return wiringPiI2CTransfer (fd, xfer->msgs, xfer->nmsgs);
+}
+
+
+/*
+ * wiringPiI2CTransfer:
+ *	Pass a list of raw i2c_msg segments to the bus in one I2C_RDWR ioctl
+ *********************************************************************************
+ */
+int wiringPiI2CTransfer (int fd, struct i2c_msg *msgs, int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data	i2c;
+
+	if (nmsgs <= 0 || nmsgs > WPI_I2C_MAX_MSGS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	i2c.msgs	= msgs;
+	i2c.nmsgs	= nmsgs;
+
 	return ioctl( fd, I2C_RDWR, &i2c );
 }
 
 
+/*
+ * i2cBusTransfer:
+ *	Send a list of segments down a bus, through i2c-dev or bit-banged
+ *********************************************************************************
+ */
+static int i2cBusTransfer (struct i2cBus *bus, struct i2c_msg *msgs, int nmsgs)
+{
+	if (bus->soft != NULL)
+		return softI2cTransfer (bus->soft, msgs, nmsgs);
+
+	return wiringPiI2CTransfer (bus->fd, msgs, nmsgs);
+}
+
+
+/*
+ * i2cGetDev:
+ *	Look up the bus fd and device address behind a handle
+ *********************************************************************************
+ */
+
+static int i2cGetDev (int handle, int *fd, int *addr)
+{
+	int ret = -1;
+
+	pthread_mutex_lock (&i2cMutex);
+	if (handle >= 0 && handle < i2cNumDevs && i2cDevs[handle] != NULL) {
+		*fd   = i2cDevs[handle]->bus->fd;
+		*addr = i2cDevs[handle]->addr;
+		ret   = 0;
+	}
+	pthread_mutex_unlock (&i2cMutex);
+
+	if (ret < 0)
+		errno = EBADF;
+
+	return ret;
+}
+
+
+/*
+ * i2cNow:
+ *	Monotonic time in uS for the scheduler
+ *********************************************************************************
+ */
+
+static uint64_t i2cNow (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * i2cSchedThread:
+ *	Bus scheduler worker. Walks the queue in arrival order picking every
+ *	request whose device is not being held back by its rate limit, until
+ *	the segment limit of one I2C_RDWR is reached, and sends them together.
+ *	A device's requests always go out in the order they were queued.
+ *********************************************************************************
+ */
+
+static void *i2cSchedThread (void *arg)
+{
+	struct i2cSched		*sched = (struct i2cSched *)arg;
+	struct i2cRequest	*batch, **batchTail, *req, **prev, *next;
+	struct i2c_msg		msgs[WPI_I2C_MAX_MSGS];
+	struct timespec		ts;
+	uint64_t		now, wake;
+	int			n, result;
+
+	for (;;) {
+		pthread_mutex_lock (&sched->lock);
+
+		for (;;) {
+			batch     = NULL;
+			batchTail = &batch;
+			n         = 0;
+			now       = i2cNow ();
+			wake      = 0;
+
+			for (prev = &sched->head; (req = *prev) != NULL; ) {
+				if (req->dev->nextSlot > now) {
+					if (wake == 0 || req->dev->nextSlot < wake)
+						wake = req->dev->nextSlot;
+					prev = &req->next;
+					continue;
+				}
+				if (n + req->nmsgs > WPI_I2C_MAX_MSGS)
+					break;
+
+				*prev = req->next;
+				req->next  = NULL;
+				*batchTail = req;
+				batchTail  = &req->next;
+
+				memcpy (&msgs[n], req->msgs, req->nmsgs * sizeof (msgs[0]));
+				n += req->nmsgs;
+				req->dev->nextSlot = now + req->dev->interval;
+			}
+
+			sched->tail = NULL;
+			for (req = sched->head; req != NULL; req = req->next)
+				sched->tail = req;
+
+			if (batch != NULL || (sched->stopping && sched->head == NULL))
+				break;
+
+			if (wake == 0)
+				pthread_cond_wait (&sched->work, &sched->lock);
+			else {
+				ts.tv_sec  = wake / 1000000;
+				ts.tv_nsec = (wake % 1000000) * 1000;
+				pthread_cond_timedwait (&sched->work, &sched->lock, &ts);
+			}
+		}
+
+		pthread_mutex_unlock (&sched->lock);
+
+		if (batch == NULL)
+			break;
+
+// If the combined transfer fails there is no telling how far it got, so
+//	every request in it is failed rather than risking repeating writes.
+
+		result = i2cBusTransfer (sched->bus, msgs, n) < 0 ? -errno : 0;
+
+		pthread_mutex_lock (&sched->lock);
+		for (req = batch; req != NULL; req = next) {
+			next = req->next;
+			req->dev->pending--;
+			if (req->callback != NULL) {
+				pthread_mutex_unlock (&sched->lock);
+				req->callback (req->handle, result, req->userData);
+				pthread_mutex_lock (&sched->lock);
+				free (req);
+			} else {
+				req->result = result;
+				req->done   = TRUE;
+			}
+		}
+		pthread_cond_broadcast (&sched->done);
+		pthread_mutex_unlock (&sched->lock);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * i2cSchedStart: i2cSchedStop:
+ *	Create and tear down the scheduler of a bus
+ *********************************************************************************
+ */
+
+static struct i2cSched *i2cSchedStart (struct i2cBus *bus)
+{
+	struct i2cSched		*sched;
+	pthread_condattr_t	attr;
+
+	if ((sched = calloc (1, sizeof (*sched))) == NULL)
+		return NULL;
+
+	sched->bus = bus;
+	pthread_mutex_init (&sched->lock, NULL);
+	pthread_condattr_init (&attr);
+	pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+	pthread_cond_init (&sched->work, &attr);
+	pthread_condattr_destroy (&attr);
+	pthread_cond_init (&sched->done, NULL);
+
+	if ((errno = pthread_create (&sched->thread, NULL, i2cSchedThread, sched)) != 0) {
+		pthread_cond_destroy (&sched->done);
+		pthread_cond_destroy (&sched->work);
+		pthread_mutex_destroy (&sched->lock);
+		free (sched);
+		return NULL;
+	}
+
+	return sched;
+}
+
+static void i2cSchedStop (struct i2cSched *sched)
+{
+	if (sched == NULL)
+		return;
+
+	pthread_mutex_lock (&sched->lock);
+	sched->stopping = TRUE;
+	pthread_cond_signal (&sched->work);
+	pthread_mutex_unlock (&sched->lock);
+
+	pthread_join (sched->thread, NULL);
+
+	pthread_cond_destroy (&sched->done);
+	pthread_cond_destroy (&sched->work);
+	pthread_mutex_destroy (&sched->lock);
+	free (sched);
+}
+
+
+/*
+ * i2cRun:
+ *	Send a list of segments to the device behind a handle, directly or
+ *	through the bus scheduler. With a callback the request is queued and
+ *	this returns at once, the msgs then have to stay valid until it runs;
+ *	that needs a scheduled handle, there being nothing to queue it on
+ *	otherwise.
+ *********************************************************************************
+ */
+
+static int i2cRun (int handle, struct i2c_msg *msgs, int nmsgs,
+	void (*callback)(int handle, int result, void *userData), void *userData)
+{
+	struct i2cRequest	local, *req = &local;
+	struct i2cSched		*sched;
+	struct i2cDev		*dev;
+	struct i2cBus		*bus;
+	int			i, result;
+
+	if (nmsgs <= 0 || nmsgs > WPI_I2C_MAX_MSGS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock (&i2cMutex);
+	if (handle < 0 || handle >= i2cNumDevs || (dev = i2cDevs[handle]) == NULL) {
+		pthread_mutex_unlock (&i2cMutex);
+		errno = EBADF;
+		return -1;
+	}
+	bus   = dev->bus;
+	sched = dev->scheduled ? dev->bus->sched : NULL;
+	for (i = 0; i < nmsgs; i++)
+		msgs[i].addr = dev->addr;
+	pthread_mutex_unlock (&i2cMutex);
+
+	if (sched == NULL && callback != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (sched == NULL)
+		return i2cBusTransfer (bus, msgs, nmsgs) < 0 ? -1 : 0;
+
+	if (callback != NULL && (req = malloc (sizeof (*req))) == NULL)
+		return -1;
+
+	req->dev	= dev;
+	req->handle	= handle;
+	req->msgs	= msgs;
+	req->nmsgs	= nmsgs;
+	req->result	= 0;
+	req->done	= FALSE;
+	req->callback	= callback;
+	req->userData	= userData;
+	req->next	= NULL;
+
+	pthread_mutex_lock (&sched->lock);
+	if (sched->tail == NULL)
+		sched->head = req;
+	else
+		sched->tail->next = req;
+	sched->tail = req;
+	dev->pending++;
+	pthread_cond_signal (&sched->work);
+
+	if (callback != NULL) {
+		pthread_mutex_unlock (&sched->lock);
+		return 0;
+	}
+
+	while (!req->done)
+		pthread_cond_wait (&sched->done, &sched->lock);
+	result = req->result;
+	pthread_mutex_unlock (&sched->lock);
+
+	if (result < 0) {
+		errno = -result;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * i2cMsg:
+ *	Run a one or two segment (write then repeated-start read) transfer
+ *	to the device behind a handle.
+ *********************************************************************************
+ */
+
+static int i2cMsg (int handle, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen)
+{
+	struct i2c_msg	msgs[2];
+	int		n = 0;
+
+	if (wlen > 0) {
+		msgs[n].flags	= 0;
+		msgs[n].len	= wlen;
+		msgs[n].buf	= wbuf;
+		n++;
+	}
+	if (rlen > 0) {
+		msgs[n].flags	= I2C_M_RD;
+		msgs[n].len	= rlen;
+		msgs[n].buf	= rbuf;
+		n++;
+	}
+
+	return i2cRun (handle, msgs, n, NULL, NULL);
+}
+
+
+/*
+ * wiringPiI2CHandleRead: wiringPiI2CHandleReadReg8: wiringPiI2CHandleReadReg16:
+ * wiringPiI2CHandleReadBlock:
+ *	As the fd based versions, but addressed through a handle.
+ *	16-bit registers are little-endian as with SMBus word access.
+ *********************************************************************************
+ */
+
+int wiringPiI2CHandleRead (int handle)
+{
+	uint8_t data;
+
+	if (i2cMsg (handle, NULL, 0, &data, 1) < 0)
+		return -1;
+
+	return data;
+}
+
+int wiringPiI2CHandleReadReg8 (int handle, int reg)
+{
+	uint8_t r = reg, data;
+
+	if (i2cMsg (handle, &r, 1, &data, 1) < 0)
+		return -1;
+
+	return data;
+}
+
+int wiringPiI2CHandleReadReg16 (int handle, int reg)
+{
+	uint8_t r = reg, data[2];
+
+	if (i2cMsg (handle, &r, 1, data, 2) < 0)
+		return -1;
+
+	return data[0] | (data[1] << 8);
+}
+
+int wiringPiI2CHandleReadBlock (int handle, int reg, uint8_t *buff, int size)
+{
+	uint8_t r = reg;
+
+	return i2cMsg (handle, &r, 1, buff, size);
+}
+
+
+/*
+ * wiringPiI2CHandleWrite: wiringPiI2CHandleWriteReg8: wiringPiI2CHandleWriteReg16:
+ * wiringPiI2CHandleWriteBlock:
+ *	As the fd based versions, but addressed through a handle.
+ *********************************************************************************
+ */
+
+int wiringPiI2CHandleWrite (int handle, int data)
+{
+	uint8_t d = data;
+
+	return i2cMsg (handle, &d, 1, NULL, 0);
+}
+
+int wiringPiI2CHandleWriteReg8 (int handle, int reg, int value)
+{
+	uint8_t d[2] = { reg, value };
+
+	return i2cMsg (handle, d, 2, NULL, 0);
+}
+
+int wiringPiI2CHandleWriteReg16 (int handle, int reg, int value)
+{
+	uint8_t d[3] = { reg, value & 0xFF, (value >> 8) & 0xFF };
+
+	return i2cMsg (handle, d, 3, NULL, 0);
+}
+
+int wiringPiI2CHandleWriteBlock (int handle, int reg, const uint8_t *buff, int size)
+{
+	uint8_t	stackBuf[64];
+	uint8_t	*temp = stackBuf;
+	int	ret;
+
+	if (size < 0 || size > 0xFFFE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (size + 1 > (int)sizeof(stackBuf) && (temp = malloc(size + 1)) == NULL)
+		return -1;
+
+	temp[0] = reg;
+	memcpy(&temp[1], buff, size);
+
+	ret = i2cMsg (handle, temp, size + 1, NULL, 0);
+
+	if (temp != stackBuf)
+		free(temp);
+
+	return ret;
+}
+
+
+/*
+ * wiringPiI2CHandleXfer:
+ *	Run a combined transaction on the device behind a handle. Every
+ *	segment is addressed to the handle's device whatever devId it was
+ *	added with.
+ *********************************************************************************
+ */
+
+int wiringPiI2CHandleXfer (int handle, struct wiringPiI2CXferStruct *xfer)
+{
+	return i2cRun (handle, xfer->msgs, xfer->nmsgs, NULL, NULL);
+}
+
+
+/*
+ * wiringPiI2CSchedule:
+ *	Put a handle under its bus scheduler, so all its transfers are queued
+ *	and serialised with the other scheduled devices on the bus and may be
+ *	combined with theirs into one I2C_RDWR - the segments are then joined
+ *	by repeated starts instead of stop conditions.
+ *	minInterval is the least time in uS between two transactions to the
+ *	device, or 0 for no limit.
+ *********************************************************************************
+ */
+
+int wiringPiI2CSchedule (int handle, int minInterval)
+{
+	struct i2cDev	*dev;
+	struct i2cBus	*bus;
+
+	if (minInterval < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock (&i2cMutex);
+	if (handle < 0 || handle >= i2cNumDevs || (dev = i2cDevs[handle]) == NULL) {
+		pthread_mutex_unlock (&i2cMutex);
+		errno = EBADF;
+		return -1;
+	}
+
+	bus = dev->bus;
+	if (bus->sched == NULL && (bus->sched = i2cSchedStart (bus)) == NULL) {
+		pthread_mutex_unlock (&i2cMutex);
+		return wiringPiFailure (WPI_ALMOST, "Unable to start I2C scheduler: %s\n", strerror (errno));
+	}
+
+	pthread_mutex_lock (&bus->sched->lock);
+	dev->interval  = minInterval;
+	dev->scheduled = TRUE;
+	pthread_mutex_unlock (&bus->sched->lock);
+
+	pthread_mutex_unlock (&i2cMutex);
+
+	return 0;
+}
+
+
+/*
+ * wiringPiI2CSchedSubmit:
+ *	Queue a combined transaction on a scheduled handle and return at once.
+ *	The callback is run on the scheduler thread with 0 or a negative errno
+ *	value, and the transaction has to stay valid until then. A handle not
+ *	put under the scheduler with wiringPiI2CSchedule gets EINVAL.
+ *********************************************************************************
+ */
+
+int wiringPiI2CSchedSubmit (int handle, struct wiringPiI2CXferStruct *xfer,
+	void (*callback)(int handle, int result, void *userData), void *userData)
+{
+	if (callback == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return i2cRun (handle, xfer->msgs, xfer->nmsgs, callback, userData);
+}
+
+
+/*
+ * wiringPiI2CHandleGetFd: wiringPiI2CHandleGetAddress:
+ *	Return the shared bus fd or the device address of a handle, e.g. to
+ *	build a combined transaction with wiringPiI2CXfer*
+ *********************************************************************************
+ */
+
+int wiringPiI2CHandleGetFd (int handle)
+{
+	int fd, addr;
+
+	if (i2cGetDev (handle, &fd, &addr) < 0)
+		return -1;
+
+	return fd;
+}
+
+int wiringPiI2CHandleGetAddress (int handle)
+{
+	int fd, addr;
+
+	if (i2cGetDev (handle, &fd, &addr) < 0)
+		return -1;
+
+	return addr;
+}
+
+
+/*
+ * i2cOpen:
+ *	Return a handle for device devId on the named bus, opening the bus
+ *	the first time it is asked for. A negative sdaPin means an i2c-dev
+ *	device node, otherwise the bus is bit-banged on sdaPin and sclPin.
+ *********************************************************************************
+ */
+
+static int i2cOpen (const char *device, int devId, int sdaPin, int sclPin, int speed)
+{
+	struct i2cBus	*bus;
+	struct i2cDev	*dev, **newDevs;
+	int		handle;
+
+	if (device == NULL || devId < 0 || devId > 0x7F) {
+		errno = EINVAL;
+		return wiringPiFailure (WPI_ALMOST, "Invalid I2C device\n");
+	}
+
+	if ((dev = calloc (1, sizeof (*dev))) == NULL)
+		return wiringPiFailure (WPI_ALMOST, "Unable to allocate I2C device: %s\n", strerror (errno));
+
+	pthread_mutex_lock (&i2cMutex);
+
+	for (bus = i2cBuses; bus != NULL; bus = bus->next)
+		if (strcmp (bus->device, device) == 0)
+			break;
+
+	if (bus == NULL) {
+		if ((bus = calloc (1, sizeof (*bus))) == NULL || (bus->device = strdup (device)) == NULL) {
+			pthread_mutex_unlock (&i2cMutex);
+			free (bus);
+			free (dev);
+			return wiringPiFailure (WPI_ALMOST, "Unable to allocate I2C bus: %s\n", strerror (errno));
+		}
+
+		if (sdaPin >= 0) {
+			bus->fd = -1;
+			if ((bus->soft = softI2cCreate (sdaPin, sclPin, speed)) == NULL) {
+				pthread_mutex_unlock (&i2cMutex);
+				free (bus->device);
+				free (bus);
+				free (dev);
+				return wiringPiFailure (WPI_ALMOST, "Unable to set up soft I2C: %s\n", strerror (errno));
+			}
+		} else if ((bus->fd = open (device, O_RDWR)) < 0) {
+			pthread_mutex_unlock (&i2cMutex);
+			free (bus->device);
+			free (bus);
+			free (dev);
+			return wiringPiFailure (WPI_ALMOST, "Unable to open I2C device: %s\n", strerror (errno));
+		}
+
+		bus->next = i2cBuses;
+		i2cBuses  = bus;
+	}
+
+	for (handle = 0; handle < i2cNumDevs; handle++)
+		if (i2cDevs[handle] == NULL)
+			break;
+
+	if (handle == i2cNumDevs) {
+		if ((newDevs = realloc (i2cDevs, (i2cNumDevs + 16) * sizeof (*i2cDevs))) == NULL) {
+			pthread_mutex_unlock (&i2cMutex);
+			free (dev);
+			return wiringPiFailure (WPI_ALMOST, "Unable to allocate I2C device: %s\n", strerror (errno));
+		}
+		memset (&newDevs[i2cNumDevs], 0, 16 * sizeof (*i2cDevs));
+		i2cDevs     = newDevs;
+		i2cNumDevs += 16;
+	}
+
+	bus->refs++;
+	dev->bus	= bus;
+	dev->addr	= devId;
+	i2cDevs[handle]	= dev;
+
+	pthread_mutex_unlock (&i2cMutex);
+
+	return handle;
+}
+
+
+/*
+ * wiringPiI2COpenDevice:
+ *	Return a handle for device devId on the bus at the given device node.
+ *	The bus is only opened the first time, later handles share its fd.
+ *********************************************************************************
+ */
+
+int wiringPiI2COpenDevice (const char *device, int devId)
+{
+	return i2cOpen (device, devId, -1, -1, 0);
+}
+
+
+/*
+ * wiringPiI2COpenSoft:
+ *	Return a handle for device devId on a bus bit-banged on any two pins
+ *	at up to speed Hz, for boards short of hardware I2C. Handles on the
+ *	same pair of pins share the bus. There is no fd behind them, so only
+ *	the handle calls can be used.
+ *********************************************************************************
+ */
+
+int wiringPiI2COpenSoft (int sdaPin, int sclPin, int speed, int devId)
+{
+	char device[32];
+
+	if (sdaPin < 0 || sclPin < 0 || sdaPin == sclPin || speed <= 0) {
+		errno = EINVAL;
+		return wiringPiFailure (WPI_ALMOST, "Invalid soft I2C bus\n");
+	}
+
+	snprintf (device, sizeof (device), "soft:%d:%d", sdaPin, sclPin);
+
+	return i2cOpen (device, devId, sdaPin, sclPin, speed);
+}
+
+
+/*
+ * wiringPiI2CClose:
+ *	Release a handle, closing the bus when its last device goes
+ *********************************************************************************
+ */
+
+int wiringPiI2CClose (int handle)
+{
+	struct i2cBus	*bus, **prev;
+	struct i2cDev	*dev;
+	struct i2cSched	*sched;
+
+	pthread_mutex_lock (&i2cMutex);
+
+	if (handle < 0 || handle >= i2cNumDevs || (dev = i2cDevs[handle]) == NULL) {
+		pthread_mutex_unlock (&i2cMutex);
+		errno = EBADF;
+		return -1;
+	}
+
+	i2cDevs[handle] = NULL;
+	bus   = dev->bus;
+	sched = bus->sched;
+
+	pthread_mutex_unlock (&i2cMutex);
+
+// Let anything still queued for the device go out first. The device
+//	holds a reference on the bus, so the bus stays around meanwhile.
+
+	if (sched != NULL) {
+		pthread_mutex_lock (&sched->lock);
+		while (dev->pending > 0)
+			pthread_cond_wait (&sched->done, &sched->lock);
+		pthread_mutex_unlock (&sched->lock);
+	}
+	free (dev);
+
+	pthread_mutex_lock (&i2cMutex);
+
+	if (--bus->refs == 0) {
+		for (prev = &i2cBuses; *prev != bus; prev = &(*prev)->next)
+			;
+		*prev = bus->next;
+	} else
+		bus = NULL;
+
+	pthread_mutex_unlock (&i2cMutex);
+
+	if (bus != NULL) {
+		i2cSchedStop (bus->sched);
+		if (bus->soft != NULL)
+			softI2cFree (bus->soft);
+		else
+			close (bus->fd);
+		free (bus->device);
+		free (bus);
+	}
+
+	return 0;
+}
+
+
 /*
  * wiringPiI2CSetupInterface:
  *	Open the I2C device, and regisiter the target device
@@ -213,28 +1166,44 @@ int wiringPiI2CWriteBlock (int fd, int reg, uint8_t *buff, int size)
 
 int wiringPiI2CSetupInterface (const char *device, int devId)
 {
+	struct i2cLegacy *leg;
 	int fd;
 	if ((fd = open (device, O_RDWR)) < 0) {
 		return wiringPiFailure (WPI_ALMOST, "Unable to open I2C device: %s\n", strerror (errno)) ;
 	}
 
 	if (ioctl (fd, I2C_SLAVE, devId) < 0) {
+		close (fd);
 		return wiringPiFailure (WPI_ALMOST, "Unable to select I2C device: %s\n", strerror (errno)) ;
 	}
 
-	fdToSlaveAddress[fd] = devId;
+	pthread_mutex_lock (&i2cMutex);
+	for (leg = i2cLegacy; leg != NULL; leg = leg->next)
+		if (leg->fd == fd)
+			break;
+
+	if (leg == NULL && (leg = malloc (sizeof (*leg))) != NULL) {
+		leg->next = i2cLegacy;
+		i2cLegacy = leg;
+	}
+
+	if (leg != NULL) {
+		leg->fd   = fd;
+		leg->addr = devId;
+	}
+	pthread_mutex_unlock (&i2cMutex);
 
 	return fd ;
 }
 
 
 /*
- * wiringPiI2CSetup:
- *	Open the I2C device, and regisiter the target device
+ * i2cDefaultDevice:
+ *	Return the device node of the I2C bus on the header of this board
  *********************************************************************************
  */
 
-int wiringPiI2CSetup (const int devId)
+static const char *i2cDefaultDevice (void)
 {
 	int model, rev, mem, maker, mode;
 	const char *device = NULL;
@@ -268,5 +1237,29 @@ int wiringPiI2CSetup (const int devId)
 	break;
 	}
 
-	return wiringPiI2CSetupInterface (device, devId) ;
+	return device;
+}
+
+
+/*
+ * wiringPiI2COpen:
+ *	Return a handle for device devId on the board's header I2C bus
+ *********************************************************************************
+ */
+
+int wiringPiI2COpen (const int devId)
+{
+	return wiringPiI2COpenDevice (i2cDefaultDevice (), devId) ;
+}
+
+
+/*
+ * wiringPiI2CSetup:
+ *	Open the I2C device, and regisiter the target device
+ *********************************************************************************
+ */
+
+int wiringPiI2CSetup (const int devId)
+{
+	return wiringPiI2CSetupInterface (i2cDefaultDevice (), devId) ;
 }
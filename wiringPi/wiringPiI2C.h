@@ -27,6 +27,17 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <linux/i2c.h>
+
+// Maximum number of segments in one I2C_RDWR ioctl (I2C_RDWR_IOCTL_MAX_MSGS)
+#define	WPI_I2C_MAX_MSGS	42
+
+struct wiringPiI2CXferStruct
+{
+	int		nmsgs;
+	struct i2c_msg	msgs[WPI_I2C_MAX_MSGS];
+	uint8_t		regs[WPI_I2C_MAX_MSGS];	// Register numbers for ReadReg segments
+};
 
 extern int wiringPiI2CRead		(int fd);
 extern int wiringPiI2CReadReg8		(int fd, int reg);
@@ -38,9 +49,42 @@ extern int wiringPiI2CWriteReg8		(int fd, int reg, int data);
 extern int wiringPiI2CWriteReg16	(int fd, int reg, int data);
 extern int wiringPiI2CWriteBlock	(int fd, int reg, uint8_t *buff, int size);
 
+extern void wiringPiI2CXferInit		(struct wiringPiI2CXferStruct *xfer);
+extern int wiringPiI2CXferWrite		(struct wiringPiI2CXferStruct *xfer, int devId, const uint8_t *buff, int size);
+extern int wiringPiI2CXferRead		(struct wiringPiI2CXferStruct *xfer, int devId, uint8_t *buff, int size);
+extern int wiringPiI2CXferReadReg	(struct wiringPiI2CXferStruct *xfer, int devId, int reg, uint8_t *buff, int size);
+extern int wiringPiI2CXferSubmit	(int fd, struct wiringPiI2CXferStruct *xfer);
+extern int wiringPiI2CTransfer		(int fd, struct i2c_msg *msgs, int nmsgs);
+
 extern int wiringPiI2CSetupInterface	(const char *device, int devId);
 extern int wiringPiI2CSetup		(const int devId);
 
+// Handle based interface, one shared fd per bus
+
+extern int wiringPiI2COpenDevice	(const char *device, int devId);
+extern int wiringPiI2COpen		(const int devId);
+extern int wiringPiI2COpenSoft		(int sdaPin, int sclPin, int speed, int devId);
+extern int wiringPiI2CClose		(int handle);
+extern int wiringPiI2CHandleGetFd	(int handle);
+extern int wiringPiI2CHandleGetAddress	(int handle);
+
+extern int wiringPiI2CHandleRead	(int handle);
+extern int wiringPiI2CHandleReadReg8	(int handle, int reg);
+extern int wiringPiI2CHandleReadReg16	(int handle, int reg);
+extern int wiringPiI2CHandleReadBlock	(int handle, int reg, uint8_t *buff, int size);
+
+extern int wiringPiI2CHandleWrite	(int handle, int data);
+extern int wiringPiI2CHandleWriteReg8	(int handle, int reg, int data);
+extern int wiringPiI2CHandleWriteReg16	(int handle, int reg, int data);
+extern int wiringPiI2CHandleWriteBlock	(int handle, int reg, const uint8_t *buff, int size);
+extern int wiringPiI2CHandleXfer		(int handle, struct wiringPiI2CXferStruct *xfer);
+
+// Bus scheduler
+
+extern int wiringPiI2CSchedule		(int handle, int minInterval);
+extern int wiringPiI2CSchedSubmit	(int handle, struct wiringPiI2CXferStruct *xfer,
+					 void (*callback)(int handle, int result, void *userData), void *userData);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,173 @@
+/*
+ * wiringPiRegCache.c:
+ *	Write-through register cache for device nodes.
+ *
+ *	GPIO expanders keep their configuration (direction, pull-ups, output
+ *	latches) in registers which only ever change when we write them, so
+ *	there is no need to read them back over the bus before changing a
+ *	bit. A node can mirror up to WPI_REGCACHE_SIZE such registers here:
+ *	reads come from memory once a register is known and every write
+ *	still goes straight out to the device.
+ *
+ *	Only registers the device never changes by itself belong in the
+ *	cache - input ports and interrupt flags must always be read from
+ *	the device. Invalidate the cache whenever the device may have been
+ *	reset behind our back.
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "wiringPi.h"
+#include "wiringPiRegCache.h"
+
+
+/*
+ * wiringPiRegCacheSetup:
+ *	Give a node a register cache, using the supplied functions to talk
+ *	to the device. The cache starts out empty.
+ *********************************************************************************
+ */
+
+int wiringPiRegCacheSetup (struct wiringPiNodeStruct *node,
+	int (*readReg)  (struct wiringPiNodeStruct *node, int reg),
+	int (*writeReg) (struct wiringPiNodeStruct *node, int reg, int value))
+{
+  struct wiringPiRegCacheStruct *cache ;
+
+  if ((cache = calloc (1, sizeof (*cache))) == NULL)
+    return wiringPiFailure (WPI_ALMOST, "wiringPiRegCacheSetup: Unable to allocate memory: %s\n", strerror (errno)) ;
+
+  cache->readReg  = readReg ;
+  cache->writeReg = writeReg ;
+
+  free (node->regCache) ;
+  node->regCache = cache ;
+
+  return 0 ;
+}
+
+
+/*
+ * wiringPiRegCacheRead:
+ *	Return the value of a register, only going to the device the first
+ *	time it's asked for.
+ *********************************************************************************
+ */
+
+int wiringPiRegCacheRead (struct wiringPiNodeStruct *node, int reg)
+{
+  struct wiringPiRegCacheStruct *cache = node->regCache ;
+  int value ;
+
+  if ((reg < 0) || (reg >= WPI_REGCACHE_SIZE))
+    return -1 ;
+
+  if (cache->valid & (1u << reg))
+    return cache->regs [reg] ;
+
+  if ((value = cache->readReg (node, reg)) < 0)
+    return -1 ;
+
+  cache->regs [reg] = value ;
+  cache->valid     |= 1u << reg ;
+
+  return value & 0xFF ;
+}
+
+
+/*
+ * wiringPiRegCacheWrite:
+ *	Write a register on the device and remember the value. If the write
+ *	fails the register is forgotten so the next read goes to the device.
+ *********************************************************************************
+ */
+
+int wiringPiRegCacheWrite (struct wiringPiNodeStruct *node, int reg, int value)
+{
+  struct wiringPiRegCacheStruct *cache = node->regCache ;
+
+  if ((reg < 0) || (reg >= WPI_REGCACHE_SIZE))
+    return -1 ;
+
+  if (cache->writeReg (node, reg, value & 0xFF) < 0)
+  {
+    cache->valid &= ~(1u << reg) ;
+    return -1 ;
+  }
+
+  cache->regs [reg] = value ;
+  cache->valid     |= 1u << reg ;
+
+  return 0 ;
+}
+
+
+/*
+ * wiringPiRegCacheUpdate:
+ *	Change the bits in mask to those of value: a read-modify-write where
+ *	the read normally comes from the cache, so costs just the one write.
+ *********************************************************************************
+ */
+
+int wiringPiRegCacheUpdate (struct wiringPiNodeStruct *node, int reg, int mask, int value)
+{
+  int old ;
+
+  if ((old = wiringPiRegCacheRead (node, reg)) < 0)
+    return -1 ;
+
+  return wiringPiRegCacheWrite (node, reg, (old & ~mask) | (value & mask)) ;
+}
+
+
+/*
+ * wiringPiRegCacheSet:
+ *	Record a value the device is known to hold without any bus traffic,
+ *	e.g. after a driver has written several registers in one transfer.
+ *********************************************************************************
+ */
+
+void wiringPiRegCacheSet (struct wiringPiNodeStruct *node, int reg, int value)
+{
+  struct wiringPiRegCacheStruct *cache = node->regCache ;
+
+  if ((reg < 0) || (reg >= WPI_REGCACHE_SIZE))
+    return ;
+
+  cache->regs [reg] = value ;
+  cache->valid     |= 1u << reg ;
+}
+
+
+/*
+ * wiringPiRegCacheInvalidate:
+ *	Forget everything, e.g. after the device has been reset
+ *********************************************************************************
+ */
+
+void wiringPiRegCacheInvalidate (struct wiringPiNodeStruct *node)
+{
+  if (node->regCache != NULL)
+    node->regCache->valid = 0 ;
+}
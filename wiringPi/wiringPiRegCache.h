@@ -0,0 +1,54 @@
+/*
+ * wiringPiRegCache.h:
+ *	Write-through register cache for device nodes
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as
+ *    published by the Free Software Foundation, either version 3 of the
+ *    License, or (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with wiringPi.
+ *    If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Number of 8-bit registers a cache can mirror
+
+#define	WPI_REGCACHE_SIZE	32
+
+struct wiringPiRegCacheStruct
+{
+  uint32_t valid ;				// Bit n set when regs [n] is known
+  uint8_t  regs [WPI_REGCACHE_SIZE] ;
+
+  int (*readReg)  (struct wiringPiNodeStruct *node, int reg) ;
+  int (*writeReg) (struct wiringPiNodeStruct *node, int reg, int value) ;
+} ;
+
+extern int  wiringPiRegCacheSetup      (struct wiringPiNodeStruct *node,
+	int (*readReg)  (struct wiringPiNodeStruct *node, int reg),
+	int (*writeReg) (struct wiringPiNodeStruct *node, int reg, int value)) ;
+extern int  wiringPiRegCacheRead       (struct wiringPiNodeStruct *node, int reg) ;
+extern int  wiringPiRegCacheWrite      (struct wiringPiNodeStruct *node, int reg, int value) ;
+extern int  wiringPiRegCacheUpdate     (struct wiringPiNodeStruct *node, int reg, int mask, int value) ;
+extern void wiringPiRegCacheSet        (struct wiringPiNodeStruct *node, int reg, int value) ;
+extern void wiringPiRegCacheInvalidate (struct wiringPiNodeStruct *node) ;
+
+#ifdef __cplusplus
+}
+#endif
@@ -23,28 +23,827 @@
  */
 
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <asm/ioctl.h>
 #include <linux/spi/spidev.h>
 
 #include "wiringPi.h"
 #include "wiringPiSPI.h"
+#include "softSpi.h"
 
 
 // The SPI bus parameters
-//	Variables as they need to be passed as pointers later on
+//	Each opened device is tracked by a handle which is an index into
+//	spiDevs and carries its own mode, bits per word, speed and delay.
+//	The old channel based calls map a channel number onto a handle.
+//	A handle may also be a bit-banged bus (softSpi) on any pins, which
+//	has no fd and gets the same transfers spidev would.
 
 static const char       *spiDevType0    = "/dev/spidev0.";
 static const char       *spiDevType1    = "/dev/spidev1.";
-static const uint8_t     spiBPW         = 8;
-static const uint16_t    spiDelay       = 0;
 
-static uint32_t    spiSpeeds [8];
-static int         spiFds [8];
+// Asynchronous transfers are queued on a per-device list and clocked
+//	out by a worker thread. Back to back requests are sent together in
+//	one SPI_IOC_MESSAGE(n) of up to SPI_QUEUE_BATCH transfers, as long as
+//	they fit in spidev's default 4096 byte message buffer.
+
+#define	SPI_QUEUE_BATCH		32
+#define	SPI_QUEUE_COALESCE	4096
+
+struct spiRequest
+{
+  const unsigned char *tx ;
+  unsigned char       *rx ;
+  int                  len ;
+  uint8_t              mode ;
+  uint8_t              bpw ;
+  uint16_t             delay ;
+  uint32_t             speed ;
+  void               (*callback) (int handle, int result, void *userData) ;
+  void                *userData ;
+  struct spiRequest   *next ;
+} ;
+
+struct wiringPiSPIStruct ;
+
+struct spiQueue
+{
+  int                handle ;
+  int                fd ;
+  struct softSpiStruct *soft ;
+  int                stopping ;
+  int                refs ;	// The device, the worker and those waiting on it
+  struct wiringPiSPIStruct *orphan ;	// Closed from a callback; the worker frees it
+  int                orphanFd ;	// And closes its fd
+  pthread_t          thread ;
+  pthread_mutex_t    lock ;
+  pthread_cond_t     work ;
+  pthread_cond_t     done ;
+  struct spiRequest *head, *tail ;
+  unsigned int       nextId ;	// Id of the next request to be submitted
+  unsigned int       doneId ;	// Id of the next request to be completed
+} ;
+
+struct wiringPiSPIStruct
+{
+  int      fd ;
+  uint8_t  mode ;
+  uint8_t  bpw ;
+  uint16_t delay ;
+  uint32_t speed ;
+  struct softSpiStruct *soft ;
+  struct spiQueue *queue ;
+} ;
+
+static struct wiringPiSPIStruct **spiDevs   = NULL ;
+static int                        spiNumDevs = 0 ;
+
+static int *spiChannels    = NULL ;
+static int  spiNumChannels = 0 ;
+
+static pthread_mutex_t spiMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+
+/*
+ * spiGetDev:
+ *	Copy out the settings for a handle. Done under the lock as the table
+ *	may be re-allocated by another thread opening a device.
+ *********************************************************************************
+ */
+
+static int spiGetDev (int handle, struct wiringPiSPIStruct *dev)
+{
+  int ret = -1 ;
+
+  pthread_mutex_lock (&spiMutex) ;
+  if ((handle >= 0) && (handle < spiNumDevs) && (spiDevs [handle] != NULL))
+  {
+    *dev = *spiDevs [handle] ;
+    ret  = 0 ;
+  }
+  pthread_mutex_unlock (&spiMutex) ;
+
+  if (ret < 0)
+    errno = EBADF ;
+
+  return ret ;
+}
+
+
+/*
+ * spiChannelToHandle:
+ *	Return the handle a legacy channel number was set up with, or -1
+ *********************************************************************************
+ */
+
+static int spiChannelToHandle (int channel)
+{
+  int handle = -1 ;
+
+  pthread_mutex_lock (&spiMutex) ;
+  if ((channel >= 0) && (channel < spiNumChannels))
+    handle = spiChannels [channel] ;
+  pthread_mutex_unlock (&spiMutex) ;
+
+  return handle ;
+}
+
+
+/*
+ * spiTransfer:
+ *	Send a list of transfers to spidev, or clock them out on a soft bus
+ *********************************************************************************
+ */
+
+static int spiTransfer (int fd, struct softSpiStruct *soft, int mode, struct spi_ioc_transfer *spi, int n)
+{
+  if (soft != NULL)
+    return softSpiTransfer (soft, mode, spi, n) ;
+
+  return ioctl (fd, SPI_IOC_MESSAGE(n), spi) ;
+}
+
+
+/*
+ * spiSetParams:
+ *	Push the mode, bits per word and speed of a device down to spidev.
+ *	A soft bus takes them from each transfer, so has nothing to set.
+ *********************************************************************************
+ */
+
+static int spiSetParams (struct wiringPiSPIStruct *dev)
+{
+  if (dev->soft != NULL)
+    return 0 ;
+
+  if (ioctl (dev->fd, SPI_IOC_WR_MODE, &dev->mode) < 0)
+    return wiringPiFailure (WPI_ALMOST, "SPI Mode Change failure: %s\n", strerror (errno)) ;
+
+  if (ioctl (dev->fd, SPI_IOC_WR_BITS_PER_WORD, &dev->bpw) < 0)
+    return wiringPiFailure (WPI_ALMOST, "SPI BPW Change failure: %s\n", strerror (errno)) ;
+
+  if (ioctl (dev->fd, SPI_IOC_WR_MAX_SPEED_HZ, &dev->speed) < 0)
+    return wiringPiFailure (WPI_ALMOST, "SPI Speed Change failure: %s\n", strerror (errno)) ;
+
+  return 0 ;
+}
+
+
+/*
+ * spiDevRelease:
+ *	Free a device once its queue is done with, optionally closing its
+ *	fd. A soft bus belongs to the library and always goes.
+ *********************************************************************************
+ */
+
+static void spiDevRelease (struct wiringPiSPIStruct *dev, int closeFd)
+{
+  if (dev->soft != NULL)
+    softSpiFree (dev->soft) ;
+  else if (closeFd)
+    close (dev->fd) ;
+
+  free (dev) ;
+}
+
+
+/*
+ * spiQueuePut:
+ *	Let go of a queue, freeing it once nobody has hold of it
+ *********************************************************************************
+ */
+
+static void spiQueuePut (struct spiQueue *queue)
+{
+  int refs ;
+
+  pthread_mutex_lock (&queue->lock) ;
+  refs = --queue->refs ;
+  pthread_mutex_unlock (&queue->lock) ;
+
+  if (refs > 0)
+    return ;
+
+  pthread_cond_destroy  (&queue->done) ;
+  pthread_cond_destroy  (&queue->work) ;
+  pthread_mutex_destroy (&queue->lock) ;
+  free (queue) ;
+}
+
+
+/*
+ * spiQueueThread:
+ *	Worker for the asynchronous queue of one device. Takes as many
+ *	pending requests as can go in one message, sends them and runs the
+ *	completion callbacks. A device closed from one of those is freed
+ *	here, once the rest of its queue has gone out.
+ *********************************************************************************
+ */
+
+static void *spiQueueThread (void *arg)
+{
+  struct spiQueue         *queue = (struct spiQueue *)arg ;
+  struct spiRequest       *batch, *req, *next ;
+  struct spi_ioc_transfer  spi [SPI_QUEUE_BATCH] ;
+  int i, n, total, result ;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&queue->lock) ;
+    while ((queue->head == NULL) && !queue->stopping)
+      pthread_cond_wait (&queue->work, &queue->lock) ;
+
+    if (queue->head == NULL)
+    {
+      pthread_mutex_unlock (&queue->lock) ;
+      break ;
+    }
+
+    batch = queue->head ;
+    n     = 0 ;
+    total = 0 ;
+    for (req = batch ; (req != NULL) && (n < SPI_QUEUE_BATCH) ; req = req->next)
+    {
+      if ((n > 0) && ((total + req->len > SPI_QUEUE_COALESCE) || (req->mode != batch->mode)))
+	break ;
+      total += req->len ;
+      ++n ;
+    }
+
+    queue->head = req ;
+    if (req == NULL)
+      queue->tail = NULL ;
+    pthread_mutex_unlock (&queue->lock) ;
+
+// Each request is its own chip-select framed transfer, as if it had been
+//	sent on its own, so drop CS between them but not after the last one.
+
+    memset (spi, 0, n * sizeof (spi [0])) ;
+    for (req = batch, i = 0 ; i < n ; req = req->next, ++i)
+    {
+      spi [i].tx_buf        = (unsigned long)req->tx ;
+      spi [i].rx_buf        = (unsigned long)req->rx ;
+      spi [i].len           = req->len ;
+      spi [i].delay_usecs   = req->delay ;
+      spi [i].speed_hz      = req->speed ;
+      spi [i].bits_per_word = req->bpw ;
+      spi [i].cs_change     = (i < n - 1) ;
+    }
+
+    result = spiTransfer (queue->fd, queue->soft, batch->mode, spi, n) < 0 ? -errno : 0 ;
+
+    for (req = batch, i = 0 ; i < n ; req = next, ++i)
+    {
+      next = req->next ;
+      if (req->callback != NULL)
+	req->callback (queue->handle, result < 0 ? result : req->len, req->userData) ;
+      free (req) ;
+    }
+
+    pthread_mutex_lock (&queue->lock) ;
+    queue->doneId += n ;
+    pthread_cond_broadcast (&queue->done) ;
+    pthread_mutex_unlock (&queue->lock) ;
+  }
+
+  if (queue->orphan != NULL)
+    spiDevRelease (queue->orphan, queue->orphanFd) ;
+
+  spiQueuePut (queue) ;
+
+  return NULL ;
+}
+
+
+/*
+ * spiQueueStop:
+ *	Let the worker finish what is queued, and let go of the queue. It
+ *	goes once anyone still waiting on it is done. Called from one of the
+ *	queue's own callbacks, the worker can't be waited for, so it is left
+ *	to finish and free the device itself: returns TRUE then.
+ *********************************************************************************
+ */
+
+static int spiQueueStop (struct spiQueue *queue, struct wiringPiSPIStruct *dev, int closeFd)
+{
+  pthread_t thread ;
+
+  if (queue == NULL)
+    return FALSE ;
+
+  pthread_mutex_lock (&queue->lock) ;
+  queue->stopping = TRUE ;
+  pthread_cond_signal (&queue->work) ;
+  thread = queue->thread ;
+
+  if (pthread_equal (pthread_self (), thread))
+  {
+    queue->orphan   = dev ;
+    queue->orphanFd = closeFd ;
+    pthread_mutex_unlock (&queue->lock) ;
+    pthread_detach (thread) ;
+    spiQueuePut (queue) ;
+    return TRUE ;
+  }
+
+  pthread_mutex_unlock (&queue->lock) ;
+
+  pthread_join (thread, NULL) ;
+  spiQueuePut (queue) ;
+
+  return FALSE ;
+}
+
+
+/*
+ * spiDevFree:
+ *	Release a device taken out of the table, optionally closing its fd,
+ *	once its queue has finished with it.
+ *********************************************************************************
+ */
+
+static void spiDevFree (struct wiringPiSPIStruct *dev, int closeFd)
+{
+  if (!spiQueueStop (dev->queue, dev, closeFd))
+    spiDevRelease (dev, closeFd) ;
+}
+
+
+/*
+ * spiGetQueue:
+ *	Return the queue of a device, starting the worker on first use.
+ *	Must be called with spiMutex held.
+ *********************************************************************************
+ */
+
+static struct spiQueue *spiGetQueue (int handle)
+{
+  struct wiringPiSPIStruct *dev ;
+  struct spiQueue *queue ;
+
+  if ((handle < 0) || (handle >= spiNumDevs) || ((dev = spiDevs [handle]) == NULL))
+  {
+    errno = EBADF ;
+    return NULL ;
+  }
+
+  if (dev->queue != NULL)
+    return dev->queue ;
+
+  if ((queue = calloc (1, sizeof (*queue))) == NULL)
+    return NULL ;
+
+  queue->handle = handle ;
+  queue->fd     = dev->fd ;
+  queue->soft   = dev->soft ;
+  queue->refs   = 2 ;
+  pthread_mutex_init (&queue->lock, NULL) ;
+  pthread_cond_init  (&queue->work, NULL) ;
+  pthread_cond_init  (&queue->done, NULL) ;
+
+  if ((errno = pthread_create (&queue->thread, NULL, spiQueueThread, queue)) != 0)
+  {
+    pthread_cond_destroy  (&queue->done) ;
+    pthread_cond_destroy  (&queue->work) ;
+    pthread_mutex_destroy (&queue->lock) ;
+    free (queue) ;
+    return NULL ;
+  }
+
+  dev->queue = queue ;
+  return queue ;
+}
+
+
+/*
+ * wiringPiSPISubmit:
+ *	Queue a transfer on a handle and return straight away with an id for
+ *	it. The buffers must stay valid until the transfer has completed.
+ *	The callback, if any, is run on the worker thread with the number of
+ *	bytes transferred or a negative errno value.
+ *	Transfers on one handle complete in the order they were submitted.
+ *********************************************************************************
+ */
+
+int wiringPiSPISubmit (int handle, const unsigned char *tx, unsigned char *rx, int len,
+	void (*callback)(int handle, int result, void *userData), void *userData)
+{
+  struct spiQueue   *queue ;
+  struct spiRequest *req ;
+  unsigned int id ;
+
+  if (len <= 0)
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  if ((req = malloc (sizeof (*req))) == NULL)
+    return -1 ;
+
+  req->tx       = tx ;
+  req->rx       = rx ;
+  req->len      = len ;
+  req->callback = callback ;
+  req->userData = userData ;
+  req->next     = NULL ;
+
+  pthread_mutex_lock (&spiMutex) ;
+
+  if ((queue = spiGetQueue (handle)) == NULL)
+  {
+    pthread_mutex_unlock (&spiMutex) ;
+    free (req) ;
+    return -1 ;
+  }
+
+  req->mode  = spiDevs [handle]->mode ;
+  req->bpw   = spiDevs [handle]->bpw ;
+  req->delay = spiDevs [handle]->delay ;
+  req->speed = spiDevs [handle]->speed ;
+
+  pthread_mutex_lock (&queue->lock) ;
+  if (queue->tail == NULL)
+    queue->head = req ;
+  else
+    queue->tail->next = req ;
+  queue->tail = req ;
+  id = queue->nextId++ ;
+  pthread_cond_signal (&queue->work) ;
+  pthread_mutex_unlock (&queue->lock) ;
+
+  pthread_mutex_unlock (&spiMutex) ;
+
+  return (int)(id & 0x7FFFFFFF) ;
+}
+
+
+/*
+ * wiringPiSPIWait: wiringPiSPIFlush:
+ *	Block until the transfer with the given id, or everything submitted
+ *	so far, has completed.
+ *	Ids are compared modulo 2^31 so they can wrap around safely. The
+ *	queue is held on to meanwhile, in case the handle is closed.
+ *********************************************************************************
+ */
+
+static int spiQueueWait (int handle, int id, int all)
+{
+  struct spiQueue *queue ;
+
+  pthread_mutex_lock (&spiMutex) ;
+  if ((handle < 0) || (handle >= spiNumDevs) || (spiDevs [handle] == NULL))
+  {
+    pthread_mutex_unlock (&spiMutex) ;
+    errno = EBADF ;
+    return -1 ;
+  }
+  if ((queue = spiDevs [handle]->queue) != NULL)
+  {
+    pthread_mutex_lock (&queue->lock) ;
+    ++queue->refs ;
+    pthread_mutex_unlock (&queue->lock) ;
+  }
+  pthread_mutex_unlock (&spiMutex) ;
+
+  if (queue == NULL)
+    return 0 ;
+
+  pthread_mutex_lock (&queue->lock) ;
+  if (all)
+    id = queue->nextId - 1 ;
+  while (((queue->doneId - 1 - (unsigned int)id) & 0x7FFFFFFF) >= 0x40000000)
+    pthread_cond_wait (&queue->done, &queue->lock) ;
+  pthread_mutex_unlock (&queue->lock) ;
+
+  spiQueuePut (queue) ;
+
+  return 0 ;
+}
+
+int wiringPiSPIWait (int handle, int id)
+{
+  return spiQueueWait (handle, id, FALSE) ;
+}
+
+int wiringPiSPIFlush (int handle)
+{
+  return spiQueueWait (handle, 0, TRUE) ;
+}
+
+
+/*
+ * spiAddDev:
+ *	Put a set up device in the first free slot of the table and return
+ *	its handle. The device is left to the caller if this fails.
+ *********************************************************************************
+ */
+
+static int spiAddDev (struct wiringPiSPIStruct *dev)
+{
+  struct wiringPiSPIStruct **newDevs ;
+  int handle ;
+
+  pthread_mutex_lock (&spiMutex) ;
+
+  for (handle = 0 ; handle < spiNumDevs ; ++handle)
+    if (spiDevs [handle] == NULL)
+      break ;
+
+  if (handle == spiNumDevs)
+  {
+    if ((newDevs = realloc (spiDevs, (spiNumDevs + 8) * sizeof (*spiDevs))) == NULL)
+    {
+      pthread_mutex_unlock (&spiMutex) ;
+      return wiringPiFailure (WPI_ALMOST, "Unable to allocate SPI device: %s\n", strerror (errno)) ;
+    }
+    memset (&newDevs [spiNumDevs], 0, 8 * sizeof (*spiDevs)) ;
+    spiDevs     = newDevs ;
+    spiNumDevs += 8 ;
+  }
+
+  spiDevs [handle] = dev ;
+  pthread_mutex_unlock (&spiMutex) ;
+
+  return handle ;
+}
+
+
+/*
+ * wiringPiSPIOpenDevice:
+ *	Open an SPI device node, set it up with the speed and mode given and
+ *	return a handle for it.
+ *********************************************************************************
+ */
+
+int wiringPiSPIOpenDevice (const char *device, int speed, int mode)
+{
+  struct wiringPiSPIStruct *dev ;
+  int handle ;
+
+  if ((dev = calloc (1, sizeof (*dev))) == NULL)
+    return wiringPiFailure (WPI_ALMOST, "Unable to allocate SPI device: %s\n", strerror (errno)) ;
+
+  if ((dev->fd = open (device, O_RDWR)) < 0)
+  {
+    free (dev) ;
+    return wiringPiFailure (WPI_ALMOST, "Unable to open %s: %s\n", device, strerror (errno)) ;
+  }
+
+  dev->mode  = mode & 3 ;
+  dev->bpw   = 8 ;
+  dev->delay = 0 ;
+  dev->speed = speed ;
+
+  if ((spiSetParams (dev) < 0) || ((handle = spiAddDev (dev)) < 0))
+  {
+    close (dev->fd) ;
+    free  (dev) ;
+    return -1 ;
+  }
+
+  return handle ;
+}
+
+
+/*
+ * wiringPiSPIOpenSoft:
+ *	Bit-bang an SPI bus on any four wiringPi pins, for boards with no
+ *	hardware SPI, and return a handle for it which works with all the
+ *	handle calls. mosiPin, misoPin or csPin may be -1 if not wired.
+ *	The clock runs at up to speed Hz, or as fast as the pins can be
+ *	toggled if that is less; there is no fd behind the handle.
+ *********************************************************************************
+ */
+
+int wiringPiSPIOpenSoft (int sclkPin, int mosiPin, int misoPin, int csPin, int speed, int mode)
+{
+  struct wiringPiSPIStruct *dev ;
+  int handle ;
+
+  if (speed <= 0)
+  {
+    errno = EINVAL ;
+    return wiringPiFailure (WPI_ALMOST, "Invalid soft SPI speed %d\n", speed) ;
+  }
+
+  if ((dev = calloc (1, sizeof (*dev))) == NULL)
+    return wiringPiFailure (WPI_ALMOST, "Unable to allocate SPI device: %s\n", strerror (errno)) ;
+
+  if ((dev->soft = softSpiCreate (sclkPin, mosiPin, misoPin, csPin)) == NULL)
+  {
+    free (dev) ;
+    return wiringPiFailure (WPI_ALMOST, "Unable to set up soft SPI: %s\n", strerror (errno)) ;
+  }
+
+  dev->fd    = -1 ;
+  dev->mode  = mode & 3 ;
+  dev->bpw   = 8 ;
+  dev->delay = 0 ;
+  dev->speed = speed ;
+
+  if ((handle = spiAddDev (dev)) < 0)
+  {
+    softSpiFree (dev->soft) ;
+    free (dev) ;
+    return -1 ;
+  }
+
+  return handle ;
+}
+
+
+/*
+ * wiringPiSPIOpen:
+ *	Open chip-select cs on SPI bus number bus, i.e. /dev/spidev<bus>.<cs>
+ *********************************************************************************
+ */
+
+int wiringPiSPIOpen (int bus, int cs, int speed, int mode)
+{
+  char device [32] ;
+
+  snprintf (device, sizeof (device), "/dev/spidev%d.%d", bus, cs) ;
+
+  return wiringPiSPIOpenDevice (device, speed, mode) ;
+}
+
+
+/*
+ * wiringPiSPIClose:
+ *	Close the device behind a handle and release the handle. A handle
+ *	set up as a legacy channel has had its fd handed to the caller by
+ *	wiringPiSPISetup, so the channel is just forgotten and the fd left
+ *	open, as setting the channel up again would.
+ *********************************************************************************
+ */
+
+int wiringPiSPIClose (int handle)
+{
+  struct wiringPiSPIStruct *dev = NULL ;
+  int channel, closeFd = TRUE ;
+
+  pthread_mutex_lock (&spiMutex) ;
+  if ((handle >= 0) && (handle < spiNumDevs))
+  {
+    dev = spiDevs [handle] ;
+    spiDevs [handle] = NULL ;
+
+    for (channel = 0 ; channel < spiNumChannels ; ++channel)
+      if (spiChannels [channel] == handle)
+      {
+	spiChannels [channel] = -1 ;
+	closeFd = FALSE ;
+      }
+  }
+  pthread_mutex_unlock (&spiMutex) ;
+
+  if (dev == NULL)
+  {
+    errno = EBADF ;
+    return -1 ;
+  }
+
+  spiDevFree (dev, closeFd) ;
+
+  return 0 ;
+}
+
+
+/*
+ * wiringPiSPISetMode: wiringPiSPISetBitsPerWord: wiringPiSPISetSpeed:
+ * wiringPiSPISetDelay:
+ *	Change the settings of an open device. The delay is the time in uS
+ *	to wait after each transfer before the chip select is released.
+ *********************************************************************************
+ */
+
+static int spiUpdate (int handle, int mode, int bpw, int speed, int delay)
+{
+  struct wiringPiSPIStruct *dev, newDev ;
+  int ret = 0 ;
+
+  pthread_mutex_lock (&spiMutex) ;
+
+  if ((handle < 0) || (handle >= spiNumDevs) || ((dev = spiDevs [handle]) == NULL))
+  {
+    pthread_mutex_unlock (&spiMutex) ;
+    errno = EBADF ;
+    return -1 ;
+  }
+
+  newDev = *dev ;
+  if (mode  >= 0) newDev.mode  = mode & 3 ;
+  if (bpw   >= 0) newDev.bpw   = bpw ;
+  if (speed >= 0) newDev.speed = speed ;
+  if (delay >= 0) newDev.delay = delay ;
+
+  if ((mode >= 0) || (bpw >= 0) || (speed >= 0))
+    ret = spiSetParams (&newDev) ;
+
+  if (ret == 0)
+    *dev = newDev ;
+
+  pthread_mutex_unlock (&spiMutex) ;
+
+  return ret ;
+}
+
+int wiringPiSPISetMode (int handle, int mode)
+{
+  return spiUpdate (handle, mode & 3, -1, -1, -1) ;
+}
+
+int wiringPiSPISetBitsPerWord (int handle, int bpw)
+{
+  if ((bpw < 1) || (bpw > 32))
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+  return spiUpdate (handle, -1, bpw, -1, -1) ;
+}
+
+int wiringPiSPISetSpeed (int handle, int speed)
+{
+  if (speed <= 0)
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+  return spiUpdate (handle, -1, -1, speed, -1) ;
+}
+
+int wiringPiSPISetDelay (int handle, int usecs)
+{
+  if ((usecs < 0) || (usecs > 0xFFFF))
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+  return spiUpdate (handle, -1, -1, -1, usecs) ;
+}
+
+
+/*
+ * wiringPiSPIHandleGetFd:
+ *	Return the file-descriptor behind a handle
+ *********************************************************************************
+ */
+
+int wiringPiSPIHandleGetFd (int handle)
+{
+  struct wiringPiSPIStruct dev ;
+
+  if (spiGetDev (handle, &dev) < 0)
+    return -1 ;
+
+  return dev.fd ;
+}
+
+
+/*
+ * wiringPiSPIHandleXfer:
+ *	Write and Read a block of data over the SPI bus using separate
+ *	transmit and receive buffers and the settings of the handle.
+ *	Either buffer may be NULL: with no tx buffer zeros are clocked out,
+ *	with no rx buffer the incoming data is discarded. The buffers are
+ *	handed straight to spidev, so no copies are made here - but note
+ *	that spidev limits a single transfer to its bufsiz module parameter
+ *	(4096 bytes by default).
+ *********************************************************************************
+ */
+
+int wiringPiSPIHandleXfer (int handle, const unsigned char *tx, unsigned char *rx, int len)
+{
+  struct wiringPiSPIStruct dev ;
+  struct spi_ioc_transfer spi ;
+
+  if (spiGetDev (handle, &dev) < 0)
+    return -1 ;
+
+// Mentioned in spidev.h but not used in the original kernel documentation
+//	test program )-:
+
+  memset (&spi, 0, sizeof (spi)) ;
+
+  spi.tx_buf        = (unsigned long)tx ;
+  spi.rx_buf        = (unsigned long)rx ;
+  spi.len           = len ;
+  spi.delay_usecs   = dev.delay ;
+  spi.speed_hz      = dev.speed ;
+  spi.bits_per_word = dev.bpw ;
+
+  return spiTransfer (dev.fd, dev.soft, dev.mode, &spi, 1) ;
+}
 
 
 /*
@@ -55,7 +854,20 @@ static int         spiFds [8];
 
 int wiringPiSPIGetFd (int channel)
 {
-  return spiFds [channel & 0x7] ;
+  return wiringPiSPIHandleGetFd (spiChannelToHandle (channel)) ;
+}
+
+
+/*
+ * wiringPiSPIXfer:
+ *	As wiringPiSPIHandleXfer, but for a channel set up with one of the
+ *	wiringPiSPISetup functions.
+ *********************************************************************************
+ */
+
+int wiringPiSPIXfer (int channel, const unsigned char *tx, unsigned char *rx, int len)
+{
+  return wiringPiSPIHandleXfer (spiChannelToHandle (channel), tx, rx, len) ;
 }
 
 
@@ -70,59 +882,100 @@ int wiringPiSPIGetFd (int channel)
 
 int wiringPiSPIDataRW (int channel, unsigned char *data, int len)
 {
-  struct spi_ioc_transfer spi ;
+  return wiringPiSPIXfer (channel, data, data, len) ;
+}
 
-  channel &= 0x7 ;
+/*
+ * spiSetChannel:
+ *	Point a legacy channel number at a handle. The old device on the
+ *	channel is forgotten, its fd left open as that belongs to the caller.
+ *********************************************************************************
+ */
 
-// Mentioned in spidev.h but not used in the original kernel documentation
-//	test program )-:
+static int spiSetChannel (int channel, int handle)
+{
+	int old, *newChannels ;
+	struct wiringPiSPIStruct *oldDev = NULL ;
 
-  memset (&spi, 0, sizeof (spi)) ;
+	pthread_mutex_lock (&spiMutex) ;
 
-  spi.tx_buf        = (unsigned long)data ;
-  spi.rx_buf        = (unsigned long)data ;
-  spi.len           = len ;
-  spi.delay_usecs   = spiDelay ;
-  spi.speed_hz      = spiSpeeds [channel] ;
-  spi.bits_per_word = spiBPW ;
+	if (channel >= spiNumChannels) {
+		if ((newChannels = realloc (spiChannels, (channel + 1) * sizeof (int))) == NULL) {
+			pthread_mutex_unlock (&spiMutex) ;
+			return wiringPiFailure (WPI_ALMOST,
+				"Unable to allocate SPI channel: %s\n", strerror (errno));
+		}
+		while (spiNumChannels <= channel)
+			newChannels [spiNumChannels++] = -1 ;
+		spiChannels = newChannels ;
+	}
+
+	if ((old = spiChannels [channel]) >= 0) {
+		oldDev = spiDevs [old] ;
+		spiDevs [old] = NULL ;
+	}
+	spiChannels [channel] = handle ;
+
+	pthread_mutex_unlock (&spiMutex) ;
 
-  return ioctl (spiFds [channel], SPI_IOC_MESSAGE(1), &spi) ;
+	if (oldDev != NULL)
+		spiDevFree (oldDev, FALSE) ;
+
+	return 0 ;
 }
 
 /*
  * wiringPiSPISetupInterface:
  *	Open the SPI device, and set it up, with the mode, etc.
+ *	The file-descriptor returned belongs to the caller, as it always has,
+ *	so setting up a channel again forgets the old device without closing it.
  *********************************************************************************
  */
 
 int wiringPiSPISetupInterface	(const char *device, int channel, int speed, int mode)
 {
-	int fd ;
-
-	channel &= 0x7;
-	mode    &= 3;
+	int handle ;
 
-	if ((fd = open (device, O_RDWR)) < 0)
+	if (channel < 0)
 		return wiringPiFailure (WPI_ALMOST,
-			"Unable to open %s: %s\n",device , strerror (errno));
+			"Invalid SPI channel %d\n", channel);
 
-	spiSpeeds [channel] = speed ;
-	spiFds    [channel] = fd ;
+	if ((handle = wiringPiSPIOpenDevice (device, speed, mode)) < 0)
+		return -1 ;
 
-	// Set SPI parameters.
-	if (ioctl (fd, SPI_IOC_WR_MODE, &mode) < 0)
-		return wiringPiFailure (WPI_ALMOST,
-			"SPI Mode Change failure: %s\n", strerror (errno));
+	if (spiSetChannel (channel, handle) < 0) {
+		wiringPiSPIClose (handle) ;
+		return -1 ;
+	}
 
-	if (ioctl (fd, SPI_IOC_WR_BITS_PER_WORD, &spiBPW) < 0)
-		return wiringPiFailure (WPI_ALMOST,
-			"SPI BPW Change failure: %s\n", strerror (errno));
+	return wiringPiSPIHandleGetFd (handle) ;
+}
+
+/*
+ * wiringPiSPISetupSoft:
+ *	Set up a channel on a bit-banged bus, see wiringPiSPIOpenSoft, so the
+ *	channel calls (wiringPiSPIDataRW, ...) can be used on boards without
+ *	hardware SPI. There is no fd to return, so this returns the handle.
+ *********************************************************************************
+ */
 
-	if (ioctl (fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)
+int wiringPiSPISetupSoft (int channel, int sclkPin, int mosiPin, int misoPin, int csPin, int speed, int mode)
+{
+	int handle ;
+
+	if (channel < 0)
 		return wiringPiFailure (WPI_ALMOST,
-			"SPI Speed Change failure: %s\n", strerror (errno));
+			"Invalid SPI channel %d\n", channel);
+
+	if ((handle = wiringPiSPIOpenSoft (sclkPin, mosiPin, misoPin, csPin, speed, mode)) < 0)
+		return -1 ;
+
+	if (spiSetChannel (channel, handle) < 0) {
+		wiringPiSPIClose (handle) ;
+		return -1 ;
+	}
 
-	return fd ;
+	return handle ;
 }
 
 /*
@@ -141,10 +994,10 @@ int wiringPiSPISetupMode (int channel, int speed, int mode)
 	switch(model)	{
 	case MODEL_ODROID_C2:
 		return wiringPiFailure (WPI_ALMOST,
-			"ODROID C2 does not support hardware SPI. Check out the SPI bitbang and use wiringPiSPISetupInterface.\n");
+			"ODROID C2 does not support hardware SPI. Use wiringPiSPISetupSoft to bit-bang it.\n");
 	case MODEL_ODROID_HC4:
 		return wiringPiFailure (WPI_ALMOST,
-			"ODROID HC4 does not support hardware SPI.\n");
+			"ODROID HC4 does not support hardware SPI. Use wiringPiSPISetupSoft to bit-bang it.\n");
 	case MODEL_ODROID_C1:
 	case MODEL_ODROID_N2:
 	case MODEL_ODROID_C4:
@@ -26,11 +26,35 @@
 extern "C" {
 #endif
 
+// Handle based interface
+
+int wiringPiSPIOpen		(int bus, int cs, int speed, int mode) ;
+int wiringPiSPIOpenDevice	(const char *device, int speed, int mode) ;
+int wiringPiSPIOpenSoft		(int sclkPin, int mosiPin, int misoPin, int csPin, int speed, int mode) ;
+int wiringPiSPIClose		(int handle) ;
+int wiringPiSPISetMode		(int handle, int mode) ;
+int wiringPiSPISetBitsPerWord	(int handle, int bpw) ;
+int wiringPiSPISetSpeed		(int handle, int speed) ;
+int wiringPiSPISetDelay		(int handle, int usecs) ;
+int wiringPiSPIHandleGetFd	(int handle) ;
+int wiringPiSPIHandleXfer	(int handle, const unsigned char *tx, unsigned char *rx, int len) ;
+
+// Asynchronous queue
+
+int wiringPiSPISubmit		(int handle, const unsigned char *tx, unsigned char *rx, int len,
+				 void (*callback)(int handle, int result, void *userData), void *userData) ;
+int wiringPiSPIWait		(int handle, int id) ;
+int wiringPiSPIFlush		(int handle) ;
+
+// Channel based interface
+
 int wiringPiSPIGetFd	(int channel) ;
 int wiringPiSPIDataRW	(int channel, unsigned char *data, int len) ;
+int wiringPiSPIXfer	(int channel, const unsigned char *tx, unsigned char *rx, int len) ;
 
 int wiringPiSPISetupInterface	(const char *device, int channel, int speed, int mode) ;
 int wiringPiSPISetupMode	(int channel, int speed, int mode) ;
+int wiringPiSPISetupSoft	(int channel, int sclkPin, int mosiPin, int misoPin, int csPin, int speed, int mode) ;
 int wiringPiSPISetup		(int channel, int speed) ;
 
 #ifdef __cplusplus
@@ -29,62 +29,303 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/serial.h>
 
 #include "wiringSerial.h"
 
+// Received data is read from the port in bulk into a buffer per fd, so
+//	serialGetchar and small serialReads don't cost a system call each.
+//	Ports are looked up by fd; one not opened here simply has no buffer
+//	and is read directly.
+
+#define	SERIAL_RX_SIZE	4096
+
+struct serialPort
+{
+  uint8_t buf [SERIAL_RX_SIZE] ;
+  int     head, tail ;		// Buffered data is buf [head] to buf [tail - 1]
+  int     baud ;
+  pthread_mutex_t lock ;
+} ;
+
+// Baud rates serialOpen knows, with their termios speeds
+
+static const struct
+{
+  int     baud ;
+  speed_t speed ;
+} serialSpeeds [] =
+{
+  {      50,      B50 },
+  {      75,      B75 },
+  {     110,     B110 },
+  {     134,     B134 },
+  {     150,     B150 },
+  {     200,     B200 },
+  {     300,     B300 },
+  {     600,     B600 },
+  {    1200,    B1200 },
+  {    1800,    B1800 },
+  {    2400,    B2400 },
+  {    4800,    B4800 },
+  {    9600,    B9600 },
+  {   19200,   B19200 },
+  {   38400,   B38400 },
+  {   57600,   B57600 },
+  {  115200,  B115200 },
+  {  230400,  B230400 },
+  {  460800,  B460800 },
+  {  500000,  B500000 },
+  {  576000,  B576000 },
+  {  921600,  B921600 },
+  { 1000000, B1000000 },
+  { 1152000, B1152000 },
+  { 1500000, B1500000 },
+  { 2000000, B2000000 },
+  { 2500000, B2500000 },
+  { 3000000, B3000000 },
+  { 3500000, B3500000 },
+  { 4000000, B4000000 },
+} ;
+
+#define	SERIAL_NUM_SPEEDS	(int)(sizeof (serialSpeeds) / sizeof (serialSpeeds [0]))
+
+// Any other rate is set through the kernel's termios2, which takes the
+//	speed in bits per second when the BOTHER speed is selected. glibc
+//	has no declaration of it, so this is the kernel's own layout.
+
+struct serialTermios2
+{
+  tcflag_t c_iflag, c_oflag, c_cflag, c_lflag ;
+  cc_t     c_line ;
+  cc_t     c_cc [19] ;
+  speed_t  c_ispeed, c_ospeed ;
+} ;
+
+#define	SERIAL_TCGETS2	_IOR ('T', 0x2A, struct serialTermios2)
+#define	SERIAL_TCSETS2	_IOW ('T', 0x2B, struct serialTermios2)
+
+#ifndef	BOTHER
+#define	BOTHER		0010000
+#endif
+
+static struct serialPort **serialPorts    = NULL ;
+static int                 serialNumPorts = 0 ;
+
+static pthread_mutex_t serialMutex = PTHREAD_MUTEX_INITIALIZER ;
+
+// Frame reception
+//	Ports handed to serialOnFrame are watched by one epoll thread, which
+//	reads whatever arrives, splits it into frames and runs the callback
+//	for each. Gap framing has a timerfd per port, re-armed on every read,
+//	which fires once the line has been quiet for the gap.
+//	The event lock is held while events are handled, callbacks included,
+//	and is recursive so a callback can (de)register ports.
+
+#define	SERIAL_FRAME_MAX	4096
+
+struct serialListener
+{
+  int           fd, timerFd ;
+  unsigned int  id ;
+  int           type, param ;
+  int64_t       gapNs ;
+  void        (*callback) (int fd, const unsigned char *frame, int len, void *userData) ;
+  void         *userData ;
+  int           len ;
+  int           skip ;			// Left of a length framed frame too big to take
+  uint8_t       buf [SERIAL_FRAME_MAX] ;
+} ;
+
+static struct serialListener **serialListeners    = NULL ;
+static int                     serialNumListeners = 0 ;
+static unsigned int            serialNextId       = 1 ;
+static int                     serialEpollFd      = -1 ;
+
+static pthread_mutex_t serialEventLock ;
+static pthread_once_t  serialEventOnce = PTHREAD_ONCE_INIT ;
+
+
 /*
- * serialOpen:
+ * serialGetPort:
+ *	Return the buffer state of a port, or NULL if it has none
+ *********************************************************************************
+ */
+
+static struct serialPort *serialGetPort (const int fd)
+{
+  struct serialPort *port = NULL ;
+
+  pthread_mutex_lock (&serialMutex) ;
+  if ((fd >= 0) && (fd < serialNumPorts))
+    port = serialPorts [fd] ;
+  pthread_mutex_unlock (&serialMutex) ;
+
+  return port ;
+}
+
+
+/*
+ * serialAddPort: serialRemovePort:
+ *	Give an opened fd its buffer, and take it away again
+ *********************************************************************************
+ */
+
+static int serialAddPort (const int fd, const int baud)
+{
+  struct serialPort *port, **newPorts ;
+  int size ;
+
+  if ((port = calloc (1, sizeof (*port))) == NULL)
+    return -1 ;
+
+  port->baud = baud ;
+  pthread_mutex_init (&port->lock, NULL) ;
+
+  pthread_mutex_lock (&serialMutex) ;
+  if (fd >= serialNumPorts)
+  {
+    size = fd + 8 ;
+    if ((newPorts = realloc (serialPorts, size * sizeof (*serialPorts))) == NULL)
+    {
+      pthread_mutex_unlock (&serialMutex) ;
+      pthread_mutex_destroy (&port->lock) ;
+      free (port) ;
+      return -1 ;
+    }
+    memset (&newPorts [serialNumPorts], 0, (size - serialNumPorts) * sizeof (*serialPorts)) ;
+    serialPorts    = newPorts ;
+    serialNumPorts = size ;
+  }
+  serialPorts [fd] = port ;
+  pthread_mutex_unlock (&serialMutex) ;
+
+  return 0 ;
+}
+
+static void serialRemovePort (const int fd)
+{
+  struct serialPort *port = NULL ;
+
+  pthread_mutex_lock (&serialMutex) ;
+  if ((fd >= 0) && (fd < serialNumPorts))
+  {
+    port = serialPorts [fd] ;
+    serialPorts [fd] = NULL ;
+  }
+  pthread_mutex_unlock (&serialMutex) ;
+
+  if (port != NULL)
+  {
+    pthread_mutex_destroy (&port->lock) ;
+    free (port) ;
+  }
+}
+
+
+/*
+ * serialSetCustomBaud:
+ *	Set a rate that has no Bxxx code. The UART can only divide its clock
+ *	down so far, so the rate the kernel settled on is read back and has
+ *	to be within 2% of the one asked for, about what a receiver at the
+ *	far end will tolerate.
+ *********************************************************************************
+ */
+
+static int serialSetCustomBaud (const int fd, const int baud)
+{
+  struct serialTermios2 tio ;
+
+  if (ioctl (fd, SERIAL_TCGETS2, &tio) < 0)
+    return -1 ;
+
+  tio.c_cflag  &= ~CBAUD ;
+  tio.c_cflag  |= BOTHER ;
+  tio.c_ispeed  = baud ;
+  tio.c_ospeed  = baud ;
+
+  if ((ioctl (fd, SERIAL_TCSETS2, &tio) < 0) || (ioctl (fd, SERIAL_TCGETS2, &tio) < 0))
+    return -1 ;
+
+  if (((long)tio.c_ospeed - baud) * 50 > baud || ((long)baud - tio.c_ospeed) * 50 > baud)
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * serialOpenMode:
  *	Open and initialise the serial port, setting all the right
  *	port parameters - or as many as are required - hopefully!
+ *	The framing is given as data bits, parity and stop bits, e.g. "8N1"
+ *	or "7E2", with parity N(one), E(ven), O(dd), M(ark) or S(pace).
+ *	Any baud rate the UART can get within 2% of may be used, not just
+ *	the standard ones. Returns -2 for a baud rate or framing that can't
+ *	be set.
  *********************************************************************************
  */
 
-int serialOpen (const char *device, const int baud)
+int serialOpenMode (const char *device, const int baud, const char *mode)
 {
   struct termios options ;
   speed_t myBaud ;
-  int     status, fd ;
-
-  switch (baud)
-  {
-    case      50:	myBaud =      B50 ; break ;
-    case      75:	myBaud =      B75 ; break ;
-    case     110:	myBaud =     B110 ; break ;
-    case     134:	myBaud =     B134 ; break ;
-    case     150:	myBaud =     B150 ; break ;
-    case     200:	myBaud =     B200 ; break ;
-    case     300:	myBaud =     B300 ; break ;
-    case     600:	myBaud =     B600 ; break ;
-    case    1200:	myBaud =    B1200 ; break ;
-    case    1800:	myBaud =    B1800 ; break ;
-    case    2400:	myBaud =    B2400 ; break ;
-    case    4800:	myBaud =    B4800 ; break ;
-    case    9600:	myBaud =    B9600 ; break ;
-    case   19200:	myBaud =   B19200 ; break ;
-    case   38400:	myBaud =   B38400 ; break ;
-    case   57600:	myBaud =   B57600 ; break ;
-    case  115200:	myBaud =  B115200 ; break ;
-    case  230400:	myBaud =  B230400 ; break ;
-    case  460800:	myBaud =  B460800 ; break ;
-    case  500000:	myBaud =  B500000 ; break ;
-    case  576000:	myBaud =  B576000 ; break ;
-    case  921600:	myBaud =  B921600 ; break ;
-    case 1000000:	myBaud = B1000000 ; break ;
-    case 1152000:	myBaud = B1152000 ; break ;
-    case 1500000:	myBaud = B1500000 ; break ;
-    case 2000000:	myBaud = B2000000 ; break ;
-    case 2500000:	myBaud = B2500000 ; break ;
-    case 3000000:	myBaud = B3000000 ; break ;
-    case 3500000:	myBaud = B3500000 ; break ;
-    case 4000000:	myBaud = B4000000 ; break ;
+  tcflag_t size, parity, stop ;
+  int     status, fd, i ;
+
+  if ((mode == NULL) || (strlen (mode) != 3))
+    return -2 ;
+
+  switch (mode [0])
+  {
+    case '5':	size = CS5 ; break ;
+    case '6':	size = CS6 ; break ;
+    case '7':	size = CS7 ; break ;
+    case '8':	size = CS8 ; break ;
+    default:
+      return -2 ;
+  }
 
+  switch (mode [1])
+  {
+    case 'N': case 'n':	parity = 0 ;			  break ;
+    case 'E': case 'e':	parity = PARENB ;		  break ;
+    case 'O': case 'o':	parity = PARENB | PARODD ;	  break ;
+    case 'M': case 'm':	parity = PARENB | PARODD | CMSPAR ; break ;
+    case 'S': case 's':	parity = PARENB | CMSPAR ;	  break ;
     default:
       return -2 ;
   }
 
+  switch (mode [2])
+  {
+    case '1':	stop = 0 ;      break ;
+    case '2':	stop = CSTOPB ; break ;
+    default:
+      return -2 ;
+  }
+
+  for (i = 0 ; i < SERIAL_NUM_SPEEDS ; ++i)
+    if (serialSpeeds [i].baud == baud)
+      break ;
+
+  if (baud <= 0)
+    return -2 ;
+
+  myBaud = (i < SERIAL_NUM_SPEEDS) ? serialSpeeds [i].speed : B38400 ;
+
   if ((fd = open (device, O_RDWR | O_NOCTTY | O_NDELAY | O_NONBLOCK)) == -1)
     return -1 ;
 
@@ -99,10 +340,10 @@ int serialOpen (const char *device, const int baud)
     cfsetospeed (&options, myBaud) ;
 
     options.c_cflag |= (CLOCAL | CREAD) ;
-    options.c_cflag &= ~PARENB ;
+    options.c_cflag &= ~(PARENB | PARODD | CMSPAR) ;
     options.c_cflag &= ~CSTOPB ;
     options.c_cflag &= ~CSIZE ;
-    options.c_cflag |= CS8 ;
+    options.c_cflag |= size | parity | stop ;
     options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG) ;
     options.c_oflag &= ~OPOST ;
 
@@ -111,6 +352,12 @@ int serialOpen (const char *device, const int baud)
 
   tcsetattr (fd, TCSANOW, &options) ;
 
+  if ((i == SERIAL_NUM_SPEEDS) && (serialSetCustomBaud (fd, baud) < 0))
+  {
+    close (fd) ;
+    return -2 ;
+  }
+
   ioctl (fd, TIOCMGET, &status);
 
   status |= TIOCM_DTR ;
@@ -120,10 +367,55 @@ int serialOpen (const char *device, const int baud)
 
   usleep (10000) ;	// 10mS
 
+  if (serialAddPort (fd, baud) < 0)
+  {
+    close (fd) ;
+    return -1 ;
+  }
+
   return fd ;
 }
 
 
+/*
+ * serialOpen:
+ *	Open the serial port at 8N1
+ *********************************************************************************
+ */
+
+int serialOpen (const char *device, const int baud)
+{
+  return serialOpenMode (device, baud, "8N1") ;
+}
+
+
+/*
+ * serialSetLowLatency:
+ *	Ask the driver to hand received data up straight away rather than
+ *	batching it, for request/response protocols where the turnaround
+ *	matters more than throughput. On USB adapters such as the FTDI ones
+ *	this takes the latency timer from 16mS down to 1mS. Reads already
+ *	return on the first byte (VMIN is 0), so there is nothing to change
+ *	in the termios settings.
+ *********************************************************************************
+ */
+
+int serialSetLowLatency (const int fd, const int enable)
+{
+  struct serial_struct serial ;
+
+  if (ioctl (fd, TIOCGSERIAL, &serial) < 0)
+    return -1 ;
+
+  if (enable)
+    serial.flags |=  ASYNC_LOW_LATENCY ;
+  else
+    serial.flags &= ~ASYNC_LOW_LATENCY ;
+
+  return ioctl (fd, TIOCSSERIAL, &serial) ;
+}
+
+
 /*
  * serialFlush:
  *	Flush the serial buffers (both tx & rx)
@@ -132,6 +424,15 @@ int serialOpen (const char *device, const int baud)
 
 void serialFlush (const int fd)
 {
+  struct serialPort *port ;
+
+  if ((port = serialGetPort (fd)) != NULL)
+  {
+    pthread_mutex_lock (&port->lock) ;
+    port->head = port->tail = 0 ;
+    pthread_mutex_unlock (&port->lock) ;
+  }
+
   tcflush (fd, TCIOFLUSH) ;
 }
 
@@ -144,10 +445,48 @@ void serialFlush (const int fd)
 
 void serialClose (const int fd)
 {
+  serialOnFrameCancel (fd) ;
+  serialRemovePort (fd) ;
   close (fd) ;
 }
 
 
+/*
+ * serialWrite:
+ *	Send a block of data, all of it, in as few system calls as the
+ *	driver allows. Returns the number of bytes sent, or -1.
+ *********************************************************************************
+ */
+
+int serialWrite (const int fd, const void *buf, int len)
+{
+  const uint8_t *p = (const uint8_t *)buf ;
+  struct pollfd pfd ;
+  int done = 0, n ;
+
+  while (done < len)
+  {
+    if ((n = write (fd, p + done, len - done)) >= 0)
+    {
+      done += n ;
+      continue ;
+    }
+
+    if (errno == EINTR)
+      continue ;
+    if (errno != EAGAIN)
+      return -1 ;
+
+    pfd.fd     = fd ;
+    pfd.events = POLLOUT ;
+    if ((poll (&pfd, 1, -1) < 0) && (errno != EINTR))
+      return -1 ;
+  }
+
+  return done ;
+}
+
+
 /*
  * serialPutchar:
  *	Send a single character to the serial port
@@ -156,7 +495,7 @@ void serialClose (const int fd)
 
 void serialPutchar (const int fd, const unsigned char c)
 {
-  if (write(fd, &c, 1) < 0)
+  if (serialWrite (fd, &c, 1) < 0)
     fprintf(stderr, "Unable to send to the opened serial device: %s \n", strerror(errno));
 }
 
@@ -169,26 +508,51 @@ void serialPutchar (const int fd, const unsigned char c)
 
 void serialPuts (const int fd, const char *s)
 {
-  if (write(fd, s, strlen(s)) < 0)
+  if (serialWrite (fd, s, strlen(s)) < 0)
     fprintf(stderr, "Unable to send to the opened serial device: %s \n", strerror(errno));
 }
 
 /*
  * serialPrintf:
  *	Printf over Serial
+ *	Short messages are formatted on the stack, longer ones on the heap,
+ *	so there's no limit on the length.
  *********************************************************************************
  */
 
 void serialPrintf (const int fd, const char *message, ...)
 {
   va_list argp ;
-  char buffer [1024] ;
+  char buffer [256], *p = buffer ;
+  int len ;
 
   va_start (argp, message) ;
-    vsnprintf (buffer, 1023, message, argp) ;
+    len = vsnprintf (buffer, sizeof (buffer), message, argp) ;
   va_end (argp) ;
 
-  serialPuts (fd, buffer) ;
+  if (len < 0)
+    return ;
+
+  if (len >= (int)sizeof (buffer))
+  {
+    if ((p = malloc (len + 1)) == NULL)
+    {
+      p   = buffer ;			// Send what fitted
+      len = sizeof (buffer) - 1 ;
+    }
+    else
+    {
+      va_start (argp, message) ;
+	vsnprintf (p, len + 1, message, argp) ;
+      va_end (argp) ;
+    }
+  }
+
+  if (serialWrite (fd, p, len) < 0)
+    fprintf(stderr, "Unable to send to the opened serial device: %s \n", strerror(errno));
+
+  if (p != buffer)
+    free (p) ;
 }
 
 
@@ -200,12 +564,20 @@ void serialPrintf (const int fd, const char *message, ...)
 
 int serialDataAvail (const int fd)
 {
-  int result ;
+  struct serialPort *port ;
+  int result, buffered = 0 ;
 
   if (ioctl (fd, FIONREAD, &result) == -1)
     return -1 ;
 
-  return result ;
+  if ((port = serialGetPort (fd)) != NULL)
+  {
+    pthread_mutex_lock (&port->lock) ;
+    buffered = port->tail - port->head ;
+    pthread_mutex_unlock (&port->lock) ;
+  }
+
+  return result + buffered ;
 }
 
 
@@ -214,15 +586,518 @@ int serialDataAvail (const int fd)
  *	Get a single character from the serial device.
  *	Note: Zero is a valid character and this function will time-out after
  *	10 seconds.
+ *	Whatever else has arrived is read along with it and kept for later.
  *********************************************************************************
  */
 
 int serialGetchar (const int fd)
 {
+  struct serialPort *port ;
   uint8_t x ;
+  int n ;
 
-  if (read (fd, &x, 1) != 1)
-    return -1 ;
+  if ((port = serialGetPort (fd)) == NULL)
+  {
+    if (read (fd, &x, 1) != 1)
+      return -1 ;
+
+    return ((int)x) & 0xFF ;
+  }
+
+  pthread_mutex_lock (&port->lock) ;
+
+  if (port->head == port->tail)
+  {
+    port->head = port->tail = 0 ;
+    if ((n = read (fd, port->buf, SERIAL_RX_SIZE)) <= 0)
+    {
+      pthread_mutex_unlock (&port->lock) ;
+      return -1 ;
+    }
+    port->tail = n ;
+  }
+
+  x = port->buf [port->head++] ;
+
+  pthread_mutex_unlock (&port->lock) ;
 
   return ((int)x) & 0xFF ;
 }
+
+
+/*
+ * serialRead:
+ *	Read len bytes, waiting up to timeout mS in all for them (0 to take
+ *	only what has already arrived, -1 to wait for ever). Returns the
+ *	number of bytes read, which is short if the time ran out, or -1.
+ *	Data goes straight into buf, anything that arrived beyond what was
+ *	asked for is kept in the port's buffer from the same read.
+ *********************************************************************************
+ */
+
+int serialRead (const int fd, void *buf, int len, int timeout)
+{
+  struct serialPort *port ;
+  struct pollfd pfd ;
+  struct iovec iov [2] ;
+  struct timespec start, now ;
+  uint8_t *p = (uint8_t *)buf ;
+  int done = 0, n, wait ;
+
+  if (len <= 0)
+    return 0 ;
+
+  port = serialGetPort (fd) ;
+  if (port != NULL)
+    pthread_mutex_lock (&port->lock) ;
+
+  if ((port != NULL) && (port->head != port->tail))
+  {
+    done = port->tail - port->head ;
+    if (done > len)
+      done = len ;
+    memcpy (p, port->buf + port->head, done) ;
+    port->head += done ;
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &start) ;
+
+  while (done < len)
+  {
+    wait = timeout ;
+    if (timeout > 0)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &now) ;
+      wait = timeout - (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000) ;
+      if (wait < 0)
+	wait = 0 ;
+    }
+
+    pfd.fd     = fd ;
+    pfd.events = POLLIN ;
+    if ((n = poll (&pfd, 1, wait)) < 0)
+    {
+      if (errno == EINTR)
+	continue ;
+      done = (done > 0) ? done : -1 ;
+      break ;
+    }
+    if (n == 0)
+      break ;
+
+    iov [0].iov_base = p + done ;
+    iov [0].iov_len  = len - done ;
+
+    if (port != NULL)
+    {
+      port->head = port->tail = 0 ;
+      iov [1].iov_base = port->buf ;
+      iov [1].iov_len  = SERIAL_RX_SIZE ;
+    }
+
+    if ((n = readv (fd, iov, (port != NULL) ? 2 : 1)) < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+	continue ;
+      done = (done > 0) ? done : -1 ;
+      break ;
+    }
+    if (n == 0)
+      break ;
+
+    if (n > len - done)
+    {
+      port->tail = n - (len - done) ;
+      n = len - done ;
+    }
+    done += n ;
+  }
+
+  if (port != NULL)
+    pthread_mutex_unlock (&port->lock) ;
+
+  return done ;
+}
+
+
+/*
+ * serialListenerFind:
+ *	The listener on a port, if it is still the registration with this
+ *	id. Called with the event lock held.
+ *********************************************************************************
+ */
+
+static struct serialListener *serialListenerFind (const int fd, unsigned int id)
+{
+  struct serialListener *l ;
+
+  if ((fd < 0) || (fd >= serialNumListeners) || ((l = serialListeners [fd]) == NULL) || (l->id != id))
+    return NULL ;
+
+  return l ;
+}
+
+
+/*
+ * serialDeliver:
+ *	Run the callback for a frame and say whether the listener survived it
+ *********************************************************************************
+ */
+
+static int serialDeliver (struct serialListener *l, const uint8_t *frame, int len)
+{
+  int          fd = l->fd ;
+  unsigned int id = l->id ;
+
+  l->callback (fd, frame, len, l->userData) ;
+
+  return serialListenerFind (fd, id) != NULL ;
+}
+
+
+/*
+ * serialFeed:
+ *	Run newly received data through a port's framer. A delimited or gap
+ *	framed frame that outgrows SERIAL_FRAME_MAX is handed over in pieces
+ *	of that size; a length framed one that won't fit is dropped, its
+ *	payload skipped so the next length is read from the right place.
+ *********************************************************************************
+ */
+
+static void serialFeed (struct serialListener *l, const uint8_t *data, int n)
+{
+  struct itimerspec its ;
+  int i, len, need ;
+
+  for (i = 0 ; i < n ; ++i)
+  {
+    if (l->skip > 0)
+    {
+      --l->skip ;
+      continue ;
+    }
+
+    if ((l->type == SERIAL_FRAME_DELIM) && (data [i] == l->param))
+    {
+      len    = l->len ;
+      l->len = 0 ;
+      if (!serialDeliver (l, l->buf, len))
+	return ;
+      continue ;
+    }
+
+    if (l->len == SERIAL_FRAME_MAX)
+    {
+      l->len = 0 ;
+      if (!serialDeliver (l, l->buf, SERIAL_FRAME_MAX))
+	return ;
+    }
+    l->buf [l->len++] = data [i] ;
+
+    if ((l->type == SERIAL_FRAME_LENGTH) && (l->len >= l->param))
+    {
+      need = (l->param == 1) ? l->buf [0] : (l->buf [0] << 8) | l->buf [1] ;
+      if (l->param + need > SERIAL_FRAME_MAX)
+      {
+	l->len  = 0 ;
+	l->skip = need ;
+      }
+      else if (l->len == l->param + need)
+      {
+	l->len = 0 ;
+	if (!serialDeliver (l, l->buf + l->param, need))
+	  return ;
+      }
+    }
+  }
+
+  if ((l->type == SERIAL_FRAME_GAP) && (l->len > 0))
+  {
+    memset (&its, 0, sizeof (its)) ;
+    its.it_value.tv_sec  = l->gapNs / 1000000000L ;
+    its.it_value.tv_nsec = l->gapNs % 1000000000L ;
+    timerfd_settime (l->timerFd, 0, &its, NULL) ;
+  }
+}
+
+
+/*
+ * serialEventThread:
+ *	Wait for data and gap timers on all the registered ports
+ *********************************************************************************
+ */
+
+static void *serialEventThread (void *arg)
+{
+  struct epoll_event     events [16] ;
+  struct serialListener *l ;
+  uint8_t                data [SERIAL_RX_SIZE] ;
+  uint64_t               key, expiries ;
+  int i, n, len, fd ;
+
+  (void)arg ;
+
+  for (;;)
+  {
+    if ((n = epoll_wait (serialEpollFd, events, 16, -1)) < 0)
+    {
+      if (errno == EINTR)
+	continue ;
+      break ;
+    }
+
+    pthread_mutex_lock (&serialEventLock) ;
+
+    for (i = 0 ; i < n ; ++i)
+    {
+      key = events [i].data.u64 ;
+      fd  = key & 0x7FFFFFFF ;
+      if ((l = serialListenerFind (fd, (unsigned int)(key >> 32))) == NULL)
+	continue ;
+
+      if (key & 0x80000000)		// Gap timer
+      {
+	if ((read (l->timerFd, &expiries, sizeof (expiries)) > 0) && (l->len > 0))
+	{
+	  len    = l->len ;
+	  l->len = 0 ;
+	  serialDeliver (l, l->buf, len) ;
+	}
+	continue ;
+      }
+
+      if ((len = read (fd, data, sizeof (data))) > 0)
+	serialFeed (l, data, len) ;
+      else if ((len == 0) || ((errno != EAGAIN) && (errno != EINTR)))
+      {
+	if (serialDeliver (l, NULL, -1))
+	  serialOnFrameCancel (fd) ;
+      }
+    }
+
+    pthread_mutex_unlock (&serialEventLock) ;
+  }
+
+  return NULL ;
+}
+
+
+/*
+ * serialEventInit:
+ *	Start the event thread, once
+ *********************************************************************************
+ */
+
+static void serialEventInit (void)
+{
+  pthread_mutexattr_t attr ;
+  pthread_t thread ;
+
+  pthread_mutexattr_init    (&attr) ;
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE) ;
+  pthread_mutex_init        (&serialEventLock, &attr) ;
+  pthread_mutexattr_destroy (&attr) ;
+
+  if ((serialEpollFd = epoll_create1 (EPOLL_CLOEXEC)) < 0)
+    return ;
+
+  if (pthread_create (&thread, NULL, serialEventThread, NULL) != 0)
+  {
+    close (serialEpollFd) ;
+    serialEpollFd = -1 ;
+    return ;
+  }
+
+  pthread_detach (thread) ;
+}
+
+
+/*
+ * serialGapNs:
+ *	Modbus RTU's frame gap of 3.5 character times at the port's current
+ *	speed and framing, or the fixed 1750uS it uses above 19200 baud.
+ *********************************************************************************
+ */
+
+static int64_t serialGapNs (const int fd)
+{
+  struct serialPort *port ;
+  struct termios options ;
+  int baud, bits ;
+
+  if (((port = serialGetPort (fd)) == NULL) || (tcgetattr (fd, &options) < 0))
+    return 1750000 ;
+
+  baud = port->baud ;
+  if (baud > 19200)
+    return 1750000 ;
+
+  switch (options.c_cflag & CSIZE)
+  {
+    case CS5:	bits = 5 ; break ;
+    case CS6:	bits = 6 ; break ;
+    case CS7:	bits = 7 ; break ;
+    default:	bits = 8 ; break ;
+  }
+  bits += 1 + ((options.c_cflag & PARENB) ? 1 : 0) + ((options.c_cflag & CSTOPB) ? 2 : 1) ;
+
+  return (int64_t)bits * 35 * 100000000 / baud ;	// Well past 32 bits on the way
+}
+
+
+/*
+ * serialOnFrame:
+ *	Have callback run, on the library's event thread, for every frame
+ *	received on the port, instead of polling for data:
+ *	  SERIAL_FRAME_DELIM	frames end with the byte param, which is
+ *				not passed on
+ *	  SERIAL_FRAME_LENGTH	frames start with a param (1 or 2) byte,
+ *				big-endian count of the bytes that follow,
+ *				and only those are passed on; frames of
+ *				more than 4KB are dropped
+ *	  SERIAL_FRAME_GAP	frames end when the line is quiet for param
+ *				uS, or 0 for the Modbus RTU 3.5 characters
+ *	The callback gets a NULL frame and a len of -1 if the port fails,
+ *	after which it is dropped. Data already buffered by serialGetchar
+ *	or serialRead is framed straight away, on the calling thread.
+ *	Registering a port again replaces the old callback.
+ *********************************************************************************
+ */
+
+int serialOnFrame (const int fd, int type, int param,
+	void (*callback)(int fd, const unsigned char *frame, int len, void *userData), void *userData)
+{
+  struct serialListener *l, **newListeners ;
+  struct serialPort     *port ;
+  struct epoll_event     ev ;
+  int size ;
+
+  if ((fd < 0) || (callback == NULL) ||
+      ((type == SERIAL_FRAME_DELIM)  && ((param < 0) || (param > 255))) ||
+      ((type == SERIAL_FRAME_LENGTH) && (param != 1) && (param != 2)) ||
+      ((type == SERIAL_FRAME_GAP)    && (param < 0)) ||
+      ((type != SERIAL_FRAME_DELIM) && (type != SERIAL_FRAME_LENGTH) && (type != SERIAL_FRAME_GAP)))
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  pthread_once (&serialEventOnce, serialEventInit) ;
+  if (serialEpollFd < 0)
+    return -1 ;
+
+  if ((l = calloc (1, sizeof (*l))) == NULL)
+    return -1 ;
+
+  l->fd       = fd ;
+  l->timerFd  = -1 ;
+  l->type     = type ;
+  l->param    = param ;
+  l->callback = callback ;
+  l->userData = userData ;
+
+  if (type == SERIAL_FRAME_GAP)
+  {
+    l->gapNs = (param > 0) ? (int64_t)param * 1000 : serialGapNs (fd) ;
+    if ((l->timerFd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    {
+      free (l) ;
+      return -1 ;
+    }
+  }
+
+  pthread_mutex_lock (&serialEventLock) ;
+
+  serialOnFrameCancel (fd) ;
+
+  if (fd >= serialNumListeners)
+  {
+    size = fd + 8 ;
+    if ((newListeners = realloc (serialListeners, size * sizeof (*serialListeners))) == NULL)
+    {
+      pthread_mutex_unlock (&serialEventLock) ;
+      if (l->timerFd >= 0)
+	close (l->timerFd) ;
+      free (l) ;
+      return -1 ;
+    }
+    memset (&newListeners [serialNumListeners], 0, (size - serialNumListeners) * sizeof (*serialListeners)) ;
+    serialListeners    = newListeners ;
+    serialNumListeners = size ;
+  }
+
+  l->id = serialNextId++ ;
+
+  memset (&ev, 0, sizeof (ev)) ;
+  ev.events   = EPOLLIN ;
+  ev.data.u64 = ((uint64_t)l->id << 32) | (uint32_t)fd ;
+  if (epoll_ctl (serialEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+  {
+    pthread_mutex_unlock (&serialEventLock) ;
+    if (l->timerFd >= 0)
+      close (l->timerFd) ;
+    free (l) ;
+    return -1 ;
+  }
+
+  if (l->timerFd >= 0)
+  {
+    ev.data.u64 |= 0x80000000 ;
+    epoll_ctl (serialEpollFd, EPOLL_CTL_ADD, l->timerFd, &ev) ;
+  }
+
+  serialListeners [fd] = l ;
+
+  if ((port = serialGetPort (fd)) != NULL)
+  {
+    pthread_mutex_lock (&port->lock) ;
+    size       = port->tail - port->head ;
+    port->tail = port->head ;
+    pthread_mutex_unlock (&port->lock) ;
+
+    if (size > 0)
+      serialFeed (l, port->buf + port->head, size) ;
+  }
+
+  pthread_mutex_unlock (&serialEventLock) ;
+
+  return 0 ;
+}
+
+
+/*
+ * serialOnFrameCancel:
+ *	Stop watching a port. Once this returns the callback is not running
+ *	and won't be called again, unless it is the callback cancelling.
+ *********************************************************************************
+ */
+
+int serialOnFrameCancel (const int fd)
+{
+  struct serialListener *l ;
+
+  if ((fd < 0) || (serialEpollFd < 0))
+    return -1 ;
+
+  pthread_mutex_lock (&serialEventLock) ;
+
+  if ((fd >= serialNumListeners) || ((l = serialListeners [fd]) == NULL))
+  {
+    pthread_mutex_unlock (&serialEventLock) ;
+    return -1 ;
+  }
+
+  serialListeners [fd] = NULL ;
+  epoll_ctl (serialEpollFd, EPOLL_CTL_DEL, fd, NULL) ;
+  if (l->timerFd >= 0)
+  {
+    epoll_ctl (serialEpollFd, EPOLL_CTL_DEL, l->timerFd, NULL) ;
+    close (l->timerFd) ;
+  }
+
+  pthread_mutex_unlock (&serialEventLock) ;
+
+  free (l) ;
+
+  return 0 ;
+}
@@ -24,7 +24,15 @@
 extern "C" {
 #endif
 
+// Framing for serialOnFrame
+
+#define	SERIAL_FRAME_DELIM	0
+#define	SERIAL_FRAME_LENGTH	1
+#define	SERIAL_FRAME_GAP	2
+
 extern int   serialOpen      (const char *device, const int baud) ;
+extern int   serialOpenMode  (const char *device, const int baud, const char *mode) ;
+extern int   serialSetLowLatency (const int fd, const int enable) ;
 extern void  serialClose     (const int fd) ;
 extern void  serialFlush     (const int fd) ;
 extern void  serialPutchar   (const int fd, const unsigned char c) ;
@@ -32,6 +40,12 @@ extern void  serialPuts      (const int fd, const char *s) ;
 extern void  serialPrintf    (const int fd, const char *message, ...) ;
 extern int   serialDataAvail (const int fd) ;
 extern int   serialGetchar   (const int fd) ;
+extern int   serialRead      (const int fd, void *buf, int len, int timeout) ;
+extern int   serialWrite     (const int fd, const void *buf, int len) ;
+
+extern int   serialOnFrame   (const int fd, int type, int param,
+		void (*callback)(int fd, const unsigned char *frame, int len, void *userData), void *userData) ;
+extern int   serialOnFrameCancel (const int fd) ;
 
 #ifdef __cplusplus
 }
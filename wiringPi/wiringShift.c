@@ -23,61 +23,184 @@
  */
 
 #include <stdint.h>
+#include <errno.h>
+#include <time.h>
 
 #include "wiringPi.h"
 #include "wiringShift.h"
 
+
 /*
- * shiftIn:
- *	Shift data in from a clocked source
+ * wiringShiftSetup:
+ *	Resolve the data and clock pins once and work out the delay needed
+ *	for each half of the clock to run at clockHz. The time a pin write
+ *	takes is measured here and allowed for, so the delay is only what
+ *	the pins themselves don't already use up. clockHz of 0 means as
+ *	fast as the pins will go, as shiftIn() and shiftOut() always have.
+ *	Calibrating drives the clock pin low, so set the pin modes first.
+ *	Fails with ENODEV if either pin can't be found.
  *********************************************************************************
  */
 
-uint8_t shiftIn (uint8_t dPin, uint8_t cPin, uint8_t order)
+int wiringShiftSetup (struct wiringShiftStruct *shift, int dPin, int cPin, int order, int clockHz)
 {
-  uint8_t value = 0 ;
-  int8_t  i ;
- 
-  if (order == MSBFIRST)
-    for (i = 7 ; i >= 0 ; --i)
-    {
-      digitalWrite (cPin, HIGH) ;
-      value |= digitalRead (dPin) << i ;
-      digitalWrite (cPin, LOW) ;
-    }
-  else
-    for (i = 0 ; i < 8 ; ++i)
-    {
-      digitalWrite (cPin, HIGH) ;
-      value |= digitalRead (dPin) << i ;
-      digitalWrite (cPin, LOW) ;
-    }
-
-  return value;
+  struct timespec start, end ;
+  long halfNs, writeNs ;
+  int i ;
+
+  if ((wiringPiPinResolve (dPin, &shift->data)  < 0) ||
+      (wiringPiPinResolve (cPin, &shift->clock) < 0))
+  {
+    errno = ENODEV ;
+    return -1 ;
+  }
+
+  shift->order   = order ;
+  shift->delayNs = 0 ;
+
+  if (clockHz <= 0)
+    return 0 ;
+
+  clock_gettime (CLOCK_MONOTONIC, &start) ;
+  for (i = 0 ; i < 64 ; ++i)
+    wiringPiPinWrite (&shift->clock, LOW) ;
+  clock_gettime (CLOCK_MONOTONIC, &end) ;
+
+  writeNs = ((end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec)) / 64 ;
+  halfNs  = 500000000L / clockHz ;
+
+  shift->delayNs = (halfNs > writeNs) ? halfNs - writeNs : 0 ;
+
+  return 0 ;
 }
 
+
 /*
- * shiftOut:
- *	Shift data out to a clocked source
+ * wiringShiftOut: wiringShiftIn:
+ *	Shift 1 to 32 bits of a word out or in, in the handle's bit order.
+ *	Data is set up before the rising edge of the clock and read after it.
+ *	Any other number of bits is EINVAL, and nothing is clocked.
  *********************************************************************************
  */
 
-void shiftOut (uint8_t dPin, uint8_t cPin, uint8_t order, uint8_t val)
+int wiringShiftOut (const struct wiringShiftStruct *shift, unsigned int value, int bits)
+{
+  int i, bit ;
+
+  if ((bits < 1) || (bits > 32))
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  for (i = 0 ; i < bits ; ++i)
+  {
+    bit = (shift->order == MSBFIRST) ? bits - 1 - i : i ;
+
+    wiringPiPinWrite (&shift->data, (value >> bit) & 1) ;
+    delayNanoseconds (shift->delayNs) ;
+    wiringPiPinWrite (&shift->clock, HIGH) ;
+    delayNanoseconds (shift->delayNs) ;
+    wiringPiPinWrite (&shift->clock, LOW) ;
+  }
+
+  return 0 ;
+}
+
+int wiringShiftIn (const struct wiringShiftStruct *shift, unsigned int *value, int bits)
 {
-  int8_t i;
-
-  if (order == MSBFIRST)
-    for (i = 7 ; i >= 0 ; --i)
-    {
-      digitalWrite (dPin, val & (1 << i)) ;
-      digitalWrite (cPin, HIGH) ;
-      digitalWrite (cPin, LOW) ;
-    }
-  else
-    for (i = 0 ; i < 8 ; ++i)
-    {
-      digitalWrite (dPin, val & (1 << i)) ;
-      digitalWrite (cPin, HIGH) ;
-      digitalWrite (cPin, LOW) ;
-    }
+  int i, bit ;
+
+  if ((bits < 1) || (bits > 32))
+  {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  *value = 0 ;
+
+  for (i = 0 ; i < bits ; ++i)
+  {
+    bit = (shift->order == MSBFIRST) ? bits - 1 - i : i ;
+
+    wiringPiPinWrite (&shift->clock, HIGH) ;
+    delayNanoseconds (shift->delayNs) ;
+    if (wiringPiPinRead (&shift->data) == HIGH)
+      *value |= 1u << bit ;
+    wiringPiPinWrite (&shift->clock, LOW) ;
+    delayNanoseconds (shift->delayNs) ;
+  }
+
+  return 0 ;
 }
+
+
+/*
+ * wiringShiftOutBuf: wiringShiftInBuf:
+ *	A buffer of bytes, first byte first, each in the handle's bit order
+ *********************************************************************************
+ */
+
+void wiringShiftOutBuf (const struct wiringShiftStruct *shift, const uint8_t *buf, int len)
+{
+  while (len-- > 0)
+    (void)wiringShiftOut (shift, *buf++, 8) ;
+}
+
+void wiringShiftInBuf (const struct wiringShiftStruct *shift, uint8_t *buf, int len)
+{
+  unsigned int value ;
+
+  while (len-- > 0)
+  {
+    (void)wiringShiftIn (shift, &value, 8) ;
+    *buf++ = value ;
+  }
+}
+
+
+/*
+ * shiftIn: shiftIn16: shiftIn32:
+ *	Shift data in from a clocked source. There's no room in the value
+ *	for an error, so pins that can't be found read as 0, with errno set
+ *	to ENODEV; wiringShiftSetup() says so up front.
+ *********************************************************************************
+ */
+
+static unsigned int shiftInBits (uint8_t dPin, uint8_t cPin, uint8_t order, int bits)
+{
+  struct wiringShiftStruct shift ;
+  unsigned int value ;
+
+  if ((wiringShiftSetup (&shift, dPin, cPin, order, 0) < 0) ||
+      (wiringShiftIn (&shift, &value, bits) < 0))
+    return 0 ;
+
+  return value ;
+}
+
+uint8_t  shiftIn   (uint8_t dPin, uint8_t cPin, uint8_t order) { return shiftInBits (dPin, cPin, order, 8) ; }
+uint16_t shiftIn16 (uint8_t dPin, uint8_t cPin, uint8_t order) { return shiftInBits (dPin, cPin, order, 16) ; }
+uint32_t shiftIn32 (uint8_t dPin, uint8_t cPin, uint8_t order) { return shiftInBits (dPin, cPin, order, 32) ; }
+
+
+/*
+ * shiftOut: shiftOut16: shiftOut32:
+ *	Shift data out to a clocked source. Nothing is sent to pins that
+ *	can't be found, and errno is set to ENODEV.
+ *********************************************************************************
+ */
+
+static void shiftOutBits (uint8_t dPin, uint8_t cPin, uint8_t order, uint32_t val, int bits)
+{
+  struct wiringShiftStruct shift ;
+
+  if (wiringShiftSetup (&shift, dPin, cPin, order, 0) < 0)
+    return ;
+
+  (void)wiringShiftOut (&shift, val, bits) ;
+}
+
+void shiftOut   (uint8_t dPin, uint8_t cPin, uint8_t order, uint8_t  val) { shiftOutBits (dPin, cPin, order, val, 8) ; }
+void shiftOut16 (uint8_t dPin, uint8_t cPin, uint8_t order, uint16_t val) { shiftOutBits (dPin, cPin, order, val, 16) ; }
+void shiftOut32 (uint8_t dPin, uint8_t cPin, uint8_t order, uint32_t val) { shiftOutBits (dPin, cPin, order, val, 32) ; }
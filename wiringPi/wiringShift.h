@@ -29,12 +29,34 @@
 #  include <stdint.h>
 #endif
 
+#include "wiringPi.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-extern uint8_t shiftIn      (uint8_t dPin, uint8_t cPin, uint8_t order) ;
-extern void    shiftOut     (uint8_t dPin, uint8_t cPin, uint8_t order, uint8_t val) ;
+// A pair of pins resolved once, see wiringShiftSetup()
+
+struct wiringShiftStruct
+{
+  struct wiringPiPinStruct data ;
+  struct wiringPiPinStruct clock ;
+  int  order ;
+  unsigned int delayNs ;	// Each half clock, on top of the pin writes
+} ;
+
+extern uint8_t  shiftIn      (uint8_t dPin, uint8_t cPin, uint8_t order) ;
+extern uint16_t shiftIn16    (uint8_t dPin, uint8_t cPin, uint8_t order) ;
+extern uint32_t shiftIn32    (uint8_t dPin, uint8_t cPin, uint8_t order) ;
+extern void     shiftOut     (uint8_t dPin, uint8_t cPin, uint8_t order, uint8_t  val) ;
+extern void     shiftOut16   (uint8_t dPin, uint8_t cPin, uint8_t order, uint16_t val) ;
+extern void     shiftOut32   (uint8_t dPin, uint8_t cPin, uint8_t order, uint32_t val) ;
+
+extern int          wiringShiftSetup  (struct wiringShiftStruct *shift, int dPin, int cPin, int order, int clockHz) ;
+extern int          wiringShiftOut    (const struct wiringShiftStruct *shift, unsigned int value, int bits) ;
+extern int          wiringShiftIn     (const struct wiringShiftStruct *shift, unsigned int *value, int bits) ;
+extern void         wiringShiftOutBuf (const struct wiringShiftStruct *shift, const uint8_t *buf, int len) ;
+extern void         wiringShiftInBuf  (const struct wiringShiftStruct *shift, uint8_t *buf, int len) ;
 
 #ifdef __cplusplus
 }
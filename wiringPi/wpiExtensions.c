@@ -726,13 +726,15 @@ static int doExtensionMcp3422 (char *progName, int pinBase, char *params)
 
 
 /*
- * doExtensionDrcS:
- *	Interface to a DRC Serial system
+ * doExtensionDrcS: doExtensionDrcF:
+ *	Interface to a DRC Serial system, talking the plain or the framed
+ *	protocol
  *	drcs:base:pins:serialPort:baud
+ *	drcf:base:pins:serialPort:baud
  *********************************************************************************
  */
 
-static int doExtensionDrcS (char *progName, int pinBase, char *params)
+static int drcSerialExtension (char *progName, int pinBase, char *params, int framed)
 {
   char *port ;
   int pins, baud ;
@@ -764,11 +766,24 @@ static int doExtensionDrcS (char *progName, int pinBase, char *params)
     return FALSE ;
   }
 
-  drcSetupSerial (pinBase, pins, port, baud) ;
+  if (framed)
+    drcSetupSerialFramed (pinBase, pins, port, baud) ;
+  else
+    drcSetupSerial (pinBase, pins, port, baud) ;
 
   return TRUE ;
 }
 
+static int doExtensionDrcS (char *progName, int pinBase, char *params)
+{
+  return drcSerialExtension (progName, pinBase, params, FALSE) ;
+}
+
+static int doExtensionDrcF (char *progName, int pinBase, char *params)
+{
+  return drcSerialExtension (progName, pinBase, params, TRUE) ;
+}
+
 
 /*
  * doExtensionDrcNet:
@@ -853,6 +868,7 @@ static struct extensionFunctionStruct extensionFunctions [] =
   { "max5322",		&doExtensionMax5322	},
   { "sn3218",		&doExtensionSn3218	},
   { "drcs",		&doExtensionDrcS	},
+  { "drcf",		&doExtensionDrcF	},
   { "drcn",		&doExtensionDrcNet	},
   { NULL,		NULL		 	},
 } ;
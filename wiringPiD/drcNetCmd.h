@@ -34,6 +34,46 @@
 #define	DRCN_DIGITAL_READ8	8
 #define	DRCN_ANALOG_READ	9
 
+#define	DRCN_DIGITAL_WRITE16	10
+#define	DRCN_DIGITAL_WRITE32	11
+#define	DRCN_DIGITAL_READ16	12
+#define	DRCN_DIGITAL_READ32	13
+
+// Edge notifications: DRCN_SUBSCRIBE asks for a local pin's edges, with
+//	data INT_EDGE_FALLING, _RISING or _BOTH, and is answered with data 0,
+//	or -1 if the pin can't be watched. From then on the daemon sends,
+//	unasked, DRCN_EDGE_RISING or DRCN_EDGE_FALLING with the pin and its
+//	micros() time as data.
+
+#define	DRCN_SUBSCRIBE		14
+#define	DRCN_UNSUBSCRIBE	15
+#define	DRCN_EDGE_RISING	16
+#define	DRCN_EDGE_FALLING	17
+
+// Local clients, on the UNIX socket, can also pass the daemon a shared
+//	memory ring (a memfd, sent with DRCN_RING) to put writes on without
+//	a system call each. The daemon runs what is on it before any command
+//	from the socket, so the order holds, and when it has run dry it sets
+//	sleeping and waits for a DRCN_RING_KICK.
+
+#define	DRCN_RING		18
+#define	DRCN_RING_KICK		19
+
+#define	DEFAULT_SERVER_SOCKET	"/var/run/wiringPiD.sock"
+
+// Protocol 2, advertised in the greeting: the daemon takes commands in
+//	batches and replies to them in batches, and doesn't reply at all to
+//	a command flagged DRCN_NO_REPLY.
+//
+// Protocol 3: a command can carry a sequence number in the DRCN_SEQ_MASK
+//	bits, which the daemon leaves alone and so sends back in the reply,
+//	for clients with many commands out at once to match them up.
+
+#define	DRCN_PROTOCOL		3
+#define	DRCN_NO_REPLY		0x80000000
+#define	DRCN_SEQ_MASK		0x7FFF0000
+#define	DRCN_SEQ_SHIFT		16
+#define	DRCN_CMD_MASK		0x0000FFFF
 
 extern struct drcNetComStruct
 {
@@ -42,3 +82,13 @@ extern struct drcNetComStruct
   uint32_t data ;
 } comDat ;
 
+#define	DRCN_RING_SIZE		4096		// Commands; a power of 2
+
+struct drcNetRingStruct
+{
+  volatile uint32_t head ;			// Moved on by the client
+  volatile uint32_t tail ;			//  and by the daemon
+  volatile uint32_t sleeping ;
+  struct drcNetComStruct cmds [DRCN_RING_SIZE] ;
+} ;
+
@@ -21,32 +21,46 @@
  ***********************************************************************
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdarg.h>
 #include <malloc.h>
+#include <errno.h>
+#include <grp.h>
 
 #include <fcntl.h>
 #include <crypt.h>
 
 #include "network.h"
+#include "drcNetCmd.h"
 
 #define	TRUE	(1==1)
 #define	FALSE	(!TRUE)
 
 // Local data
 
-#define	SALT_LEN	16
-
-static char salt [SALT_LEN + 1] ;
-static char *returnedHash = NULL ;
 static int serverFd = -1 ;
 
+// The UNIX socket, and the group, besides root and us, let in on it
+
+static int   localFd    = -1 ;
+static char *localPath  = NULL ;
+static gid_t localGroup = (gid_t)-1 ;
+
 // Union for the server Socket Address
 
 static union
@@ -57,61 +71,61 @@ static union
 
 // and client address
 
-static union
+union clientSockAddr
 {
   struct sockaddr_in  sin ;
   struct sockaddr_in6 sin6 ;
-} clientSockAddr ;
+} ;
 
 
 /*
- * getClientIP:
- *	Returns a pointer to a static string containing the clients IP address
+ * setClientIP:
+ *	Put a printable version of the clients IP address into the client
  *********************************************************************************
  */
 
-char *getClientIP (void)
+static void setClientIP (struct clientStruct *client, union clientSockAddr *clientSockAddr)
 {
   char buf [INET6_ADDRSTRLEN] ;
-  static char ipAddress [1024] ;
+  char *ipAddress = client->ipAddress ;
+  int   size      = sizeof (client->ipAddress) ;
 
-  if (clientSockAddr.sin.sin_family == AF_INET)	// IPv4
+  if (clientSockAddr->sin.sin_family == AF_INET)	// IPv4
   {
-    if (snprintf (ipAddress, 1024, "IPv4: %s", 
-	inet_ntop (clientSockAddr.sin.sin_family, (void *)&clientSockAddr.sin.sin_addr, buf, sizeof (buf))) == 1024)
+    if (snprintf (ipAddress, size, "IPv4: %s", 
+	inet_ntop (clientSockAddr->sin.sin_family, (void *)&clientSockAddr->sin.sin_addr, buf, sizeof (buf))) >= size)
       strcpy (ipAddress, "Too long") ;
   }
   else						// IPv6
   {
-    if (clientSockAddr.sin.sin_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED (&clientSockAddr.sin6.sin6_addr))
+    if (clientSockAddr->sin.sin_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED (&clientSockAddr->sin6.sin6_addr))
     {
-      if (snprintf (ipAddress, 1024, "IPv4in6: %s", 
-	inet_ntop (clientSockAddr.sin.sin_family, (char *)&clientSockAddr.sin6.sin6_addr, buf, sizeof(buf))) == 1024)
+      if (snprintf (ipAddress, size, "IPv4in6: %s", 
+	inet_ntop (clientSockAddr->sin.sin_family, (char *)&clientSockAddr->sin6.sin6_addr, buf, sizeof(buf))) >= size)
       strcpy (ipAddress, "Too long") ;
     }
     else
     {
-      if (snprintf (ipAddress, 1024, "IPv6: %s", 
-	inet_ntop (clientSockAddr.sin.sin_family, (char *)&clientSockAddr.sin6.sin6_addr, buf, sizeof(buf))) == 1024)
+      if (snprintf (ipAddress, size, "IPv6: %s", 
+	inet_ntop (clientSockAddr->sin.sin_family, (char *)&clientSockAddr->sin6.sin6_addr, buf, sizeof(buf))) >= size)
       strcpy (ipAddress, "Too long") ;
     }
   }
-
-  return ipAddress ;
 }
 
 
 
 /*
  * clientPstr: clientPrintf:
- *	Print over a network socket
+ *	Print over a network socket. These are only sent to new
+ *	connections, so there is always room for them.
  *********************************************************************************
  */
 
 static int clientPstr (int fd, char *s)
 {
   int len = strlen (s) ;
-  return (write (fd, s, len) == len) ? 0 : -1 ;
+  return (send (fd, s, len, MSG_NOSIGNAL) == len) ? 0 : -1 ;
 }
 
 static int clientPrintf (const int fd, const char *message, ...)
@@ -133,12 +147,27 @@ static int clientPrintf (const int fd, const char *message, ...)
  *********************************************************************************
  */
 
-int sendGreeting (int clientFd)
+int sendGreeting (struct clientStruct *client)
 {
-  if (clientPrintf (clientFd, "200 Welcome to wiringPiD - http://wiringpi.com/\n") < 0)
+  if (clientPrintf (client->fd, "200 Welcome to wiringPiD - http://wiringpi.com/\n") < 0)
+    return -1 ;
+
+  if (clientPrintf (client->fd, "200 Connecting from: %s\n", client->ipAddress) < 0)
     return -1 ;
 
-  return clientPrintf (clientFd, "200 Connecting from: %s\n", getClientIP ()) ;
+  return clientPrintf (client->fd, "200 Protocol %d\n", DRCN_PROTOCOL) ;
+}
+
+
+/*
+ * sendReady:
+ *	Tell a local client it can start
+ *********************************************************************************
+ */
+
+int sendReady (struct clientStruct *client)
+{
+  return clientPrintf (client->fd, "200 Ready\n") ;
 }
 
 
@@ -180,97 +209,61 @@ static int getSalt (char drySalt [])
  *********************************************************************************
  */
 
-int sendChallenge (int clientFd)
+int sendChallenge (struct clientStruct *client)
 {
-  if (getSalt (salt) < 0)
+  if (getSalt (client->salt) < 0)
     return -1 ;
 
-  return clientPrintf (clientFd, "Challenge %s\n", salt) ;
-}
-
-
-/*
- * getResponse:
- *	Read the encrypted password from the remote device.
- *********************************************************************************
- */
-
-
-int getResponse (int clientFd)
-{
-  char reply [1024] ;
-  int len ;
-
-// Being sort of lazy about this. I'm expecting an SHA-512 hash back and these
-//	are exactly 86 characters long, so no reason not to, I guess...
-
-  len = 86 ;
-
-  if (setsockopt (clientFd, SOL_SOCKET, SO_RCVLOWAT, (void *)&len, sizeof (len)) < 0)
-    return -1 ;
-
-  len = recv (clientFd, reply, 86, 0) ;
-  if (len != 86)
-    return -1 ;
-
-  reply [len] = 0 ;
-
-  if ((returnedHash = malloc (len + 1)) == NULL)
-    return -1 ;
-
-  strcpy (returnedHash, reply) ;
-
-  return 0 ;
+  return clientPrintf (client->fd, "Challenge %s\n", client->salt) ;
 }
 
 
 /*
  * passwordMatch:
- *	See if there's a match. If not, we simply dump them.
+ *	See if the encrypted password the client sent back, the first
+ *	RESPONSE_LEN bytes of its input, matches. If not, we simply dump them.
  *********************************************************************************
  */
 
-int passwordMatch (const char *password)
+int passwordMatch (struct clientStruct *client, const char *password)
 {
   char *encrypted ;
   char salted [1024] ;
 
-  sprintf (salted, "$6$%s$", salt) ;
+  sprintf (salted, "$6$%s$", client->salt) ;
 
   encrypted = crypt (password, salted) ;
 
 // 20: $6$ then 16 characters of salt, then $
 // 86 is the length of an SHA-512 hash
 
-  return strncmp (encrypted + 20, returnedHash, 86) == 0 ;
+  return (encrypted != NULL) && (strncmp (encrypted + 20, (char *)client->in, RESPONSE_LEN) == 0) ;
 }
 
 
 /* 
  * setupServer:
  *	Do what's needed to create a local server socket instance that can listen
- *	on both IPv4 and IPv6 interfaces.
+ *	on both IPv4 and IPv6 interfaces. It is non-blocking, for an event
+ *	loop to accept clients on as they turn up.
  *********************************************************************************
  */
 
 int setupServer (int serverPort)
 {
-  socklen_t clientSockAddrSize = sizeof (clientSockAddr) ;
-
   int on = 1 ;
   int family ;
   socklen_t serverSockAddrSize ;
-  int clientFd ;
 
 // Try to create an IPv6 socket
 
-  serverFd = socket (PF_INET6, SOCK_STREAM, 0) ;
+  serverFd = socket (PF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) ;
 
 // If it didn't work, then fall-back to IPv4.
 
   if (serverFd < 0)
   {
-    if ((serverFd = socket (PF_INET, SOCK_STREAM, 0)) < 0)
+    if ((serverFd = socket (PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
       return -1 ;
 
     family             = AF_INET ;
@@ -302,29 +295,251 @@ int setupServer (int serverPort)
       serverSockAddr.sin6.sin6_port   = htons (serverPort) ;
   }
 
-// Bind, listen and accept
+// Bind and listen
 
   if (bind (serverFd, (struct sockaddr *)&serverSockAddr, serverSockAddrSize) < 0)
     return -1 ;
 
-  if (listen (serverFd, 4) < 0)	// Really only going to talk to one client at a time...
+  if (listen (serverFd, SOMAXCONN) < 0)
+    return -1 ;
+
+  return serverFd ;
+}
+
+
+/*
+ * setupLocalServer:
+ *	Listen on a UNIX socket too, for clients on this machine. They need
+ *	no password: the kernel says who they are. Only root and the user the
+ *	daemon runs as are let in, and the members of group if one is given,
+ *	going by their primary group.
+ *********************************************************************************
+ */
+
+int setupLocalServer (const char *path, const char *group)
+{
+  struct sockaddr_un addr ;
+  struct group *gr ;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+  {
+    errno = ENAMETOOLONG ;
+    return -1 ;
+  }
+
+  if (group != NULL)
+  {
+    if ((gr = getgrnam (group)) == NULL)
+    {
+      errno = ENOENT ;
+      return -1 ;
+    }
+    localGroup = gr->gr_gid ;
+  }
+
+  if ((localPath = strdup (path)) == NULL)
+    return -1 ;
+
+  if ((localFd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    return -1 ;
+
+  memset (&addr, 0, sizeof (addr)) ;
+  addr.sun_family = AF_UNIX ;
+  strcpy (addr.sun_path, path) ;
+
+  (void)unlink (path) ;		// Left over from last time
+
+  if (bind (localFd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+    return -1 ;
+
+  if (chmod (path, (group != NULL) ? 0660 : 0600) < 0)
+    return -1 ;
+
+  if ((group != NULL) && (chown (path, (uid_t)-1, localGroup) < 0))
+    return -1 ;
+
+  if (listen (localFd, SOMAXCONN) < 0)
     return -1 ;
 
-  if ((clientFd = accept (serverFd, (struct sockaddr *)&clientSockAddr, &clientSockAddrSize)) < 0)
+  return localFd ;
+}
+
+
+/*
+ * acceptClient:
+ *	Take the next waiting connection, if there is one, and give it its
+ *	state. A local client is authenticated there and then, if it is
+ *	allowed in at all. Returns NULL with errno EAGAIN when there are no
+ *	more.
+ *********************************************************************************
+ */
+
+struct clientStruct *acceptClient (int local)
+{
+  union clientSockAddr clientSockAddr ;
+  socklen_t clientSockAddrSize = sizeof (clientSockAddr) ;
+  struct clientStruct *client ;
+  struct ucred cred ;
+  socklen_t credSize = sizeof (cred) ;
+  int on = 1 ;
+  int clientFd ;
+
+  if (local)
+    clientFd = accept4 (localFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC) ;
+  else
+    clientFd = accept4 (serverFd, (struct sockaddr *)&clientSockAddr, &clientSockAddrSize, SOCK_NONBLOCK | SOCK_CLOEXEC) ;
+
+  if (clientFd < 0)
+    return NULL ;
+
+  if ((client = calloc (1, sizeof (*client))) == NULL)
+  {
+    close (clientFd) ;
+    return NULL ;
+  }
+
+  client->fd       = clientFd ;
+  client->local    = local ;
+  client->passedFd = -1 ;
+
+  if (local)
+  {
+    if (getsockopt (clientFd, SOL_SOCKET, SO_PEERCRED, &cred, &credSize) < 0)
+      cred.pid = cred.uid = cred.gid = -1 ;
+
+    snprintf (client->ipAddress, sizeof (client->ipAddress), "UNIX: pid %d uid %d gid %d",
+	(int)cred.pid, (int)cred.uid, (int)cred.gid) ;
+
+    client->authenticated = (cred.uid == 0) || (cred.uid == geteuid ()) ||
+	((localGroup != (gid_t)-1) && (cred.gid == localGroup)) ;
+
+    return client ;
+  }
+
+// Replies are batched already, so have them go out as soon as they're sent
+
+  if (setsockopt (clientFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on)) < 0)
+  {
+    closeClient (client) ;
+    return NULL ;
+  }
+
+  setClientIP (client, &clientSockAddr) ;
+
+  return client ;
+}
+
+
+/*
+ * clientRecv:
+ *	Read what a client has sent onto the end of its input. Local clients
+ *	may send an fd along with it, which is kept for the command that
+ *	uses it.
+ *********************************************************************************
+ */
+
+int clientRecv (struct clientStruct *client)
+{
+  union
+  {
+    char buf [CMSG_SPACE (sizeof (int))] ;
+    struct cmsghdr align ;
+  } control ;
+  struct msghdr msg ;
+  struct iovec iov ;
+  struct cmsghdr *cmsg ;
+  int len ;
+
+  iov.iov_base = client->in + client->inLen ;
+  iov.iov_len  = CLIENT_BUF_SIZE - client->inLen ;
+
+  if (!client->local)
+    return recv (client->fd, iov.iov_base, iov.iov_len, 0) ;
+
+  memset (&msg, 0, sizeof (msg)) ;
+  msg.msg_iov        = &iov ;
+  msg.msg_iovlen     = 1 ;
+  msg.msg_control    = control.buf ;
+  msg.msg_controllen = sizeof (control.buf) ;
+
+  if ((len = recvmsg (client->fd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+    return len ;
+
+  for (cmsg = CMSG_FIRSTHDR (&msg) ; cmsg != NULL ; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+    {
+      if (client->passedFd != -1)
+	close (client->passedFd) ;
+      memcpy (&client->passedFd, CMSG_DATA (cmsg), sizeof (int)) ;
+    }
+
+  return len ;
+}
+
+
+/*
+ * mapRing:
+ *	Map the command ring a local client has sent. It has to be sealed
+ *	against shrinking, or the client could pull it out from under us.
+ *********************************************************************************
+ */
+
+int mapRing (struct clientStruct *client)
+{
+  struct drcNetRingStruct *ring ;
+  struct stat st ;
+  int seals, fd = client->passedFd ;
+
+  client->passedFd = -1 ;
+
+  if ((fd == -1) || (client->ring != NULL))
+  {
+    if (fd != -1)
+      close (fd) ;
+    return -1 ;
+  }
+
+  seals = fcntl (fd, F_GET_SEALS) ;
+  if ((seals < 0) || !(seals & F_SEAL_SHRINK) ||
+      (fstat (fd, &st) < 0) || (st.st_size < (off_t)sizeof (*ring)))
+  {
+    close (fd) ;
+    return -1 ;
+  }
+
+  ring = mmap (NULL, sizeof (*ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ;
+  close (fd) ;
+  if (ring == MAP_FAILED)
     return -1 ;
 
-  return clientFd ;
+  client->ring     = ring ;
+  client->ringTail = ring->tail ;
+  ring->sleeping   = TRUE ;
+
+  return 0 ;
 }
 
 
 /*
- * closeServer:
+ * closeClient: closeServer:
  *********************************************************************************
  */
 
-void closeServer (int clientFd)
+void closeClient (struct clientStruct *client)
+{
+  if (client->ring != NULL)
+    munmap (client->ring, sizeof (*client->ring)) ;
+  if (client->passedFd != -1)
+    close (client->passedFd) ;
+
+  close (client->fd) ;
+  free  (client) ;
+}
+
+void closeServer (void)
 {
   if (serverFd != -1) close (serverFd) ;
-  if (clientFd != -1) close (clientFd) ;
-  serverFd = clientFd = -1 ;
+  if (localFd  != -1) close (localFd) ;
+  if (localPath != NULL) (void)unlink (localPath) ;
+  serverFd = localFd = -1 ;
 }
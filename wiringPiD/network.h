@@ -21,11 +21,51 @@
  ***********************************************************************
  */
 
-extern char *getClientIP   (void) ;
-extern int   getResponce   (int clientFd) ;
+// Most clients served at once
+
+#define	MAX_CLIENTS		32
+
+// Buffer sizes, for a batch of commands, or their replies, at a time.
+//	The password hash (86 characters of SHA-512) comes in through the
+//	same buffer. The out buffer has room for as much again of edge
+//	notifications.
+
+#define	CLIENT_BUF_SIZE		(256 * 12)
+#define	RESPONSE_LEN		86
+#define	SALT_LEN		16
+
+struct drcNetRingStruct ;
+
+// Everything kept for a connected client
+
+struct clientStruct
+{
+  int     fd ;
+  int     local ;			// On the UNIX socket
+  int     authenticated ;
+  int     events ;			// What epoll is waiting on
+  char    ipAddress [64] ;
+  char    salt [SALT_LEN + 1] ;
+
+  int     passedFd ;			// Last fd a local client sent, or -1
+  struct drcNetRingStruct *ring ;
+  uint32_t ringTail ;
+  int     ringBusy ;			// Left commands on it for next time round
+
+  uint8_t in  [CLIENT_BUF_SIZE] ;
+  int     inLen ;
+  uint8_t out [2 * CLIENT_BUF_SIZE] ;
+  int     outLen ;
+} ;
+
 extern int   setupServer   (int serverPort) ;
-extern int   sendGreeting  (int clientFd) ;
-extern int   sendChallenge (int clientFd) ;
-extern int   getResponse   (int clientFd) ;
-extern int   passwordMatch (const char *password) ;
-extern void  closeServer   (int clientFd) ;
+extern int   setupLocalServer (const char *path, const char *group) ;
+extern struct clientStruct *acceptClient (int local) ;
+extern int   clientRecv    (struct clientStruct *client) ;
+extern int   sendGreeting  (struct clientStruct *client) ;
+extern int   sendChallenge (struct clientStruct *client) ;
+extern int   sendReady     (struct clientStruct *client) ;
+extern int   passwordMatch (struct clientStruct *client, const char *password) ;
+extern void  closeClient   (struct clientStruct *client) ;
+extern void  closeServer   (void) ;
+extern int   mapRing       (struct clientStruct *client) ;
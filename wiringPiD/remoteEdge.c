@@ -0,0 +1,536 @@
+/*
+ * remoteEdge.c:
+ *	Watch local pins for edges and send them on to the clients that
+ *	asked for them.
+ *
+ *	The pins are watched with wiringPiISR. Its handlers run on their own
+ *	threads, so they only queue the edge and wake the event loop through
+ *	an eventfd; the loop then hands the edge to each client's out buffer,
+ *	the same as a reply. Exporting a pin through sysfs can take seconds
+ *	while udev catches up, so that is done on a thread of its own too,
+ *	and the subscribe answered once it is done.
+ *
+ *	Copyright (c) 2012-2017 Gordon Henderson
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with wiringPi.  If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <wiringPi.h>
+
+#include "drcNetCmd.h"
+#include "network.h"
+#include "runRemote.h"
+#include "remoteEdge.h"
+
+// Most pins watched at once, and edges held waiting for the event loop
+
+#define	EDGE_PINS	8
+#define	EDGE_QUEUE	256
+
+// The pins being watched, and who for. Only the event loop changes this,
+//	bar pin, which the handlers read, and result, which the set up thread
+//	writes, both under queueLock.
+
+static struct
+{
+  int pin ;			// -1 when not in use
+  int gpio ;
+  int ready ;			// Being watched; else still being set up
+  int result ;			// How the set up went: 0 or -1, 1 until it has
+  int numClients ;
+  struct clientStruct *clients [MAX_CLIENTS] ;
+  int modes [MAX_CLIENTS] ;
+  uint32_t replies [MAX_CLIENTS] ;	// Subscribe reply held until ready, or 0
+} edgePins [EDGE_PINS] ;
+
+static struct drcNetComStruct queue [EDGE_QUEUE] ;
+static int queueHead = 0 ;
+static int queueLen  = 0 ;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER ;
+
+static int eventFd = -1 ;
+static int wpiMode = MODE_UNINITIALISED ;
+
+
+/*
+ * edgeInterrupt:
+ *	An edge on a watched pin: note which way it went, and when.
+ *	wiringPiISRCancel cancels the thread this runs on, which holds
+ *	wiringPi's pin lock meanwhile, so cancelling is put off until it is
+ *	done.
+ *********************************************************************************
+ */
+
+static void edgeInterrupt (int slot)
+{
+  struct drcNetComStruct edge ;
+  uint64_t one = 1 ;
+  int cancelState ;
+
+  edge.data = micros () ;
+
+  pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &cancelState) ;
+
+  pthread_mutex_lock (&queueLock) ;
+  edge.pin = edgePins [slot].pin ;
+  pthread_mutex_unlock (&queueLock) ;
+
+  if (edge.pin == (uint32_t)-1)
+  {
+    pthread_setcancelstate (cancelState, NULL) ;
+    return ;
+  }
+
+  edge.cmd = (digitalRead (edge.pin) == HIGH) ? DRCN_EDGE_RISING : DRCN_EDGE_FALLING ;
+
+  pthread_mutex_lock (&queueLock) ;
+  if (queueLen < EDGE_QUEUE)		// Else the loop has fallen badly behind; drop it
+  {
+    queue [(queueHead + queueLen) % EDGE_QUEUE] = edge ;
+    ++queueLen ;
+  }
+  pthread_mutex_unlock (&queueLock) ;
+
+  (void)write (eventFd, &one, sizeof (one)) ;
+
+  pthread_setcancelstate (cancelState, NULL) ;
+}
+
+// wiringPiISR has no user data, so one small function per watched pin
+
+static void edgeInterrupt0 (void) { edgeInterrupt (0) ; }
+static void edgeInterrupt1 (void) { edgeInterrupt (1) ; }
+static void edgeInterrupt2 (void) { edgeInterrupt (2) ; }
+static void edgeInterrupt3 (void) { edgeInterrupt (3) ; }
+static void edgeInterrupt4 (void) { edgeInterrupt (4) ; }
+static void edgeInterrupt5 (void) { edgeInterrupt (5) ; }
+static void edgeInterrupt6 (void) { edgeInterrupt (6) ; }
+static void edgeInterrupt7 (void) { edgeInterrupt (7) ; }
+
+static void (*edgeInterrupts [EDGE_PINS]) (void) =
+{
+  edgeInterrupt0, edgeInterrupt1, edgeInterrupt2, edgeInterrupt3,
+  edgeInterrupt4, edgeInterrupt5, edgeInterrupt6, edgeInterrupt7,
+} ;
+
+
+/*
+ * sysWrite:
+ *	Write a value to one of a GPIO's sysfs files, which udev may not
+ *	have let us at yet
+ *********************************************************************************
+ */
+
+static int sysWrite (const char *file, int gpio, const char *value)
+{
+  char fName [64] ;
+  int fd, tries, ok ;
+
+  snprintf (fName, sizeof (fName), "/sys/class/gpio/gpio%d/%s", gpio, file) ;
+
+  for (tries = 5 ; (fd = open (fName, O_WRONLY | O_CLOEXEC)) < 0 ; --tries)
+  {
+    if (tries == 1)
+      return -1 ;
+    sleep (1) ;
+  }
+
+  ok = (write (fd, value, strlen (value)) == (ssize_t)strlen (value)) ;
+  close (fd) ;
+
+  return ok ? 0 : -1 ;
+}
+
+
+/*
+ * edgeWatch:
+ *	Export a pin, set it up for both edges and start watching it, on a
+ *	thread of its own rather than holding up the event loop. A pin that
+ *	is already exported is fine, a GPIO there is no such thing as isn't.
+ *	All this is done here rather than by wiringPiISR, which gives up on
+ *	the whole program when it can't.
+ *********************************************************************************
+ */
+
+static void *edgeWatch (void *arg)
+{
+  int slot = (int)(intptr_t)arg ;
+  uint64_t one = 1 ;
+  char gpioS [16] ;
+  int pin, gpio, fd, ok ;
+
+  pthread_mutex_lock (&queueLock) ;
+  pin  = edgePins [slot].pin ;
+  gpio = edgePins [slot].gpio ;
+  pthread_mutex_unlock (&queueLock) ;
+
+  snprintf (gpioS, sizeof (gpioS), "%d\n", gpio) ;
+
+  if ((fd = open ("/sys/class/gpio/export", O_WRONLY | O_CLOEXEC)) < 0)
+    ok = FALSE ;
+  else
+  {
+    ok = (write (fd, gpioS, strlen (gpioS)) > 0) || (errno == EBUSY) ;
+    close (fd) ;
+  }
+
+  ok = ok && (sysWrite ("direction", gpio, "in\n")   == 0)
+	  && (sysWrite ("edge",      gpio, "both\n") == 0)
+	  && (wiringPiISR (pin, INT_EDGE_SETUP, edgeInterrupts [slot]) == 0) ;
+
+  pthread_mutex_lock (&queueLock) ;
+  edgePins [slot].result = ok ? 0 : -1 ;
+  pthread_mutex_unlock (&queueLock) ;
+
+  (void)write (eventFd, &one, sizeof (one)) ;
+
+  return NULL ;
+}
+
+
+/*
+ * edgeGpio:
+ *	The GPIO a pin number is in the mode we were set up in, or -1
+ *********************************************************************************
+ */
+
+static int edgeGpio (int pin)
+{
+  switch (wpiMode)
+  {
+    case MODE_PINS:	return wpiPinToGpio  (pin) ;
+    case MODE_PHYS:	return physPinToGpio (pin) ;
+    case MODE_GPIO:
+    case MODE_GPIO_SYS:	return pin ;
+  }
+
+  return -1 ;
+}
+
+
+/*
+ * edgeSetup:
+ *	Returns the fd the event loop is to wait on for edges
+ *********************************************************************************
+ */
+
+int edgeSetup (void)
+{
+  int model, rev, mem, maker ;
+  int slot ;
+
+  for (slot = 0 ; slot < EDGE_PINS ; ++slot)
+    edgePins [slot].pin = -1 ;
+
+  if (!noLocalPins)
+    piBoardId (&model, &rev, &mem, &maker, &wpiMode) ;
+
+  return eventFd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC) ;
+}
+
+
+/*
+ * edgeSubscribe:
+ *	Send the client the edges on a local pin. The pin is watched for
+ *	both edges, however many clients want which, and the edges sorted
+ *	out per client. Subscribing again just changes the mode. A pin not
+ *	yet watched is set up in the background, and the reply held until
+ *	that is done: EDGE_HELD is returned, and the reply sent later by
+ *	edgeDispatch. A pin still being set up can't be subscribed again.
+ *********************************************************************************
+ */
+
+int edgeSubscribe (struct clientStruct *client, struct drcNetComStruct *cmd)
+{
+  pthread_t thread ;
+  int pin  = cmd->pin ;
+  int mode = cmd->data ;
+  int slot, unused = -1, gpio, i ;
+
+  if ((pin & PI_GPIO_MASK) || noLocalPins ||
+      ((mode != INT_EDGE_FALLING) && (mode != INT_EDGE_RISING) && (mode != INT_EDGE_BOTH)))
+    return -1 ;
+
+  for (slot = 0 ; slot < EDGE_PINS ; ++slot)
+  {
+    if (edgePins [slot].pin == pin)
+      break ;
+    if ((edgePins [slot].pin == -1) && (unused == -1))
+      unused = slot ;
+  }
+
+  for (i = 0 ; (slot < EDGE_PINS) && (i < edgePins [slot].numClients) ; ++i)
+    if (edgePins [slot].clients [i] == client)
+      break ;
+
+  if (slot < EDGE_PINS)
+  {
+    if (!edgePins [slot].ready && (i < edgePins [slot].numClients))
+      return -1 ;
+
+    edgePins [slot].clients [i] = client ;
+    edgePins [slot].modes   [i] = mode ;
+    edgePins [slot].replies [i] = 0 ;
+    if (i == edgePins [slot].numClients)
+      ++edgePins [slot].numClients ;
+
+    if (edgePins [slot].ready)
+      return 0 ;
+
+    edgePins [slot].replies [i] = (cmd->cmd & DRCN_NO_REPLY) ? 0 : cmd->cmd ;
+    return EDGE_HELD ;
+  }
+
+  if ((unused == -1) || ((gpio = edgeGpio (pin)) < 0))
+    return -1 ;
+
+  slot = unused ;
+  pthread_mutex_lock (&queueLock) ;
+  edgePins [slot].pin    = pin ;
+  edgePins [slot].gpio   = gpio ;
+  edgePins [slot].result = 1 ;
+  pthread_mutex_unlock (&queueLock) ;
+
+  edgePins [slot].ready      = FALSE ;
+  edgePins [slot].numClients = 1 ;
+  edgePins [slot].clients [0] = client ;
+  edgePins [slot].modes   [0] = mode ;
+  edgePins [slot].replies [0] = (cmd->cmd & DRCN_NO_REPLY) ? 0 : cmd->cmd ;
+
+  if (pthread_create (&thread, NULL, edgeWatch, (void *)(intptr_t)slot) != 0)
+  {
+    pthread_mutex_lock (&queueLock) ;
+    edgePins [slot].pin = -1 ;
+    pthread_mutex_unlock (&queueLock) ;
+    return -1 ;
+  }
+  pthread_detach (thread) ;
+
+  return EDGE_HELD ;
+}
+
+
+/*
+ * edgeRemove:
+ *	Take a client off a pin, and stop watching the pin once nobody is.
+ *	A pin still being set up is left for edgeReady to stop.
+ *********************************************************************************
+ */
+
+static void edgeRemove (int slot, int i)
+{
+  int last = --edgePins [slot].numClients ;
+
+  edgePins [slot].clients [i] = edgePins [slot].clients [last] ;
+  edgePins [slot].modes   [i] = edgePins [slot].modes   [last] ;
+  edgePins [slot].replies [i] = edgePins [slot].replies [last] ;
+
+  if ((last > 0) || !edgePins [slot].ready)
+    return ;
+
+  wiringPiISRCancel (edgePins [slot].pin) ;
+
+  pthread_mutex_lock (&queueLock) ;
+  edgePins [slot].pin = -1 ;
+  pthread_mutex_unlock (&queueLock) ;
+}
+
+
+/*
+ * edgeReady:
+ *	A pin's set up thread is done: send the replies held for it, with
+ *	how it went, and give the slot up if it failed or nobody is left
+ *	wanting it. A client with no room left for its reply isn't keeping
+ *	up, and would only wait on for it, so it is hung up on; the event
+ *	loop then drops it, and its subscriptions with it.
+ *********************************************************************************
+ */
+
+static void edgeReady (int slot, int result, struct clientStruct **sendTo, int *numSendTo)
+{
+  struct clientStruct *client ;
+  struct drcNetComStruct reply ;
+  int i, j ;
+
+  for (i = 0 ; i < edgePins [slot].numClients ; ++i)
+  {
+    client = edgePins [slot].clients [i] ;
+
+    if (edgePins [slot].replies [i] == 0)
+      continue ;
+
+    if (client->outLen + (int)sizeof (reply) > (int)sizeof (client->out))
+    {
+      edgePins [slot].replies [i] = 0 ;
+      shutdown (client->fd, SHUT_RDWR) ;
+      continue ;
+    }
+
+    reply.pin  = edgePins [slot].pin ;
+    reply.cmd  = edgePins [slot].replies [i] ;
+    reply.data = result ;
+    memcpy (client->out + client->outLen, &reply, sizeof (reply)) ;
+    client->outLen += sizeof (reply) ;
+    edgePins [slot].replies [i] = 0 ;
+
+    for (j = 0 ; j < *numSendTo ; ++j)
+      if (sendTo [j] == client)
+	break ;
+    if (j == *numSendTo)
+      sendTo [(*numSendTo)++] = client ;
+  }
+
+  edgePins [slot].ready = TRUE ;
+
+  if (result < 0)
+    edgePins [slot].numClients = 0 ;
+  else if (edgePins [slot].numClients == 0)
+    wiringPiISRCancel (edgePins [slot].pin) ;
+
+  if (edgePins [slot].numClients == 0)
+  {
+    pthread_mutex_lock (&queueLock) ;
+    edgePins [slot].pin = -1 ;
+    pthread_mutex_unlock (&queueLock) ;
+  }
+}
+
+
+/*
+ * edgeUnsubscribe: edgeDropClient:
+ *	Stop sending a client one pin's edges, or any
+ *********************************************************************************
+ */
+
+int edgeUnsubscribe (struct clientStruct *client, int pin)
+{
+  int slot, i ;
+
+  for (slot = 0 ; slot < EDGE_PINS ; ++slot)
+    if (edgePins [slot].pin == pin)
+      for (i = 0 ; i < edgePins [slot].numClients ; ++i)
+	if (edgePins [slot].clients [i] == client)
+	{
+	  edgeRemove (slot, i) ;
+	  return 0 ;
+	}
+
+  return -1 ;
+}
+
+void edgeDropClient (struct clientStruct *client)
+{
+  int slot, i ;
+
+  for (slot = 0 ; slot < EDGE_PINS ; ++slot)
+    for (i = 0 ; i < edgePins [slot].numClients ; ++i)
+      if (edgePins [slot].clients [i] == client)
+      {
+	edgeRemove (slot, i) ;
+	break ;
+      }
+}
+
+
+/*
+ * edgeDispatch:
+ *	Send the replies for pins that have finished being set up, and hand
+ *	the queued edges to the clients that want them, then flush those
+ *	clients. Notifications only take the first half of a client's out
+ *	buffer, leaving the rest for replies; a client that lets that fill
+ *	up loses edges rather than holding up the others.
+ *********************************************************************************
+ */
+
+void edgeDispatch (int (*flush)(struct clientStruct *client))
+{
+  struct clientStruct *client, *sendTo [MAX_CLIENTS] ;
+  struct drcNetComStruct edge ;
+  uint64_t count ;
+  int numSendTo = 0 ;
+  int slot, i, j, mode, result ;
+
+  (void)read (eventFd, &count, sizeof (count)) ;
+
+  for (slot = 0 ; slot < EDGE_PINS ; ++slot)
+  {
+    if ((edgePins [slot].pin == -1) || edgePins [slot].ready)
+      continue ;
+
+    pthread_mutex_lock (&queueLock) ;
+    result = edgePins [slot].result ;
+    pthread_mutex_unlock (&queueLock) ;
+
+    if (result != 1)
+      edgeReady (slot, result, sendTo, &numSendTo) ;
+  }
+
+  for (;;)
+  {
+    pthread_mutex_lock (&queueLock) ;
+    if (queueLen == 0)
+    {
+      pthread_mutex_unlock (&queueLock) ;
+      break ;
+    }
+    edge      = queue [queueHead] ;
+    queueHead = (queueHead + 1) % EDGE_QUEUE ;
+    --queueLen ;
+    pthread_mutex_unlock (&queueLock) ;
+
+    for (slot = 0 ; slot < EDGE_PINS ; ++slot)
+      if (edgePins [slot].pin == (int)edge.pin)
+	break ;
+    if ((slot == EDGE_PINS) || !edgePins [slot].ready)
+      continue ;
+
+    for (i = 0 ; i < edgePins [slot].numClients ; ++i)
+    {
+      client = edgePins [slot].clients [i] ;
+      mode   = edgePins [slot].modes   [i] ;
+
+      if (((mode == INT_EDGE_RISING)  && (edge.cmd != DRCN_EDGE_RISING)) ||
+	  ((mode == INT_EDGE_FALLING) && (edge.cmd != DRCN_EDGE_FALLING)) ||
+	  (client->outLen + (int)sizeof (edge) > CLIENT_BUF_SIZE))
+	continue ;
+
+      memcpy (client->out + client->outLen, &edge, sizeof (edge)) ;
+      client->outLen += sizeof (edge) ;
+
+      for (j = 0 ; j < numSendTo ; ++j)
+	if (sendTo [j] == client)
+	  break ;
+      if (j == numSendTo)
+	sendTo [numSendTo++] = client ;
+    }
+  }
+
+  for (j = 0 ; j < numSendTo ; ++j)
+    flush (sendTo [j]) ;
+}
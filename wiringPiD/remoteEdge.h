@@ -0,0 +1,37 @@
+/*
+ * remoteEdge.h:
+ *	Watch local pins for edges and send them on to the clients that
+ *	asked for them.
+ *
+ *	Copyright (c) 2012-2017 Gordon Henderson
+ ***********************************************************************
+ * This file is part of wiringPi:
+ *	https://projects.drogon.net/raspberry-pi/wiringpi/
+ *
+ *    wiringPi is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU Lesser General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    wiringPi is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public License
+ *    along with wiringPi.  If not, see <http://www.gnu.org/licenses/>.
+ ***********************************************************************
+ */
+
+// edgeSubscribe's answer when the reply is to be sent later
+
+#define	EDGE_HELD	1
+
+struct clientStruct ;
+struct drcNetComStruct ;
+
+extern int  edgeSetup       (void) ;
+extern int  edgeSubscribe   (struct clientStruct *client, struct drcNetComStruct *cmd) ;
+extern int  edgeUnsubscribe (struct clientStruct *client, int pin) ;
+extern void edgeDropClient  (struct clientStruct *client) ;
+extern void edgeDispatch    (int (*flush)(struct clientStruct *client)) ;
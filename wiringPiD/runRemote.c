@@ -37,90 +37,165 @@
 #include "drcNetCmd.h"
 #include "network.h"
 #include "runRemote.h"
+#include "remoteEdge.h"
 
 
 
 int noLocalPins = FALSE ;
 
+/*
+ * runCommand:
+ *	Carry out one command, putting any result into its data. Returns
+ *	TRUE if it is to be sent back, which is always, bar for commands
+ *	flagged DRCN_NO_REPLY or not known, and subscribes whose reply the
+ *	edge code sends once the pin is set up. A sequence number is left as
+ *	it is, to go back with the reply.
+ *********************************************************************************
+ */
 
-void runRemoteCommands (int fd)
+static int runCommand (struct clientStruct *client, struct drcNetComStruct *cmd)
 {
-  register uint32_t pin ;
-  int len ;
+  int pin   = cmd->pin ;
+  int reply = !(cmd->cmd & DRCN_NO_REPLY) ;
+
+  switch (cmd->cmd & DRCN_CMD_MASK)
+  {
+    case DRCN_SUBSCRIBE:	cmd->data = edgeSubscribe (client, cmd) ;	      return reply && (cmd->data != EDGE_HELD) ;
+    case DRCN_UNSUBSCRIBE:	cmd->data = edgeUnsubscribe (client, pin) ;	      return reply ;
+    case DRCN_RING:		cmd->data = mapRing (client) ;			      return reply ;
+    case DRCN_RING_KICK:	return FALSE ;
+  }
+
+  if (noLocalPins && ((pin & PI_GPIO_MASK) == 0))
+    return reply ;
+
+  switch (cmd->cmd & DRCN_CMD_MASK)
+  {
+    case DRCN_PIN_MODE:		pinMode         (pin, cmd->data) ; break ;
+    case DRCN_PULL_UP_DN:	pullUpDnControl (pin, cmd->data) ; break ;
+    case DRCN_PWM_WRITE:	pwmWrite        (pin, cmd->data) ; break ;
+    case DRCN_DIGITAL_WRITE:	digitalWrite    (pin, cmd->data) ; break ;
+    case DRCN_DIGITAL_WRITE8:	digitalWrite8   (pin, cmd->data) ; break ;
+    case DRCN_DIGITAL_WRITE16:	digitalWrite16  (pin, cmd->data) ; break ;
+    case DRCN_DIGITAL_WRITE32:	digitalWrite32  (pin, cmd->data) ; break ;
+    case DRCN_ANALOG_WRITE:	analogWrite     (pin, cmd->data) ; break ;
+
+    case DRCN_DIGITAL_READ:	cmd->data = digitalRead   (pin) ; break ;
+    case DRCN_DIGITAL_READ8:	cmd->data = digitalRead8  (pin) ; break ;
+    case DRCN_DIGITAL_READ16:	cmd->data = digitalRead16 (pin) ; break ;
+    case DRCN_DIGITAL_READ32:	cmd->data = digitalRead32 (pin) ; break ;
+    case DRCN_ANALOG_READ:	cmd->data = analogRead    (pin) ; break ;
+
+    default:
+      return FALSE ;
+  }
+
+  return reply ;
+}
+
+
+/*
+ * runRingCommands:
+ *	Run what a local client has put on its ring. Nothing on the ring gets
+ *	a reply, and only pin commands are taken from it. Once it is empty
+ *	it is watched for a little while, as a busy client will be putting
+ *	more on, before sleeping is set; it is then looked at again in case
+ *	the client added more without seeing that. A client that keeps it
+ *	full only gets RING_BATCH commands run at a time, so it can't keep
+ *	the event loop from the others: ringBusy is set, and sleeping left
+ *	down so it doesn't kick, until the loop comes back to it.
+ *********************************************************************************
+ */
+
+#define	RING_SPIN	4096
+#define	RING_BATCH	1024
+
+static int runRingCommands (struct clientStruct *client)
+{
+  struct drcNetRingStruct *ring = client->ring ;
   struct drcNetComStruct cmd ;
+  uint32_t head ;
+  int spin, ran = 0 ;
 
-  len = sizeof (struct drcNetComStruct) ;
+  if (ring == NULL)
+    return client->ringBusy = FALSE ;
 
-  if (setsockopt (fd, SOL_SOCKET, SO_RCVLOWAT, (void *)&len, sizeof (len)) < 0)
-    return ;
+  ring->sleeping = FALSE ;
 
   for (;;)
   {
-    if (recv (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))	// Probably remote hangup
-      return ;
+    for (spin = 0 ; (spin < RING_SPIN) && (ring->head == client->ringTail) ; ++spin)
+      ;
+
+    head = ring->head ;
+    __sync_synchronize () ;
+
+    if (head - client->ringTail > DRCN_RING_SIZE)	// Nonsense; skip it all
+      client->ringTail = head ;
 
-    pin = cmd.pin ;
-    if (noLocalPins && ((pin & PI_GPIO_MASK) == 0))
+    while ((client->ringTail != head) && (ran < RING_BATCH))
     {
-      if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	return ;
-      continue ;
+      cmd = ring->cmds [client->ringTail++ & (DRCN_RING_SIZE - 1)] ;
+      if ((cmd.cmd & DRCN_CMD_MASK) < DRCN_SUBSCRIBE)
+      {
+	cmd.cmd |= DRCN_NO_REPLY ;
+	(void)runCommand (client, &cmd) ;
+      }
+      ++ran ;
     }
 
-    switch (cmd.cmd)
+    __sync_synchronize () ;
+    ring->tail = client->ringTail ;
+
+    if (ran == RING_BATCH)		// Give the others a go
+      return client->ringBusy = TRUE ;
+
+    if (spin < RING_SPIN)		// Found more; go round again
+      continue ;
+
+    ring->sleeping = TRUE ;
+    __sync_synchronize () ;
+
+    if (ring->head == client->ringTail)
+      break ;
+
+    ring->sleeping = FALSE ;
+  }
+
+  return client->ringBusy = FALSE ;
+}
+
+
+/*
+ * runRemoteCommands:
+ *	Run all the complete commands a client has sent, in order, and queue
+ *	up the replies for sending back together. The start of a command
+ *	split across reads is kept until the rest of it turns up. There is
+ *	always room for the replies: edge notifications only use as much of
+ *	the out buffer again as the in one has. Anything on a local client's
+ *	ring was put there first, so is run first, and while it is still
+ *	busy the rest wait.
+ *********************************************************************************
+ */
+
+void runRemoteCommands (struct clientStruct *client)
+{
+  struct drcNetComStruct cmd ;
+  int pos ;
+
+  if (runRingCommands (client))
+    return ;
+
+  for (pos = 0 ; pos + (int)sizeof (cmd) <= client->inLen ; pos += sizeof (cmd))
+  {
+    memcpy (&cmd, client->in + pos, sizeof (cmd)) ;
+    if (runCommand (client, &cmd))
     {
-      case DRCN_PIN_MODE:
-	pinMode (pin, cmd.data) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
-
-      case DRCN_PULL_UP_DN:
-	pullUpDnControl (pin, cmd.data) ;
-	break ;
-
-      case DRCN_PWM_WRITE:
-	pwmWrite (pin, cmd.data) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
-
-      case DRCN_DIGITAL_WRITE:
-	digitalWrite (pin, cmd.data) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
-
-      case DRCN_DIGITAL_WRITE8:
-	//digitalWrite8 (pin, cmd.data) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
-
-      case DRCN_DIGITAL_READ:
-	cmd.data = digitalRead (pin) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
-
-      case DRCN_DIGITAL_READ8:
-	//cmd.data = digitalRead8 (pin) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
-
-      case DRCN_ANALOG_WRITE:
-	analogWrite (pin, cmd.data) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
-
-      case DRCN_ANALOG_READ:
-	cmd.data = analogRead (pin) ;
-	if (send (fd, &cmd, sizeof (cmd), 0) != sizeof (cmd))
-	  return ;
-	break ;
+      memcpy (client->out + client->outLen, &cmd, sizeof (cmd)) ;
+      client->outLen += sizeof (cmd) ;
     }
   }
 
+  client->inLen -= pos ;
+  memmove (client->in, client->in + pos, client->inLen) ;
 }
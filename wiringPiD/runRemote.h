@@ -22,8 +22,10 @@
  ***********************************************************************
  */
 
+struct clientStruct ;
+
 // Globals
 
 extern int noLocalPins ;
 
-extern void runRemoteCommands (int fd) ;
+extern void runRemoteCommands (struct clientStruct *client) ;
@@ -30,6 +30,9 @@
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
 
 #include <wiringPi.h>
 #include <wpiExtensions.h>
@@ -37,17 +40,45 @@
 #include "drcNetCmd.h"
 #include "network.h"
 #include "runRemote.h"
+#include "remoteEdge.h"
 #include "daemonise.h"
 
 
 #define	PIDFILE	"/var/run/wiringPiD.pid"
 
+// Network clients still to send their password: how many may be at it
+//	at once, and how long each gets, in mS. They don't count towards
+//	MAX_CLIENTS until they have.
+
+#define	MAX_PENDING	8
+#define	AUTH_TIMEOUT	5000
+
 
 // Globals
 
-static const char *usage = "[-h] [-d] [-g | -1 | -z] [[-x extension:pin:params] ...] password" ;
+static const char *usage = "[-h] [-d] [-g | -1 | -z] [-p port] [-u [socket]] [-a group] [[-x extension:pin:params] ...] password" ;
 static int doDaemon = FALSE ;
 
+static int epollFd ;
+static int numClients = 0 ;
+
+// Local clients with more on their rings than was run last time round
+
+static struct clientStruct *busy [MAX_CLIENTS] ;
+static int numBusy = 0 ;
+
+// Network clients waiting to be authenticated, and when they have to be
+
+static struct
+{
+  struct clientStruct *client ;
+  int64_t deadline ;
+} pending [MAX_PENDING] ;
+static int numPending = 0 ;
+
+static const char *localPath  = NULL ;
+static const char *localGroup = NULL ;
+
 //
 
 static void logMsg (const char *message, ...)
@@ -77,6 +108,7 @@ static void logMsg (const char *message, ...)
 void sigHandler (int sig)
 {
   logMsg ("Exiting on signal %d: %s", sig, strsignal (sig)) ;
+  closeServer () ;
   (void)unlink (PIDFILE) ;
   exit (EXIT_FAILURE) ;
 }
@@ -117,6 +149,389 @@ void setupSigHandler (void)
 }
 
 
+/*
+ * nowMs:
+ *	The monotonic clock, in mS
+ *********************************************************************************
+ */
+
+static int64_t nowMs (void)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 ;
+}
+
+
+/*
+ * unPend:
+ *	Take a client off the pending list
+ *********************************************************************************
+ */
+
+static void unPend (struct clientStruct *client)
+{
+  int i ;
+
+  for (i = 0 ; i < numPending ; ++i)
+    if (pending [i].client == client)
+    {
+      pending [i] = pending [--numPending] ;
+      return ;
+    }
+}
+
+
+/*
+ * setBusy:
+ *	Keep the busy list up to date with whether a client has left
+ *	commands on its ring
+ *********************************************************************************
+ */
+
+static void setBusy (struct clientStruct *client, int isBusy)
+{
+  int i ;
+
+  for (i = 0 ; i < numBusy ; ++i)
+    if (busy [i] == client)
+      break ;
+
+  if (isBusy && (i == numBusy))
+    busy [numBusy++] = client ;
+  else if (!isBusy && (i < numBusy))
+    busy [i] = busy [--numBusy] ;
+}
+
+
+/*
+ * dropClient:
+ *	Close a client's connection and forget it
+ *********************************************************************************
+ */
+
+static void dropClient (struct clientStruct *client, const char *why)
+{
+  logMsg ("Closing connection from: %s: %s", client->ipAddress, why) ;
+
+  if (client->authenticated)
+    --numClients ;
+  else
+    unPend (client) ;
+
+  setBusy (client, FALSE) ;
+  epoll_ctl (epollFd, EPOLL_CTL_DEL, client->fd, NULL) ;
+  edgeDropClient (client) ;
+  closeClient (client) ;
+}
+
+
+/*
+ * flushClient:
+ *	Send what replies the client will take. While any are left over, it
+ *	gets nothing more read from it, so one that doesn't keep up with its
+ *	replies can only hold up itself. Nor does one with commands still
+ *	on its ring, as what it sends has to wait for those.
+ *********************************************************************************
+ */
+
+static int flushClient (struct clientStruct *client)
+{
+  struct epoll_event ev ;
+  int len ;
+
+  while (client->outLen > 0)
+  {
+    if ((len = send (client->fd, client->out, client->outLen, MSG_NOSIGNAL)) < 0)
+    {
+      if (errno == EINTR)
+	continue ;
+      if (errno == EAGAIN)
+	break ;
+      return -1 ;
+    }
+    client->outLen -= len ;
+    memmove (client->out, client->out + len, client->outLen) ;
+  }
+
+  ev.events   = (client->outLen > 0) ? EPOLLOUT : client->ringBusy ? 0 : EPOLLIN ;
+  ev.data.ptr = client ;
+
+  if ((int)ev.events != client->events)
+  {
+    if (epoll_ctl (epollFd, EPOLL_CTL_MOD, client->fd, &ev) < 0)
+      return -1 ;
+    client->events = ev.events ;
+  }
+
+  return 0 ;
+}
+
+
+/*
+ * readClient:
+ *	Take in what the client has sent: first its password, then commands
+ *********************************************************************************
+ */
+
+static void readClient (struct clientStruct *client, const char *password)
+{
+  int len ;
+
+  if ((len = clientRecv (client)) < 0)
+  {
+    if ((errno != EAGAIN) && (errno != EINTR))
+      dropClient (client, strerror (errno)) ;
+    return ;
+  }
+
+  if (len == 0)
+  {
+    dropClient (client, "Remote hangup") ;
+    return ;
+  }
+
+  client->inLen += len ;
+
+  if (!client->authenticated)
+  {
+    if (client->inLen < RESPONSE_LEN)
+      return ;
+
+    if (!passwordMatch (client, password))
+    {
+      dropClient (client, "Password failure") ;
+      return ;
+    }
+
+    if (numClients == MAX_CLIENTS)
+    {
+      dropClient (client, "Too many clients") ;
+      return ;
+    }
+
+    logMsg ("Password OK from: %s - Starting", client->ipAddress) ;
+
+    unPend (client) ;
+    client->authenticated = TRUE ;
+    ++numClients ;
+    client->inLen -= RESPONSE_LEN ;
+    memmove (client->in, client->in + RESPONSE_LEN, client->inLen) ;
+  }
+
+  runRemoteCommands (client) ;
+  setBusy (client, client->ringBusy) ;
+
+  if (flushClient (client) < 0)
+    dropClient (client, strerror (errno)) ;
+}
+
+
+/*
+ * newClients:
+ *	Greet everyone waiting to connect and send them their challenge, or
+ *	for local clients, say they're in. Network clients are only let in
+ *	so far until they have answered it, so a pile of them that never do
+ *	can't keep anyone else out.
+ *********************************************************************************
+ */
+
+static void newClients (int local)
+{
+  struct clientStruct *client ;
+  struct epoll_event ev ;
+
+  while ((client = acceptClient (local)) != NULL)
+  {
+    logMsg ("New connection from: %s.", client->ipAddress) ;
+
+    if (local ? (numClients == MAX_CLIENTS) : (numPending == MAX_PENDING))
+    {
+      logMsg ("Too many clients, closing connection from: %s.", client->ipAddress) ;
+      closeClient (client) ;
+      continue ;
+    }
+
+    if (local && !client->authenticated)
+    {
+      logMsg ("Permission denied, closing connection from: %s.", client->ipAddress) ;
+      closeClient (client) ;
+      continue ;
+    }
+
+    if ((sendGreeting (client) < 0) || ((local ? sendReady (client) : sendChallenge (client)) < 0))
+    {
+      logMsg ("Unable to send greeting message: %s", strerror (errno)) ;
+      closeClient (client) ;
+      continue ;
+    }
+
+    client->events = ev.events = EPOLLIN ;
+    ev.data.ptr    = client ;
+
+    if (epoll_ctl (epollFd, EPOLL_CTL_ADD, client->fd, &ev) < 0)
+    {
+      logMsg ("Unable to watch client: %s", strerror (errno)) ;
+      closeClient (client) ;
+      continue ;
+    }
+
+    if (client->authenticated)
+      ++numClients ;
+    else
+    {
+      pending [numPending].client   = client ;
+      pending [numPending].deadline = nowMs () + AUTH_TIMEOUT ;
+      ++numPending ;
+    }
+  }
+}
+
+
+/*
+ * expireClients:
+ *	Drop the network clients that have had their time to authenticate,
+ *	and return how long until the next one's is up, or -1 for none
+ *********************************************************************************
+ */
+
+static int expireClients (void)
+{
+  int64_t now = nowMs (), wait = -1 ;
+  int i ;
+
+  for (i = numPending - 1 ; i >= 0 ; --i)
+    if (pending [i].deadline <= now)
+      dropClient (pending [i].client, "Authentication timeout") ;
+
+  for (i = 0 ; i < numPending ; ++i)
+    if ((wait < 0) || (pending [i].deadline - now < wait))
+      wait = pending [i].deadline - now ;
+
+  return (int)wait ;
+}
+
+
+/*
+ * runServer:
+ *	The event loop. Clients are served one event at a time from this one
+ *	thread, so their commands never run into each other on the GPIO.
+ *	A client whose edge notifications can't be sent isn't dropped there
+ *	and then, as it may have an event of its own still to come in this
+ *	round; the failure shows up again as that, or the next one. While
+ *	any clients are busy, the loop doesn't wait, and each gets another
+ *	batch from its ring every time round. Nor does it wait past the
+ *	first authentication deadline.
+ *********************************************************************************
+ */
+
+static void runServer (int port, const char *password)
+{
+  struct epoll_event ev, events [MAX_CLIENTS + MAX_PENDING + 3] ;
+  struct clientStruct *client ;
+  int i, n, serverFd, localFd, edgeFd, timeout ;
+
+  if ((serverFd = setupServer (port)) < 0)
+  {
+    logMsg ("Unable to setup server: %s", strerror (errno)) ;
+    exit (EXIT_FAILURE) ;
+  }
+
+  if ((epollFd = epoll_create1 (EPOLL_CLOEXEC)) < 0)
+  {
+    logMsg ("Unable to create event loop: %s", strerror (errno)) ;
+    exit (EXIT_FAILURE) ;
+  }
+
+  ev.events   = EPOLLIN ;
+  ev.data.ptr = NULL ;			// The server itself
+  if (epoll_ctl (epollFd, EPOLL_CTL_ADD, serverFd, &ev) < 0)
+  {
+    logMsg ("Unable to watch server: %s", strerror (errno)) ;
+    exit (EXIT_FAILURE) ;
+  }
+
+  if (localPath != NULL)
+  {
+    ev.data.ptr = &localFd ;		// The UNIX socket
+    if (((localFd = setupLocalServer (localPath, localGroup)) < 0) ||
+	(epoll_ctl (epollFd, EPOLL_CTL_ADD, localFd, &ev) < 0))
+    {
+      logMsg ("Unable to setup local server on %s: %s", localPath, strerror (errno)) ;
+      exit (EXIT_FAILURE) ;
+    }
+  }
+
+  ev.data.ptr = &edgeFd ;		// Edges on watched pins
+  if (((edgeFd = edgeSetup ()) < 0) || (epoll_ctl (epollFd, EPOLL_CTL_ADD, edgeFd, &ev) < 0))
+  {
+    logMsg ("Unable to watch for edges: %s", strerror (errno)) ;
+    exit (EXIT_FAILURE) ;
+  }
+
+  if (!doDaemon)
+    printf ("-=-\nWaiting for connections...\n") ;
+
+  for (;;)
+  {
+    timeout = expireClients () ;
+    if (numBusy > 0)
+      timeout = 0 ;
+
+    if ((n = epoll_wait (epollFd, events, MAX_CLIENTS + MAX_PENDING + 3, timeout)) < 0)
+    {
+      if (errno == EINTR)
+	continue ;
+      logMsg ("Event loop failed: %s", strerror (errno)) ;
+      exit (EXIT_FAILURE) ;
+    }
+
+    for (i = 0 ; i < n ; ++i)
+    {
+      if ((client = events [i].data.ptr) == NULL)
+      {
+	newClients (FALSE) ;
+	continue ;
+      }
+
+      if (events [i].data.ptr == &localFd)
+      {
+	newClients (TRUE) ;
+	continue ;
+      }
+
+      if (events [i].data.ptr == &edgeFd)
+      {
+	edgeDispatch (flushClient) ;
+	continue ;
+      }
+
+      if (events [i].events & EPOLLOUT)
+      {
+	if (flushClient (client) < 0)
+	  dropClient (client, strerror (errno)) ;
+      }
+      else if (events [i].events & EPOLLIN)
+	readClient (client, password) ;
+      else if (events [i].events & (EPOLLERR | EPOLLHUP))
+	dropClient (client, "Connection lost") ;
+    }
+
+    for (i = numBusy - 1 ; i >= 0 ; --i)
+    {
+      client = busy [i] ;
+      runRemoteCommands (client) ;
+      setBusy (client, client->ringBusy) ;
+
+      if (flushClient (client) < 0)
+	dropClient (client, strerror (errno)) ;
+    }
+  }
+}
+
+
 /*
  * The works...
  *********************************************************************************
@@ -124,7 +539,6 @@ void setupSigHandler (void)
 
 int main (int argc, char *argv [])
 {
-  int clientFd ;
   char *p, *password ;
   int i ;
   int port = DEFAULT_SERVER_PORT ;
@@ -249,6 +663,50 @@ int main (int argc, char *argv [])
       continue ;
     }
 
+// -u to listen on a UNIX socket as well, for local clients
+
+    if (strcasecmp (argv [1], "-u") == 0)
+    {
+      localPath = DEFAULT_SERVER_SOCKET ;
+
+      if ((argc > 3) && (*argv [2] == '/'))	// Optional path, then the password
+      {
+	localPath = argv [2] ;
+	for (i = 2 ; i < argc ; ++i)
+	  argv [i - 1] = argv [i] ;
+	--argc ;
+      }
+
+      logMsg ("Listening on: %s", localPath) ;
+
+      for (i = 2 ; i < argc ; ++i)
+	argv [i - 1] = argv [i] ;
+      --argc ;
+
+      continue ;
+    }
+
+// -a to let a group in on the UNIX socket
+
+    if (strcasecmp (argv [1], "-a") == 0)
+    {
+      if (argc < 3)
+      {
+	logMsg ("-a missing group") ;
+	exit (EXIT_FAILURE) ;
+      }
+
+      localGroup = argv [2] ;
+
+// Shift args down by 2
+
+      for (i = 3 ; i < argc ; ++i)
+	argv [i - 2] = argv [i] ;
+      argc -= 2 ;
+
+      continue ;
+    }
+
 // Check for -x argument to load in a new extension
 //	-x extension:base:args
 //	Can load many modules to extend the daemon.
@@ -318,65 +776,8 @@ int main (int argc, char *argv [])
     *p = ' ' ;
 
   setupSigHandler () ;
- 
-// Enter our big loop
-
-  for (;;)
-  {
-
-    if (!doDaemon)
-      printf ("-=-\nWaiting for a new connection...\n") ;
-
-    if ((clientFd = setupServer (port)) < 0)
-    {
-      logMsg ("Unable to setup server: %s", strerror (errno)) ;
-      exit (EXIT_FAILURE) ;
-    }
-
-    logMsg ("New connection from: %s.", getClientIP ()) ;
-
-    if (!doDaemon)
-      printf ("Sending Greeting.\n") ;
-
-    if (sendGreeting (clientFd) < 0)
-    {
-      logMsg ("Unable to send greeting message: %s", strerror (errno)) ;
-      closeServer (clientFd) ;
-      continue ;
-    }
 
-    if (!doDaemon)
-      printf ("Sending Challenge.\n") ;
-
-    if (sendChallenge (clientFd) < 0)
-    {
-      logMsg ("Unable to send challenge message: %s", strerror (errno)) ;
-      closeServer (clientFd) ;
-      continue ;
-    }
-
-    if (!doDaemon)
-      printf ("Waiting for response.\n") ;
-
-    if (getResponse (clientFd) < 0)
-    {
-      logMsg ("Connection closed waiting for response: %s", strerror (errno)) ;
-      closeServer (clientFd) ;
-      continue ;
-    }
-
-    if (!passwordMatch (password))
-    {
-      logMsg ("Password failure") ;
-      closeServer (clientFd) ;
-      continue ;
-    }
-
-    logMsg ("Password OK - Starting") ;
-
-    runRemoteCommands (clientFd) ;
-    closeServer       (clientFd) ;
-  }
+  runServer (port, password) ;
 
   return 0 ;
 }